@@ -7,14 +7,19 @@
 #include <QFile>
 #include <QTimer>
 #include <QQueue>
+#include <QMap>
+#include <QHash>
 #include <QDateTime>
 #include <qqml.h>
+#include "server/include/transferpacer.h"
 
 class ImagePreviewProvider;
 
 struct UploadQueueItem {
     QString localPath;
     QString remotePath;
+    // Set when the server already holds part of the file from an earlier connection
+    QString uploadId;
 };
 
 class ConnectionManager : public QObject
@@ -65,18 +70,25 @@ public:
     Q_INVOKABLE void uploadFile(const QString &localPath, const QString &remotePath);
     Q_INVOKABLE void uploadFiles(const QStringList &localPaths, const QString &remoteDir);
     Q_INVOKABLE void downloadFile(const QString &remotePath, const QString &localPath);
+    Q_INVOKABLE void downloadFileRange(const QString &remotePath, const QString &localPath, qint64 offset, qint64 length);
     Q_INVOKABLE void downloadDirectory(const QString &remotePath, const QString &localPath);
     Q_INVOKABLE void moveItem(const QString &fromPath, const QString &toPath);
     Q_INVOKABLE void downloadMultiple(const QStringList &remotePaths, const QString &localPath, const QString &zipName);
     Q_INVOKABLE void deleteMultiple(const QStringList &paths);
     Q_INVOKABLE void renameItem(const QString &path, const QString &newName);
     Q_INVOKABLE void getFolderTree(const QString &path = "", int maxDepth = -1);
+    Q_INVOKABLE void getChildren(const QString &path);
+    // The tree no longer shows the children, the server stops sending their changes
+    Q_INVOKABLE void releaseChildren(const QString &path);
+    // Names matching the query anywhere below the folder, shown in place of its listing
+    Q_INVOKABLE void search(const QString &query, const QString &path);
     Q_INVOKABLE void generateShareLink(const QString &path);
     Q_INVOKABLE void getStorageInfo();
     Q_INVOKABLE void cancelUpload();
     Q_INVOKABLE void cancelAllUploads();
     Q_INVOKABLE void cancelDownload();
     Q_INVOKABLE void getServerInfo();
+    Q_INVOKABLE void getTransferStats();
     Q_INVOKABLE void moveMultiple(const QStringList &fromPaths, const QString &toPath);
     Q_INVOKABLE void createNewUser(const QString &userName, const QString &userPassword, const int &maxStorage, const bool &isAdmin);
     Q_INVOKABLE void editExistingUser(const QString &userName, const QString &userPassword, const int &maxStorage, const bool &isAdmin);
@@ -100,6 +112,7 @@ signals:
     void speedChanged();
 
     void directoryListed(const QString &path, const QVariantList &files);
+    void directoryBatchListed(const QString &path, const QVariantList &files);
     void directoryCreated(const QString &path);
     void fileDeleted(const QString &path);
     void directoryDeleted(const QString &path);
@@ -120,7 +133,12 @@ signals:
     void userListReceived(const QVariantList &users);
     void shareLinkGenerated(const QString &path, const QString &shareLink);
     void folderTreeReceived(const QVariantMap &tree);
+    void childrenReceived(const QVariantMap &data);
+    // A change made through any session of the same user, for a folder this one shows
+    void changeReceived(const QVariantMap &change);
+    void searchResultsReceived(const QVariantList &files, bool first);
     void multipleMoved(const QStringList &fromPaths, const QString &toPath);
+    void transferStatsReceived(const QVariantMap &stats);
 
 private slots:
     void onConnected();
@@ -140,22 +158,59 @@ private:
 
     enum class TransferType { None, Upload, Download };
 
-    void sendCommand(const QString &type, const QJsonObject &params);
+    struct ActiveUpload {
+        QString localPath;
+        QString remotePath;
+        QFile *file = nullptr;
+        qint64 totalSize = 0;
+        qint64 sentSize = 0;
+        qint64 ackedSize = 0;
+        int requestId = 0;
+        QString uploadId;
+    };
+
+    // A listing as last received, shown again when the server says its version is current
+    struct CachedListing {
+        QString version;
+        QVariantList files;
+        bool complete = false;
+    };
+
+    // A single file download whose bytes so far are kept in a .part file
+    struct PartialDownload {
+        QString remotePath;
+        QString localPath;
+        qint64 modified = 0;
+    };
+
+    int sendCommand(const QString &type, const QJsonObject &params);
     void handleResponse(const QJsonObject &response);
+    void handleDownloadData(quint32 streamId, QByteArrayView data);
     void setConnected(bool connected);
     void setAuthenticating(bool authenticating);
     void setAuthenticated(bool authenticated);
     void setStatusMessage(const QString &message);
-    void sendNextChunk();
+    void pumpUploads();
     void startNextUpload();
-    void cleanupCurrentUpload();
+    void closeUpload(quint32 streamId);
+    void closeAllUploads();
+    void requeueActiveUploads();
+    void clearUploadQueue();
+    void requestDownload(const QString &remotePath, const QString &localPath, const QJsonObject &range);
+    void finishCurrentDownload();
     void cleanupCurrentDownload();
+    void discardPartialDownload();
+    void cancelDownloadStream();
     void setCurrentUploadFileName(const QString &fileName);
     void setCurrentDownloadFileName(const QString &fileName);
     void setIsZipping(bool zipping);
     void setServerName(const QString &name);
     void setIsAdmin(const bool &isAdmin);
     void requestThumbnail(const QString &path);
+    void requestThumbnails(const QVariantList &files);
+    void emitChange(const QVariantMap &change);
+    void releaseHeldChanges();
+    void touchListing(const QString &key);
 
     void resetEtaTracking();
     void startEtaTracking(TransferType type, qint64 totalSize);
@@ -169,8 +224,10 @@ private:
     QWebSocket *m_socket;
     bool m_connected;
     bool m_authenticated;
+    bool m_cborEncoding;
     QString m_statusMessage;
     QString m_username;
+    QString m_serverUrl;
     QString m_password;
 
     QString m_downloadRemotePath;
@@ -179,15 +236,14 @@ private:
     QByteArray m_downloadBuffer;
     qint64 m_downloadExpectedSize;
     qint64 m_downloadReceivedSize;
+    bool m_downloadRanged;
+    PartialDownload m_partialDownload;
     QString m_currentDownloadFileName;
     bool m_isZipping;
 
     QQueue<UploadQueueItem> m_uploadQueue;
-    QString m_uploadLocalPath;
-    QString m_uploadRemotePath;
-    QFile *m_uploadFile;
-    qint64 m_uploadTotalSize;
-    qint64 m_uploadSentSize;
+    QMap<quint32, ActiveUpload> m_activeUploads;
+    quint32 m_lastUploadStream;
     QString m_currentUploadFileName;
     QString m_serverName;
     bool m_isAdmin;
@@ -210,8 +266,32 @@ private:
     double calculateMedianSpeed();
 
     static const qint64 CHUNK_SIZE = 1024 * 1024;
+    static const int MAX_PARALLEL_UPLOADS = 8;
+    static const int LIST_BATCH_SIZE = 500;
+    static const int LISTING_CACHE_SIZE = 16;
+    static const int SEARCH_PAGE_SIZE = 200;
+    static const int MAX_SEARCH_RESULTS = 1000;
+    static const qint64 DEFAULT_UPLOAD_WINDOW = 32 * 1024 * 1024;
+    qint64 m_uploadWindow;
+    qint64 m_uploadUnacked;
+    TransferPacer m_pacer;
 
     QTimer *m_connectionTimer;
+
+    int m_nextRequestId;
+    int m_listRequestId;
+    QString m_listKey;
+    QString m_listPath;
+    // Changes for the folder being listed wait until its last batch arrived
+    bool m_listPending;
+    QList<QVariantMap> m_heldChanges;
+    QHash<QString, CachedListing> m_listingCache;
+    QStringList m_listingOrder;
+    int m_searchRequestId;
+    int m_searchReceived;
+    int m_downloadRequestId;
+    quint32 m_nextStreamId;
+    quint32 m_downloadStreamId;
 };
 
 #endif // CONNECTIONMANAGER_H
@@ -2,7 +2,9 @@
 #define FILEMODEL_H
 
 #include <QAbstractListModel>
+#include <QCollator>
 #include <QJsonArray>
+#include <QSet>
 #include <qqml.h>
 
 struct FileItem {
@@ -44,6 +46,11 @@ public:
     QString currentPath() const { return m_currentPath; }
 
     Q_INVOKABLE void loadDirectory(const QString &path, const QVariantList &files);
+    Q_INVOKABLE void appendFiles(const QString &path, const QVariantList &files);
+    // Shows a page of search results in place of the current folder until it is listed again
+    Q_INVOKABLE void showSearchResults(const QVariantList &files, bool first);
+    // Applies a change pushed by the server when it concerns the current folder
+    Q_INVOKABLE void applyChange(const QVariantMap &change, bool foldersFirst);
     Q_INVOKABLE void clear();
     Q_INVOKABLE QString getParentPath() const;
     Q_INVOKABLE bool canGoUp() const;
@@ -61,9 +68,18 @@ private:
     static FileModel *s_instance;
 
     QList<FileItem> m_files;
+    // A change can arrive before the batch that lists the same entry
+    QSet<QString> m_paths;
     QString m_currentPath;
+    // Changes are not applied to search results, they are not a folder listing
+    bool m_showingResults;
+    QCollator m_collator;
 
     bool isImageFile(const QString &fileName) const;
+    FileItem toFileItem(const QVariant &value) const;
+    int findRow(const QString &path) const;
+    void removeFile(const QString &path);
+    void upsertFile(const FileItem &item, bool foldersFirst);
 };
 
 #endif // FILEMODEL_H
@@ -10,6 +10,9 @@ struct TreeNode {
     QString path;
     bool isExpanded = false;
     bool hasChildren = false;
+    // Children are asked for when the node is first expanded
+    bool childrenLoaded = false;
+    bool fetching = false;
     QList<TreeNode*> children;
     TreeNode* parent = nullptr;
 
@@ -42,14 +45,25 @@ public:
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
     QHash<int, QByteArray> roleNames() const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
 
     Q_INVOKABLE void loadTree(const QVariantMap &treeData);
+    Q_INVOKABLE void loadChildren(const QVariantMap &data);
+    // Applies a change pushed by the server to the folders already loaded
+    Q_INVOKABLE void applyChange(const QVariantMap &change);
+    Q_INVOKABLE void refresh();
     Q_INVOKABLE void toggleExpanded(const QString &path);
     Q_INVOKABLE void clear();
     Q_INVOKABLE int getMaxDepth() const;
     Q_INVOKABLE QStringList getExpandedPaths() const;
     Q_INVOKABLE void restoreExpandedPaths(const QStringList &paths);
 
+signals:
+    void childrenRequested(const QString &path);
+    // The children of a collapsed folder were dropped and are asked for again when it opens
+    void childrenReleased(const QString &path);
+
 private:
     explicit TreeModel(QObject *parent = nullptr);
     TreeModel(const TreeModel&) = delete;
@@ -64,6 +78,11 @@ private:
     void collectVisibleNodes(TreeNode* node, QList<TreeNode*>& result);
     int calculateMaxDepth(const TreeNode* node) const;
     void collectExpandedPaths(TreeNode* node, QStringList& paths) const;
+    void insertVisibleDescendants(TreeNode* node);
+    void removeVisibleDescendants(TreeNode* node);
+    void addNode(const QVariantMap &item);
+    void removeNode(const QString &path);
+    void notifyNodeChanged(TreeNode* node);
 
     static TreeModel *s_instance;
     TreeNode *m_rootNode;
@@ -480,14 +480,27 @@ Item {
 
             TextField {
                 id: filterField
+                property bool searched: false
                 visible: !UserSettings.compactSidePane
                 Layout.fillWidth: true
                 Layout.preferredHeight: 35
-                placeholderText: "Filter..."
-                onTextChanged: FilterProxyModel.filterText = text
                 Layout.leftMargin: 10
                 Layout.rightMargin: 10
                 Layout.bottomMargin: 6
+                placeholderText: "Filter, Enter to search subfolders..."
+                onTextChanged: {
+                    FilterProxyModel.filterText = text
+                    if (searched && text.trim() === "") {
+                        searched = false
+                        ConnectionManager.listDirectory(FileModel.currentPath, UserSettings.foldersFirst)
+                    }
+                }
+                onAccepted: {
+                    if (text.trim() !== "") {
+                        searched = true
+                        ConnectionManager.search(text.trim(), FileModel.currentPath)
+                    }
+                }
             }
 
             ColumnLayout {
@@ -68,8 +68,6 @@ CustomDialog {
                 textPreviewDialog.isSaving = false
                 textPreviewDialog.originalContent = textArea.text
                 textPreviewDialog.isModified = false
-                // Refresh the directory listing
-                ConnectionManager.listDirectory(FileModel.currentPath, UserSettings.foldersFirst)
             }
         }
 
@@ -35,15 +35,17 @@ ApplicationWindow {
         onActivated: Utils.focusSearch()
     }
 
-    function refreshTreeView() {
-        var expandedPaths = TreeModel.getExpandedPaths()
-        var maxDepth = Math.max(TreeModel.getMaxDepth() + 1, 2)
+    Connections {
+        target: TreeModel
 
-        ConnectionManager.getFolderTree("", maxDepth)
-        root.pendingExpandedPaths = expandedPaths
-    }
+        function onChildrenRequested(path) {
+            ConnectionManager.getChildren(path)
+        }
 
-    property var pendingExpandedPaths: []
+        function onChildrenReleased(path) {
+            ConnectionManager.releaseChildren(path)
+        }
+    }
 
     Connections {
         target: ConnectionManager
@@ -53,7 +55,8 @@ ApplicationWindow {
                 ConnectionManager.listDirectory("", UserSettings.foldersFirst)
                 ConnectionManager.getStorageInfo()
                 ConnectionManager.getServerInfo()
-                ConnectionManager.getFolderTree("", 2)
+                TreeModel.clear()
+                TreeModel.refresh()
                 Utils.clearNavigationHistory()
                 Utils.pushToHistory("")
             } else {
@@ -65,19 +68,8 @@ ApplicationWindow {
             }
         }
 
-        function onMultipleMoved(fromPaths, toPath) {
-            ConnectionManager.listDirectory(FileModel.currentPath, UserSettings.foldersFirst)
-            storageUpdateTimer.restart()
-            root.refreshTreeView()
-        }
-
-        function onFolderTreeReceived(tree) {
-            TreeModel.loadTree(tree)
-
-            if (root.pendingExpandedPaths.length > 0) {
-                TreeModel.restoreExpandedPaths(root.pendingExpandedPaths)
-                root.pendingExpandedPaths = []
-            }
+        function onChildrenReceived(data) {
+            TreeModel.loadChildren(data)
         }
 
         function onShareLinkGenerated(path, link) {
@@ -89,15 +81,26 @@ ApplicationWindow {
             downloadProgressDialog.open()
         }
 
-        function onItemRenamed(fromPath, newName) {
-            ConnectionManager.listDirectory(FileModel.currentPath, UserSettings.foldersFirst)
-            root.refreshTreeView()
+        // Changes from this session and every other one of the same user arrive here,
+        // the views are updated in place instead of listed again
+        function onChangeReceived(change) {
+            FileModel.applyChange(change, UserSettings.foldersFirst)
+            TreeModel.applyChange(change)
+            storageUpdateTimer.restart()
         }
 
         function onDirectoryListed(path, files) {
             FileModel.loadDirectory(path, files)
         }
 
+        function onDirectoryBatchListed(path, files) {
+            FileModel.appendFiles(path, files)
+        }
+
+        function onSearchResultsReceived(files, first) {
+            FileModel.showSearchResults(files, first)
+        }
+
         function onThumbnailReady(path) {
             FileModel.refreshThumbnail(path)
         }
@@ -120,9 +123,6 @@ ApplicationWindow {
         function onUploadComplete(path) {
             // This is only emitted when ALL uploads are done
             uploadProgressDialog.close()
-            ConnectionManager.listDirectory(FileModel.currentPath, UserSettings.foldersFirst)
-            storageUpdateTimer.restart()
-            root.refreshTreeView()
         }
 
         function onUploadQueueSizeChanged() {
@@ -141,34 +141,6 @@ ApplicationWindow {
             downloadProgressDialog.close()
         }
 
-        function onDirectoryCreated(path) {
-            ConnectionManager.listDirectory(FileModel.currentPath, UserSettings.foldersFirst)
-            root.refreshTreeView()
-        }
-
-        function onFileDeleted(path) {
-            ConnectionManager.listDirectory(FileModel.currentPath, UserSettings.foldersFirst)
-            storageUpdateTimer.restart()
-        }
-
-        function onDirectoryDeleted(path) {
-            ConnectionManager.listDirectory(FileModel.currentPath, UserSettings.foldersFirst)
-            storageUpdateTimer.restart()
-            root.refreshTreeView()
-        }
-
-        function onMultipleDeleted() {
-            ConnectionManager.listDirectory(FileModel.currentPath, UserSettings.foldersFirst)
-            storageUpdateTimer.restart()
-            root.refreshTreeView()
-        }
-
-        function onItemMoved(fromPath, toPath) {
-            ConnectionManager.listDirectory(FileModel.currentPath, UserSettings.foldersFirst)
-            storageUpdateTimer.restart()
-            root.refreshTreeView()
-        }
-
         function onStorageInfo(total, used, available) {
             Utils.storagePercentage = used / total
             Utils.storageOccupied = Utils.formatStorage(used)
@@ -0,0 +1,19 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <functional>
+
+// Benchmarks of the server internals, built with -DODZN_BUILD_BENCH=ON. Each one prints
+// its own table. OdznDriveServerBench runs them all, or only those named on the command line
+namespace Bench {
+
+void encoding();
+void deflate();
+void paths();
+
+// Fastest of several runs in milliseconds, after one run that is not counted
+double bestOf(int runs, const std::function<void()> &body);
+
+}
+
+#endif // BENCH_H
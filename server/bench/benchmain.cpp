@@ -0,0 +1,71 @@
+#include "bench.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QList>
+#include <QSettings>
+#include <cstdio>
+#include <utility>
+
+namespace Bench {
+
+double bestOf(int runs, const std::function<void()> &body)
+{
+    body();
+
+    double best = -1;
+    for (int i = 0; i < runs; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        body();
+        double elapsed = timer.nsecsElapsed() / 1e6;
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    // Settings of its own, with the caches off so repeated runs measure the same work
+    QCoreApplication::setOrganizationName("Odizinne");
+    QCoreApplication::setApplicationName("OdznDriveServerBench");
+    {
+        QSettings settings;
+        settings.setValue("server/archiveCacheSize", 0);
+        settings.setValue("server/deflateCacheSize", 0);
+    }
+
+    const QList<std::pair<QString, std::function<void()>>> benches = {
+        { "encoding", Bench::encoding },
+        { "deflate", Bench::deflate },
+        { "paths", Bench::paths },
+    };
+
+    QStringList selected = app.arguments().mid(1);
+    for (const QString &name : std::as_const(selected)) {
+        bool known = false;
+        for (const auto &bench : benches) {
+            known = known || bench.first == name;
+        }
+        if (!known) {
+            std::fprintf(stderr, "Unknown benchmark %s, available:", qPrintable(name));
+            for (const auto &bench : benches) {
+                std::fprintf(stderr, " %s", qPrintable(bench.first));
+            }
+            std::fprintf(stderr, "\n");
+            return 1;
+        }
+    }
+
+    for (const auto &bench : benches) {
+        if (selected.isEmpty() || selected.contains(bench.first)) {
+            bench.second();
+        }
+    }
+    return 0;
+}
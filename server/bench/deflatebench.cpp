@@ -0,0 +1,124 @@
+#include "bench.h"
+#include "archivesink.h"
+#include "zipstreamwriter.h"
+#include <QDir>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QThreadPool>
+#include <cstdio>
+
+// Zip archives of a synthetic tree at several levels and compression pool sizes. The tree
+// holds many small text files and one large one, which only parallel blocks can spread
+// over the cores
+
+static const int FOLDERS = 4;
+static const int FILES_PER_FOLDER = 6;
+static const qint64 SMALL_FILE_SIZE = 2 * 1024 * 1024;
+static const qint64 LARGE_FILE_SIZE = 16 * 1024 * 1024;
+static const int RUNS = 3;
+
+// Counts what would have gone to the connection
+class NullSink : public ArchiveSink
+{
+public:
+    bool write(const QByteArray &data) override
+    {
+        m_size += data.size();
+        return true;
+    }
+    bool isCancelled() const override { return false; }
+
+    qint64 m_size = 0;
+};
+
+static QByteArray text(qint64 size, QRandomGenerator &random)
+{
+    static const char *words[] = {
+        "archive", "folder", "upload", "server", "client", "listing", "thumbnail", "storage",
+        "session", "stream", "block", "index", "quota", "share", "link", "preview"
+    };
+
+    QByteArray data;
+    data.reserve(size + 16);
+    while (data.size() < size) {
+        data.append(words[random.bounded(16)]);
+        data.append(random.bounded(12) == 0 ? '\n' : ' ');
+    }
+    data.truncate(size);
+    return data;
+}
+
+static bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+void Bench::deflate()
+{
+    QTemporaryDir dir;
+    QRandomGenerator random(12345);
+    QString treePath = dir.filePath("tree");
+
+    qint64 total = 0;
+    for (int folder = 0; folder < FOLDERS; ++folder) {
+        QString folderPath = treePath + QString("/folder %1").arg(folder);
+        QDir().mkpath(folderPath);
+        for (int i = 0; i < FILES_PER_FOLDER; ++i) {
+            if (!writeFile(folderPath + QString("/notes %1.txt").arg(i), text(SMALL_FILE_SIZE, random))) {
+                std::fprintf(stderr, "Failed to write the synthetic tree\n");
+                return;
+            }
+            total += SMALL_FILE_SIZE;
+        }
+    }
+    if (!writeFile(treePath + "/large.log", text(LARGE_FILE_SIZE, random))) {
+        std::fprintf(stderr, "Failed to write the synthetic tree\n");
+        return;
+    }
+    total += LARGE_FILE_SIZE;
+
+    QList<ZipEntry> entries;
+    ZipStreamWriter::collectEntries(treePath, dir.path(), entries);
+
+    QList<int> threadCounts = { 1, 2, 4 };
+    int cores = QThread::idealThreadCount();
+    if (cores > 4) {
+        threadCounts.append(cores);
+    }
+
+    std::printf("\nZip of %lld files, %lld MiB, best of %d runs\n", qint64(entries.size()), total / (1024 * 1024), RUNS);
+    std::printf("%-6s %-8s %10s %10s %12s\n", "level", "threads", "ms", "MiB/s", "bytes");
+
+    QThreadPool *pool = ZipStreamWriter::compressionPool();
+    int configuredThreads = pool->maxThreadCount();
+
+    for (int level : { 1, 6, 9 }) {
+        for (int threads : std::as_const(threadCounts)) {
+            // Blocks in flight follow the pool size, which a writer reads when it is created
+            pool->setMaxThreadCount(threads);
+
+            qint64 size = 0;
+            bool ok = true;
+            double ms = Bench::bestOf(RUNS, [&]() {
+                NullSink sink;
+                ZipStreamWriter writer(&sink, level);
+                for (const ZipEntry &entry : std::as_const(entries)) {
+                    ok = ok && writer.addEntry(entry);
+                }
+                ok = ok && writer.finish();
+                size = sink.m_size;
+            });
+
+            if (!ok) {
+                std::fprintf(stderr, "Archive failed at level %d with %d threads\n", level, threads);
+                continue;
+            }
+            std::printf("%-6d %-8d %10.1f %10.1f %12lld\n", level, threads, ms, total / (1024.0 * 1024.0) / (ms / 1000.0), size);
+        }
+    }
+
+    pool->setMaxThreadCount(configuredThreads);
+}
@@ -0,0 +1,122 @@
+#include "bench.h"
+#include "protocol.h"
+#include <QCborMap>
+#include <QCborValue>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QVariantList>
+#include <cstdio>
+
+// JSON text frames against CBOR binary frames for the largest responses the server
+// sends, encoded as ClientConnection::sendResponse does and decoded as the client does
+
+static const int LISTING_ENTRIES = 60000;
+static const int TREE_FANOUT = 12;
+static const int TREE_DEPTH = 4;
+static const int RUNS = 5;
+
+static QJsonObject wrap(const QString &type, const QJsonObject &data)
+{
+    QJsonObject response;
+    response["type"] = type;
+    response["data"] = data;
+    response[Protocol::Fields::REQUEST_ID] = 1;
+    return response;
+}
+
+static QJsonObject listingResponse()
+{
+    QString modified = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+
+    QJsonArray files;
+    for (int i = 0; i < LISTING_ENTRIES; ++i) {
+        bool isDir = i % 10 == 0;
+        QString name = isDir ? QString("folder %1").arg(i) : QString("IMG_%1.jpg").arg(i, 6, 10, QChar('0'));
+
+        QJsonObject item;
+        item["name"] = name;
+        item["isDir"] = isDir;
+        item["size"] = isDir ? 0 : qint64(i) * 4099;
+        item["modified"] = modified;
+        item["path"] = "Photos/2024/" + name;
+        if (!isDir) {
+            item["previewUrl"] = "preview://Photos/2024/" + name;
+        }
+        files.append(item);
+    }
+
+    QJsonObject data;
+    data["path"] = "Photos/2024";
+    data["files"] = files;
+    data["offset"] = 0;
+    data["total"] = LISTING_ENTRIES;
+    data["nextCursor"] = QString();
+    return wrap(Protocol::Responses::LIST_DIRECTORY, data);
+}
+
+static QJsonObject treeNode(const QString &path, const QString &name, int depth)
+{
+    QJsonObject node;
+    node["name"] = name;
+    node["path"] = path;
+
+    QJsonArray children;
+    if (depth > 0) {
+        for (int i = 0; i < TREE_FANOUT; ++i) {
+            QString childName = QString("Folder %1").arg(i);
+            children.append(treeNode(path.isEmpty() ? childName : path + '/' + childName, childName, depth - 1));
+        }
+    }
+    node["children"] = children;
+    return node;
+}
+
+static QJsonObject treeResponse()
+{
+    QJsonObject data;
+    data["tree"] = treeNode(QString(), "Root", TREE_DEPTH);
+    return wrap(Protocol::Responses::FOLDER_TREE, data);
+}
+
+static void compare(const char *label, const QJsonObject &response, const std::function<void(const QJsonObject&)> &consume)
+{
+    QString text;
+    QByteArray frame;
+
+    double jsonEncode = Bench::bestOf(RUNS, [&]() {
+        text = QString::fromUtf8(QJsonDocument(response).toJson(QJsonDocument::Compact));
+    });
+    double jsonDecode = Bench::bestOf(RUNS, [&]() {
+        QJsonDocument doc = QJsonDocument::fromJson(text.toUtf8());
+        consume(doc.object());
+    });
+
+    double cborEncode = Bench::bestOf(RUNS, [&]() {
+        frame = QByteArray(1, Protocol::Frames::CONTROL);
+        frame.append(QCborValue::fromJsonValue(response).toCbor());
+    });
+    double cborDecode = Bench::bestOf(RUNS, [&]() {
+        QCborValue value = QCborValue::fromCbor(frame.constData() + 1, frame.size() - 1);
+        consume(value.toMap().toJsonObject());
+    });
+
+    std::printf("%-16s %-5s %10.1f %10.1f %12lld\n", label, "json", jsonEncode, jsonDecode, qint64(text.toUtf8().size()));
+    std::printf("%-16s %-5s %10.1f %10.1f %12lld\n", label, "cbor", cborEncode, cborDecode, qint64(frame.size()));
+}
+
+void Bench::encoding()
+{
+    std::printf("\nControl message encoding, best of %d runs\n", RUNS);
+    std::printf("%-16s %-5s %10s %10s %12s\n", "response", "enc", "encode ms", "decode ms", "bytes");
+
+    compare("list_directory", listingResponse(), [](const QJsonObject &response) {
+        QVariantList files = response["data"].toObject()["files"].toArray().toVariantList();
+        Q_UNUSED(files)
+    });
+    compare("folder_tree", treeResponse(), [](const QJsonObject &response) {
+        QVariantMap tree = response["data"].toObject()["tree"].toObject().toVariantMap();
+        Q_UNUSED(tree)
+    });
+}
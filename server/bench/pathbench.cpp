@@ -0,0 +1,108 @@
+#include "bench.h"
+#include "pathresolver.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <cstdio>
+
+// Cost of one path check: the realpath check isValidPath used before, openat2 with
+// RESOLVE_BENEATH, and the canonical fallback with its folder cache and without it.
+// Paths are a few levels deep and checked several times, as one operation does
+
+static const int DEPTH = 5;
+static const int FOLDERS = 40;
+static const int FILES_PER_FOLDER = 25;
+static const int CHECKS_PER_PATH = 3;
+static const int RUNS = 5;
+
+// FileManager::isValidPath before PathResolver
+static bool realpathCheck(const QString &rootPath, const QString &relativePath)
+{
+    QString absPath = rootPath + "/" + relativePath;
+    QString canonicalPath = QFileInfo(absPath).canonicalFilePath();
+    if (canonicalPath.isEmpty()) {
+        canonicalPath = QDir(absPath).absolutePath();
+    }
+    return canonicalPath.startsWith(rootPath);
+}
+
+static void report(const char *label, double ms, qint64 checks, bool ok)
+{
+    std::printf("%-24s %10.1f %12.2f %s\n", label, ms, ms * 1000.0 / checks, ok ? "" : "(rejected a valid path)");
+}
+
+void Bench::paths()
+{
+    QTemporaryDir dir;
+    QString rootPath = QFileInfo(dir.path()).canonicalFilePath();
+
+    QStringList paths;
+    for (int folder = 0; folder < FOLDERS; ++folder) {
+        QString folderPath;
+        for (int level = 0; level < DEPTH; ++level) {
+            folderPath += QString("%1level %2").arg(folderPath.isEmpty() ? "" : "/").arg(level);
+        }
+        folderPath += QString("/folder %1").arg(folder);
+        QDir().mkpath(rootPath + "/" + folderPath);
+
+        for (int i = 0; i < FILES_PER_FOLDER; ++i) {
+            QString path = folderPath + QString("/file %1.txt").arg(i);
+            QFile file(rootPath + "/" + path);
+            if (!file.open(QIODevice::WriteOnly)) {
+                std::fprintf(stderr, "Failed to write the synthetic tree\n");
+                return;
+            }
+            paths.append(path);
+        }
+    }
+
+    qint64 checks = qint64(paths.size()) * CHECKS_PER_PATH;
+    std::printf("\nPath checks, %lld per run over %lld paths %d levels deep, best of %d runs\n",
+                checks, qint64(paths.size()), DEPTH + 2, RUNS);
+    std::printf("%-24s %10s %12s\n", "method", "ms", "us/check");
+
+    bool ok = true;
+    double ms = Bench::bestOf(RUNS, [&]() {
+        for (const QString &path : std::as_const(paths)) {
+            for (int i = 0; i < CHECKS_PER_PATH; ++i) {
+                ok = realpathCheck(rootPath, path) && ok;
+            }
+        }
+    });
+    report("realpath (before)", ms, checks, ok);
+
+    PathResolver kernel(rootPath);
+    ok = true;
+    ms = Bench::bestOf(RUNS, [&]() {
+        for (const QString &path : std::as_const(paths)) {
+            for (int i = 0; i < CHECKS_PER_PATH; ++i) {
+                ok = kernel.isBeneath(path) && ok;
+            }
+        }
+    });
+    report("openat2 beneath", ms, checks, ok);
+
+    PathResolver cached(rootPath, false);
+    ok = true;
+    ms = Bench::bestOf(RUNS, [&]() {
+        for (const QString &path : std::as_const(paths)) {
+            for (int i = 0; i < CHECKS_PER_PATH; ++i) {
+                ok = cached.isBeneath(path) && ok;
+            }
+        }
+    });
+    report("canonical, folder cache", ms, checks, ok);
+
+    PathResolver uncached(rootPath, false);
+    ok = true;
+    ms = Bench::bestOf(RUNS, [&]() {
+        for (const QString &path : std::as_const(paths)) {
+            for (int i = 0; i < CHECKS_PER_PATH; ++i) {
+                uncached.invalidate(QString());
+                ok = uncached.isBeneath(path) && ok;
+            }
+        }
+    });
+    report("canonical, no cache", ms, checks, ok);
+}
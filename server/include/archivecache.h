@@ -0,0 +1,102 @@
+#ifndef ARCHIVECACHE_H
+#define ARCHIVECACHE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <functional>
+#include <memory>
+#include "archivesink.h"
+#include "zipstreamwriter.h"
+
+class ArchivePipe;
+
+// Keeps generated archives in a spool directory, keyed by a signature of the files
+// that went into them, and drops the least recently used ones beyond
+// server/archiveCacheSize. Asking for an archive that is still being built waits
+// for that build instead of compressing the same files twice.
+class ArchiveCache
+{
+public:
+    // Called once the build a pipe joined is over, with the archive or with nothing
+    // when it could not be cached and the waiter has to produce the archive itself
+    using Handover = std::function<void(const QString &filePath)>;
+
+    // Written by the job building an archive. Data goes to the spool file and to the
+    // connection of that job, and keeps going while another connection waits for it
+    class Build : public ArchiveSink
+    {
+    public:
+        Build(const QByteArray &key, const QString &spoolPath, qint64 spoolLimit, std::shared_ptr<ArchivePipe> pipe);
+
+        bool write(const QByteArray &data) override;
+        bool isCancelled() const override;
+
+    private:
+        friend class ArchiveCache;
+
+        struct Waiter {
+            std::shared_ptr<ArchivePipe> pipe;
+            Handover handover;
+        };
+
+        bool hasWaitersLocked() const;
+        // Gives up on the spool and sends the waiters off to build on their own
+        void dropSpool();
+
+        QByteArray m_key;
+        QFile m_spool;
+        qint64 m_spoolLimit;
+        bool m_spoolFailed;
+        std::shared_ptr<ArchivePipe> m_pipe;
+
+        mutable QMutex m_mutex;
+        QList<Waiter> m_waiters;
+    };
+
+    // A cached file, a build for the caller to produce, or neither when the pipe
+    // joined a build in progress and gets handed over once it is done
+    struct Lookup {
+        QString filePath;
+        std::shared_ptr<Build> build;
+    };
+
+    static ArchiveCache& instance();
+
+    static QByteArray signature(const QList<ZipEntry> &entries, const QString &format, int compressionLevel);
+
+    bool isEnabled() const;
+    // Whether an archive of that many source bytes may go through the spool at all
+    bool accepts(qint64 sourceBytes) const;
+    Lookup acquire(const QByteArray &key, std::shared_ptr<ArchivePipe> pipe, Handover handover);
+    void complete(const std::shared_ptr<Build> &build, bool success);
+
+private:
+    struct CachedArchive {
+        QString filePath;
+        qint64 size = 0;
+        qint64 lastUsed = 0;
+    };
+
+    ArchiveCache();
+    ArchiveCache(const ArchiveCache&) = delete;
+    ArchiveCache& operator=(const ArchiveCache&) = delete;
+
+    void load();
+    // Stops new pipes from joining the build, complete still has to be called
+    void release(const Build *build);
+    static void handOver(const QList<Build::Waiter> &waiters, const QString &filePath);
+    void evictLocked();
+
+    mutable QMutex m_mutex;
+    QString m_directory;
+    qint64 m_budget;
+    qint64 m_totalSize;
+    QHash<QByteArray, CachedArchive> m_archives;
+    QHash<QByteArray, std::shared_ptr<Build>> m_builds;
+};
+
+#endif // ARCHIVECACHE_H
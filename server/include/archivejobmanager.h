@@ -0,0 +1,79 @@
+#ifndef ARCHIVEJOBMANAGER_H
+#define ARCHIVEJOBMANAGER_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadPool>
+#include <functional>
+#include <memory>
+#include <optional>
+#include "zipstreamwriter.h"
+
+class ArchivePipe;
+
+enum class ArchiveFormat {
+    Zip,
+    Tar,
+    TarGz
+};
+
+struct ArchiveProgress {
+    quint64 jobId = 0;
+    qint64 filesDone = 0;
+    qint64 totalFiles = 0;
+    qint64 bytesDone = 0;
+    qint64 totalBytes = 0;
+};
+
+// Generates the archives of every connection on a pool of its own. At most
+// server/maxArchiveJobs run at once, the others wait their turn. Cancelling a
+// job stops it at the next block it reads, or before it starts when still queued.
+class ArchiveJobManager
+{
+public:
+    using ProgressCallback = std::function<void(const ArchiveProgress&)>;
+
+    static ArchiveJobManager& instance();
+
+    // Accepts "zip" (also the default when empty), "tar" and "tar.gz" or "tgz"
+    static std::optional<ArchiveFormat> parseFormat(const QString &name);
+    static QString formatExtension(ArchiveFormat format);
+
+    // The callback runs on the job's thread and must only post to its receiver.
+    // The first report comes once the files are listed, with nothing done yet
+    quint64 submit(std::shared_ptr<ArchivePipe> pipe, const QStringList &absPaths, const QString &baseDir,
+                   ArchiveFormat format, int compressionLevel, ProgressCallback onProgress);
+    void cancel(quint64 jobId);
+    void shutdown();
+
+private:
+    struct Job {
+        quint64 id = 0;
+        std::shared_ptr<ArchivePipe> pipe;
+        QStringList absPaths;
+        QString baseDir;
+        ArchiveFormat format = ArchiveFormat::Zip;
+        int compressionLevel = 0;
+        ProgressCallback onProgress;
+        QAtomicInt cancelled;
+    };
+
+    ArchiveJobManager();
+    ArchiveJobManager(const ArchiveJobManager&) = delete;
+    ArchiveJobManager& operator=(const ArchiveJobManager&) = delete;
+
+    // False when the job joined a build of the same archive and is not done yet
+    bool run(const std::shared_ptr<Job> &job, bool useCache);
+    void report(const std::shared_ptr<Job> &job, const ArchiveProgress &progress);
+    void remove(quint64 jobId);
+    static void logStats(quint64 jobId, const ZipStreamWriter::Stats &stats);
+
+    QThreadPool m_pool;
+    QMutex m_mutex;
+    QHash<quint64, std::shared_ptr<Job>> m_jobs;
+    quint64 m_nextJobId;
+};
+
+#endif // ARCHIVEJOBMANAGER_H
@@ -0,0 +1,68 @@
+#ifndef ARCHIVEPIPE_H
+#define ARCHIVEPIPE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <functional>
+#include <memory>
+#include "archivesink.h"
+
+class DownloadSource;
+
+// Bounded buffer between an archive being generated on a pool thread and the
+// connection sending it. The producer blocks while the buffer is full, so an
+// archive is never produced faster than the client downloads it.
+class ArchivePipe : public ArchiveSink
+{
+public:
+    static const qint64 DEFAULT_CAPACITY = 16 * 1024 * 1024;
+
+    explicit ArchivePipe(qint64 capacity = DEFAULT_CAPACITY);
+    ~ArchivePipe();
+
+    // Producer side. write() returns false once the consumer cancelled
+    bool write(const QByteArray &data) override;
+    void start(qint64 totalSize);
+    void finish(bool success, const QString &error = QString());
+    bool isCancelled() const override;
+
+    // Hands the consumer an archive that already exists on disk, in place of start() and finish()
+    bool serveFile(const QString &filePath);
+
+    // Consumer side, never blocks. -1 as total size means unknown
+    qint64 read(char *dst, qint64 maxLength);
+    bool isStarted() const;
+    qint64 totalSize() const;
+    bool atEnd() const;
+    bool succeeded() const;
+    QString errorString() const;
+    void cancel();
+
+    // Called on the producer thread whenever the consumer may continue. Must only post
+    // to the consumer, it runs with the pipe locked
+    void setReadyCallback(std::function<void()> callback);
+
+private:
+    void notifyLocked();
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_notFull;
+    QList<QByteArray> m_chunks;
+    std::unique_ptr<DownloadSource> m_source;
+    qint64 m_sourceRead;
+    qint64 m_readOffset;
+    qint64 m_buffered;
+    qint64 m_capacity;
+    qint64 m_totalSize;
+    bool m_started;
+    bool m_finished;
+    bool m_success;
+    bool m_cancelled;
+    QString m_error;
+    std::function<void()> m_readyCallback;
+};
+
+#endif // ARCHIVEPIPE_H
@@ -0,0 +1,17 @@
+#ifndef ARCHIVESINK_H
+#define ARCHIVESINK_H
+
+#include <QByteArray>
+
+// Where a generated archive goes: straight to a connection, or also to the archive cache
+class ArchiveSink
+{
+public:
+    virtual ~ArchiveSink() = default;
+
+    // Returns false once nobody is interested in the archive anymore
+    virtual bool write(const QByteArray &data) = 0;
+    virtual bool isCancelled() const = 0;
+};
+
+#endif // ARCHIVESINK_H
@@ -0,0 +1,56 @@
+#ifndef CHANGENOTIFIER_H
+#define CHANGENOTIFIER_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+
+class ClientConnection;
+
+// Tells every connection on a storage root about changes made through any of them,
+// so other sessions of the same user see them without listing again. A connection
+// only hears about the folder it last listed and the folders loaded in its tree
+class ChangeNotifier
+{
+public:
+    static ChangeNotifier& instance();
+
+    void attach(ClientConnection *connection, const QString &rootPath);
+    void detach(ClientConnection *connection);
+    void setListedFolder(ClientConnection *connection, const QString &path);
+    void addTreeFolder(ClientConnection *connection, const QString &path);
+    // Drops the folder and everything below it from the tree of the connection
+    void removeTreeFolder(ClientConnection *connection, const QString &path);
+
+    void created(const QString &rootPath, const QString &path);
+    void changed(const QString &rootPath, const QString &path);
+    void deleted(const QString &rootPath, const QString &path);
+    void moved(const QString &rootPath, const QString &fromPath, const QString &toPath);
+    void renamed(const QString &rootPath, const QString &fromPath, const QString &toPath);
+
+private:
+    struct Subscriber {
+        QString rootPath;
+        QString listedFolder;
+        QSet<QString> treeFolders;
+    };
+
+    ChangeNotifier() = default;
+    ChangeNotifier(const ChangeNotifier&) = delete;
+    ChangeNotifier& operator=(const ChangeNotifier&) = delete;
+
+    static QString normalize(const QString &path);
+    static QString parentOf(const QString &path);
+    static QJsonObject describe(const QString &rootPath, const QString &path);
+    static bool concerns(const Subscriber &subscriber, const QString &path, bool isDir);
+    static void removeTreeFolders(Subscriber &subscriber, const QString &path);
+
+    void publish(const QString &rootPath, const QString &kind, const QString &path, const QString &toPath);
+
+    QMutex m_mutex;
+    QHash<ClientConnection*, Subscriber> m_subscribers;
+};
+
+#endif // CHANGENOTIFIER_H
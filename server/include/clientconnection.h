@@ -6,8 +6,18 @@
 #include <QFile>
 #include <QTimer>
 #include <QProcess>
+#include <QJsonObject>
+#include <QHash>
+#include <QMap>
+#include <QElapsedTimer>
+#include <functional>
 #include "filemanager.h"
 #include "httpserver.h"
+#include "transferpacer.h"
+#include "downloadsource.h"
+#include "diskwriter.h"
+#include "archivepipe.h"
+#include "archivejobmanager.h"
 
 class HttpServer;
 
@@ -21,6 +31,9 @@ public:
 
     void setHttpServer(HttpServer *httpServer);
 
+    // Pushes a change made through any connection of the same storage root
+    void sendChange(const QJsonObject &change);
+
     enum class AuthResult {
         Success,
         UnknownUser,
@@ -40,11 +53,53 @@ private slots:
     void onAuthDelayTimeout();
     void sendPing();
     void onPongTimeout();
+    void onUploadWritten(quint64 writerId, qint64 bytes);
+    void onUploadWriteFailed(quint64 writerId, const QString &error);
+    void onUploadClosed(quint64 writerId, bool success);
 
 private:
+    struct CommandReply {
+        QString type;
+        QJsonObject data;
+    };
+
+    struct UploadStream {
+        QString path;
+        QString sessionId;
+        QString targetPath;
+        quint64 writerId = 0;
+        qint64 expectedSize = 0;
+        qint64 receivedSize = 0;
+        qint64 writtenSize = 0;
+        bool committing = false;
+        QJsonValue requestId;
+    };
+
+    struct DownloadStream {
+        QString path;
+        DownloadSource *source = nullptr;
+        // Archives are generated while they are sent, download_start waits for the producer
+        std::shared_ptr<ArchivePipe> pipe;
+        quint64 archiveJobId = 0;
+        bool announced = true;
+        qint64 totalSize = 0;
+        qint64 sentSize = 0;
+        QJsonValue requestId;
+    };
+
     void handleCommand(const QJsonObject &command);
+    void handleControlFrame(QByteArrayView payload);
+    void writeUploadData(quint32 streamId, QByteArrayView payload);
+    void dispatchCommand(const QString &type, const QJsonObject &params);
     void sendResponse(const QString &type, const QJsonObject &data);
+    void sendResponse(const QString &type, const QJsonObject &data, const QJsonValue &requestId);
     void sendError(const QString &message);
+    void sendError(const QString &message, const QJsonValue &requestId);
+    void runAsync(const std::function<CommandReply()> &job);
+    // Same as runAsync for commands answered with several messages, each reply is sent as soon as the job emits it
+    using ReplySink = std::function<void(const CommandReply&)>;
+    void runAsyncStream(const std::function<void(const ReplySink&)> &job);
+    static CommandReply errorReply(const QString &message);
 
     AuthResult authenticate(const QString &username, const QString &password, const QString &clientVersion, QString &errorMessage);
     void handleAuthenticate(const QJsonObject &params);
@@ -55,6 +110,7 @@ private:
     void handleDownloadFile(const QJsonObject &params);
     void handleDownloadDirectory(const QJsonObject &params);
     void handleUploadFile(const QJsonObject &params);
+    void handleResumeUpload(const QJsonObject &params);
     void handleCancelUpload(const QJsonObject &params);
     void handleCancelDownload(const QJsonObject &params);
     void handleMoveItem(const QJsonObject &params);
@@ -64,43 +120,61 @@ private:
     void handleRenameItem(const QJsonObject &params);
     void handleGetStorageInfo();
     void handleGetServerInfo();
+    void handleGetTransferStats();
     void handleCreateUser(const QJsonObject &params);
     void handleEditUser(const QJsonObject &params);
     void handleDeleteUser(const QJsonObject &params);
     void handleGetUserList(const QJsonObject &params);
     void handleGenerateShareLink(const QJsonObject &params);
     void handleGetFolderTree(const QJsonObject &params);
+    void handleGetChildren(const QJsonObject &params);
+    void handleReleaseChildren(const QJsonObject &params);
+    void handleSearch(const QJsonObject &params);
     void handlePong(const QJsonObject &params);
     void handleMoveMultiple(const QJsonObject &params);
     void handleUploadFolder(const QJsonObject &params);
     void handleUploadMixed(const QJsonObject &params);
 
-    void sendNextDownloadChunk();
-    void cleanupDownload();
+    bool isDownloadStreamBusy(quint32 streamId) const;
+    void startArchiveDownload(quint32 streamId, const QString &zipFileName, ArchiveFormat format,
+                              const QStringList &absPaths, const QString &baseDir);
+    void sendArchiveProgress(quint32 streamId, const ArchiveProgress &progress);
+    void pumpDownloads();
+    void closeDownload(quint32 streamId);
+    bool isUploadStreamBusy(quint32 streamId);
+    void completeUpload(quint32 streamId);
+    void closeUpload(quint32 streamId, bool discard);
+    QHash<quint32, UploadStream>::iterator findUploadByWriter(quint64 writerId);
 
     QWebSocket *m_socket;
     FileManager *m_fileManager;
     bool m_authenticated;
+    bool m_cborEncoding;
     QString m_currentUsername;
     HttpServer *m_httpServer;
+    QJsonValue m_currentRequestId;
 
-    QString m_uploadPath;
-    QFile *m_uploadFile;
-    qint64 m_uploadExpectedSize;
-    qint64 m_uploadReceivedSize;
-
-    QString m_downloadPath;
-    QFile *m_downloadFile;
-    qint64 m_downloadTotalSize;
-    qint64 m_downloadSentSize;
-    bool m_isZipDownload;
+    QHash<quint32, UploadStream> m_uploads;
+    QMap<quint32, DownloadStream> m_downloads;
+    quint32 m_lastDownloadStream;
+    QByteArray m_frameBuffer;
 
     QTimer *m_authDelayTimer;
     QString m_pendingAuthUsername;
     QString m_pendingAuthPassword;
     QString m_pendingAuthClientVersion;
+    QJsonValue m_pendingAuthRequestId;
+
+    static const int MAX_STREAMS = 64;
+    static const qint64 WRITE_WINDOW = 32 * 1024 * 1024;
+
+    DiskWriter *m_diskWriter;
+    qint64 m_pendingWriteBytes;
+    static const int RTT_PROBE_INTERVAL = 5000;
 
-    static const qint64 CHUNK_SIZE = 1024 * 1024;
+    TransferPacer m_pacer;
+    QElapsedTimer m_pingSentTimer;
+    bool m_rttProbePending;
 
     QTimer *m_pingTimer;
     QTimer *m_pongTimeoutTimer;
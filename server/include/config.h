@@ -7,6 +7,8 @@
 #include <QMap>
 #include <QDateTime>
 #include <QList>
+#include <QRecursiveMutex>
+#include <optional>
 
 struct BannedIP {
     QString ip;
@@ -28,12 +30,22 @@ class Config
 public:
     static Config& instance();
 
-    QString storageRoot() const { return m_storageRoot; }
-    void setStorageRoot(const QString &path) { m_storageRoot = path; }
+    QString storageRoot() const;
+    void setStorageRoot(const QString &path);
 
     int getCompressionLevel() const;
     void setCompressionLevel(int level);
 
+    int getWorkerThreadCount() const;
+    int getCompressionThreadCount() const;
+    int getMaxArchiveJobs() const;
+    QString getArchiveCacheDir() const;
+    qint64 getArchiveCacheSize() const;
+    qint64 getDeflateCacheSize() const;
+    QString getMetadataIndexDir() const;
+    int getIndexReconcileInterval() const;
+    int getUploadSessionTimeout() const;
+
     bool isIPBanned(const QString &ip);
     void recordFailedAttempt(const QString &ip);
     void clearFailedAttempts(const QString &ip);
@@ -41,9 +53,11 @@ public:
     void saveBannedIPs();
 
     QList<User> getUsers() const;
-    User* getUser(const QString &username);
+    std::optional<User> getUser(const QString &username) const;
     bool createUser(const QString &username, const QString &password, const bool &isAdmin,
                     const qint64 &storageLimit, const QString &storagePath = QString());
+    bool updateUser(const QString &username, const QString &password, const bool &isAdmin,
+                    const qint64 &storageLimit);
     bool deleteUser(const QString &username);
     void loadUsers();
     void saveUsers();
@@ -59,6 +73,9 @@ private:
     Config(const Config&) = delete;
     Config& operator=(const Config&) = delete;
 
+    // Config is shared by every worker thread, all members are guarded by m_mutex
+    mutable QRecursiveMutex m_mutex;
+
     QString m_storageRoot;
 
     QSettings m_settings;
@@ -68,6 +85,7 @@ private:
     QString getBannedIPsFilePath() const;
     QString getUsersFilePath() const;
     QString generateUserStoragePath(const QString &username) const;
+    int findUserIndex(const QString &username) const;
     static QString getDefaultLocalNetworkUrl();
 
     void migrateUserToHashedPassword(User &user, const QString &plainPassword);
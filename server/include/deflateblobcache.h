@@ -0,0 +1,80 @@
+#ifndef DEFLATEBLOBCACHE_H
+#define DEFLATEBLOBCACHE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <memory>
+#include <optional>
+
+struct ZipEntry;
+
+// Keeps the deflated data of single files, keyed by path, size, mtime and level,
+// so an archive of a folder where little changed only compresses what changed.
+// Blobs live next to the archive cache and are bounded by server/deflateCacheSize.
+class DeflateBlobCache
+{
+public:
+    // Files below this are cheaper to compress again than to look up
+    static const qint64 MIN_ENTRY_SIZE = 64 * 1024;
+
+    // Each blob file starts with a magic, the CRC and both sizes, then the raw deflate data
+    static const qint64 HEADER_SIZE = 24;
+
+    struct Blob {
+        QString filePath;
+        quint32 crc = 0;
+        qint64 size = 0;
+        qint64 compressedSize = 0;
+    };
+
+    // Collects the compressed data of one entry while its archive is written.
+    // Only added to the cache on commit, dropped otherwise
+    class BlobWriter
+    {
+    public:
+        BlobWriter(const QByteArray &key, const QString &tempPath);
+        ~BlobWriter();
+
+        void append(const QByteArray &data);
+        void commit(quint32 crc, qint64 size);
+
+    private:
+        QByteArray m_key;
+        QFile m_file;
+        qint64 m_written;
+        bool m_failed;
+    };
+
+    static DeflateBlobCache& instance();
+
+    bool isEnabled() const;
+    std::optional<Blob> lookup(const ZipEntry &entry, int compressionLevel);
+    std::shared_ptr<BlobWriter> create(const ZipEntry &entry, int compressionLevel);
+
+private:
+    struct CachedBlob {
+        QString filePath;
+        qint64 fileSize = 0;
+        qint64 lastUsed = 0;
+    };
+
+    DeflateBlobCache();
+    DeflateBlobCache(const DeflateBlobCache&) = delete;
+    DeflateBlobCache& operator=(const DeflateBlobCache&) = delete;
+
+    static QByteArray key(const ZipEntry &entry, int compressionLevel);
+    bool add(const QByteArray &key, const QString &tempPath);
+    void load();
+    void evictLocked();
+
+    mutable QMutex m_mutex;
+    QString m_directory;
+    qint64 m_budget;
+    qint64 m_totalSize;
+    QHash<QByteArray, CachedBlob> m_blobs;
+};
+
+#endif // DEFLATEBLOBCACHE_H
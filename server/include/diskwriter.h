@@ -0,0 +1,75 @@
+#ifndef DISKWRITER_H
+#define DISKWRITER_H
+
+#include <QObject>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <functional>
+
+// Writes incoming upload data on a dedicated I/O thread so a slow disk never
+// stalls a connection's event loop. Each connection owns one writer, every
+// writer lives on the same I/O thread. Frames queued for the same file are
+// merged into larger writes. The queueing functions are thread safe.
+class DiskWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class CloseMode {
+        Keep,       // Flush and close, the file stays where it is
+        Discard,    // Drop pending data and close
+        Commit      // Flush, sync to disk and rename over the target path
+    };
+
+    static QThread* ioThread();
+
+    // Waits for everything queued so far to reach the disk, then stops the I/O thread
+    static void shutdown();
+
+    // Created on the owning connection's thread, moves itself to the I/O thread
+    DiskWriter();
+    ~DiskWriter();
+
+    // Takes ownership of an open file and returns the id used by the other calls
+    quint64 addFile(QFile *file);
+    void write(quint64 fileId, const QByteArray &data);
+
+    // onClosed runs on the I/O thread once the file is closed, even if the owner is gone by then
+    void close(quint64 fileId, CloseMode mode, const QString &targetPath = QString(),
+               std::function<void(bool)> onClosed = nullptr);
+
+signals:
+    void written(quint64 fileId, qint64 bytes);
+    void failed(quint64 fileId, const QString &error);
+    void closed(quint64 fileId, bool success);
+
+private slots:
+    void drain();
+
+private:
+    struct Target {
+        QFile *file = nullptr;
+        QList<QByteArray> pending;
+        bool failed = false;
+        bool closing = false;
+        CloseMode mode = CloseMode::Keep;
+        QString targetPath;
+        std::function<void(bool)> onClosed;
+    };
+
+    void scheduleDrain();
+    bool writePending(QFile *file, QList<QByteArray> &pending, qint64 &bytesWritten);
+    bool finalize(QFile *file, CloseMode mode, const QString &targetPath);
+
+    static const qint64 MERGE_SIZE = 4 * 1024 * 1024;
+
+    QMutex m_mutex;
+    QHash<quint64, Target> m_targets;
+    quint64 m_nextFileId;
+    bool m_drainScheduled;
+};
+
+#endif // DISKWRITER_H
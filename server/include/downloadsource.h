@@ -0,0 +1,41 @@
+#ifndef DOWNLOADSOURCE_H
+#define DOWNLOADSOURCE_H
+
+#include <QFile>
+#include <QString>
+
+class FileManager;
+
+// Reads a file being downloaded straight into the outgoing frame. The file is
+// opened unbuffered so each chunk is a single read into the caller's buffer,
+// and a file truncated meanwhile only ends the read early.
+class DownloadSource
+{
+public:
+    explicit DownloadSource(const QString &filePath);
+    ~DownloadSource();
+
+    DownloadSource(const DownloadSource&) = delete;
+    DownloadSource& operator=(const DownloadSource&) = delete;
+
+    bool open();
+    // Opens a client path through the file manager, so it cannot be redirected out of the root
+    bool open(const FileManager &fileManager, const QString &relativePath);
+    void close();
+
+    QString fileName() const { return m_file.fileName(); }
+    qint64 size() const { return m_size; }
+
+    // Moves the read position, used to serve a range of the file
+    bool seek(qint64 offset);
+
+    // Copies up to length bytes at the current position into dst
+    qint64 read(char *dst, qint64 length);
+
+private:
+    QFile m_file;
+    qint64 m_position;
+    qint64 m_size;
+};
+
+#endif // DOWNLOADSOURCE_H
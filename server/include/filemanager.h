@@ -2,25 +2,75 @@
 #define FILEMANAGER_H
 
 #include <QString>
+#include <QFile>
 #include <QFileInfo>
 #include <QJsonArray>
+#include <QJsonObject>
 #include <QObject>
-#include <QTextCodec>
-#include <quazip/quazip.h>
-#include <quazip/quazipfile.h>
+#include <functional>
+#include <memory>
+#include <optional>
+#include "metadataindex.h"
+
+class PathResolver;
 
 class FileManager : public QObject
 {
     Q_OBJECT
 
 public:
+    enum class SortKey { Name, Size, Modified };
+
+    struct ListOptions {
+        SortKey sortBy = SortKey::Name;
+        bool descending = false;
+        bool foldersFirst = true;
+        // Where the previous page ended, empty for the first one
+        QString cursor;
+        // Entries per page, 0 for everything at once
+        int limit = 0;
+        // Every page after the other instead of only the first
+        bool stream = false;
+    };
+
+    struct ListBatch {
+        QJsonArray files;
+        qint64 offset = 0;
+        qint64 total = 0;
+        // Empty once the listing is complete
+        QString nextCursor;
+    };
+
+    struct SearchPage {
+        QJsonArray files;
+        // Empty after the last page
+        QString nextCursor;
+    };
+
     FileManager(const QString &rootPath, QObject *parent = nullptr);
 
+    static std::optional<SortKey> parseSortKey(const QString &name);
+
+    QString rootPath() const { return m_rootPath; }
+    std::shared_ptr<MetadataIndex> index() const { return m_index; }
+
     bool isValidPath(const QString &relativePath) const;
     QString getAbsolutePath(const QString &relativePath) const;
+    // Opens the file without following links out of the root between the check and the
+    // open. WriteOnly creates or truncates it
+    bool openFile(const QString &relativePath, QFile &file, QIODevice::OpenMode mode) const;
 
-    QJsonArray listDirectory(const QString &relativePath, bool foldersFirst = true);
+    // Returns false for a cursor that does not belong to these options
+    bool listDirectory(const QString &relativePath, const ListOptions &options,
+                       const std::function<void(const ListBatch&)> &onBatch);
+    // Empty while the folder is not indexed, listings then carry no version
+    QString directoryVersion(const QString &relativePath) const;
+    // Everything below the folder whose name matches, nothing for a stale cursor
+    std::optional<SearchPage> search(const QString &pattern, const QString &relativePath,
+                                     const QString &cursor, int limit) const;
     bool createDirectory(const QString &relativePath);
+    // Creates the folder with any missing parent, true if it exists afterwards
+    bool makePath(const QString &relativePath);
     bool deleteFile(const QString &relativePath);
     bool deleteDirectory(const QString &relativePath);
     bool moveItem(const QString &fromPath, const QString &toPath);
@@ -33,25 +83,20 @@ public:
     QByteArray readFile(const QString &relativePath);
     qint64 getFileSize(const QString &relativePath) const;
 
-    // Synchronous versions (kept for compatibility)
-    bool createZipFromDirectory(const QString &relativePath, const QString &zipPath, int compressionLevel = 0);
-    bool createZipFromMultiplePaths(const QStringList &paths, const QString &zipPath, int compressionLevel = 0);
-
-    // NEW: Asynchronous versions
-    void createZipFromDirectoryAsync(const QString &relativePath, const QString &zipPath, int compressionLevel = 0);
-    void createZipFromMultiplePathsAsync(const QStringList &paths, const QString &zipPath, int compressionLevel = 0);
-
     QJsonObject getFolderTree(const QString &relativePath, int maxDepth = -1);
-
-signals:
-    void zipCreationComplete(bool success, const QString &zipPath);
+    QJsonArray getChildren(const QString &relativePath);
+    QString folderName(const QString &relativePath) const;
 
 private:
     QString m_rootPath;
-    qint64 calculateDirectorySize(const QString &path) const;
-
-    bool addDirectoryToZip(QuaZip &zip, const QString &dirPath, const QString &baseDir, int compressionLevel);
-    bool addFileToZip(QuaZip &zip, const QString &filePath, const QString &zipPath, int compressionLevel);
+    std::shared_ptr<MetadataIndex> m_index;
+    std::shared_ptr<PathResolver> m_resolver;
+    QJsonObject buildFolderTree(const QString &relativePath, int maxDepth) const;
+    // Creates the missing folders without telling anyone, created is the outermost new one
+    bool createFolders(const QString &relativePath, QString &created);
+    void removeFolders(const QString &relativePath, const QString &created);
+    QList<MetadataIndex::Entry> readDirectory(const QString &relativePath) const;
+    std::optional<QList<MetadataIndex::Folder>> readFolders(const QString &relativePath) const;
 };
 
 #endif // FILEMANAGER_H
@@ -2,12 +2,10 @@
 #define FILESERVER_H
 
 #include <QObject>
-#include <QWebSocketServer>
-#include <QList>
 #include <QStandardPaths>
 #include <QDir>
-#include "clientconnection.h"
 #include "httpserver.h"
+#include "workerpool.h"
 
 class FileServer : public QObject
 {
@@ -23,14 +21,9 @@ public:
     HttpServer* httpServer() const { return m_httpServer; }
     QString getShareLinksPath() const { return m_shareLinksPath; }
 
-private slots:
-    void onNewConnection();
-    void onClientDisconnected();
-
 private:
-    QWebSocketServer *m_server;
-    QList<ClientConnection*> m_clients;
     HttpServer *m_httpServer;
+    WorkerPool *m_workerPool;
     QString m_shareLinksPath;
     QString getDefaultLocalNetworkUrl();
 };
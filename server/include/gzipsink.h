@@ -0,0 +1,36 @@
+#ifndef GZIPSINK_H
+#define GZIPSINK_H
+
+#include <QByteArray>
+#include <zlib.h>
+#include "archivesink.h"
+
+// Gzip compresses everything written to it into another sink, on the writer's thread
+class GzipSink : public ArchiveSink
+{
+public:
+    GzipSink(ArchiveSink *sink, int compressionLevel);
+    ~GzipSink();
+
+    GzipSink(const GzipSink&) = delete;
+    GzipSink& operator=(const GzipSink&) = delete;
+
+    bool write(const QByteArray &data) override;
+    bool isCancelled() const override;
+
+    // Flushes the rest of the stream and the gzip trailer
+    bool finish();
+
+private:
+    bool deflateInput(const char *data, qint64 length, int flush);
+
+    static const qint64 OUTPUT_BUFFER_SIZE = 256 * 1024;
+
+    ArchiveSink *m_sink;
+    z_stream m_stream;
+    QByteArray m_output;
+    qint64 m_outputUsed;
+    bool m_ready;
+};
+
+#endif // GZIPSINK_H
@@ -8,6 +8,8 @@
 #include <QHash>
 #include <QFileInfo>
 #include <QTcpServer>
+#include <QReadWriteLock>
+#include <QMutex>
 
 class HttpServer : public QObject
 {
@@ -43,9 +45,16 @@ private:
     QString generateDownloadPage(const QFileInfo &fileInfo, const QString &shareToken);
     QString generateShareToken(const bool &shortUrl);
     QString getFileTypeIcon(const QString &fileName);
+    QString findShareToken(const QString &filePath) const;
+    QString sharedFilePath(const QString &shareToken) const;
 
     QHttpServer m_server;
     QTcpServer *m_tcpServer;
+    int m_port;
+
+    // Share links are updated from every connection worker thread
+    mutable QReadWriteLock m_sharedFilesLock;
+    mutable QMutex m_persistMutex;
     QHash<QString, QString> m_sharedFiles;
     QString m_baseUrl;
     QString m_shareLinksFilePath;
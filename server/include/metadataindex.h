@@ -0,0 +1,155 @@
+#ifndef METADATAINDEX_H
+#define METADATAINDEX_H
+
+#include "searchindex.h"
+#include <QFileInfo>
+#include <QFuture>
+#include <QList>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <optional>
+
+class QDataStream;
+class QThreadPool;
+
+// Names, sizes and dates of everything under one storage root, kept in memory and
+// saved to server/indexDir so listings, the folder tree and used space do not have
+// to walk the disk. The server updates it for every change it makes itself and a
+// background scan every server/indexReconcileInterval picks up the rest. Until the
+// first load or scan is done, and below links it does not follow, queries return
+// nothing and callers go to the filesystem.
+class MetadataIndex : public std::enable_shared_from_this<MetadataIndex>
+{
+public:
+    struct Entry {
+        QString name;
+        bool isDir = false;
+        qint64 size = 0;
+        qint64 modified = 0;
+    };
+
+    struct Folder {
+        QString name;
+        bool hasFolders = false;
+    };
+
+    struct Match {
+        QString path;
+        Entry entry;
+    };
+
+    // Space promised to an upload in progress, given back once the last copy is dropped
+    class Reservation
+    {
+    public:
+        Reservation(std::shared_ptr<MetadataIndex> index, qint64 bytes);
+        ~Reservation();
+
+    private:
+        std::shared_ptr<MetadataIndex> m_index;
+        qint64 m_bytes;
+    };
+
+    static std::shared_ptr<MetadataIndex> forRoot(const QString &rootPath);
+
+    // Starts the scans and saves that are due on every index asked for so far. Called
+    // periodically by the server, whether clients are active or not
+    static void maintainAll();
+    // Stops background scans and saves every index that changed since its last save
+    static void saveAll();
+
+    explicit MetadataIndex(const QString &rootPath);
+
+    bool isReady() const;
+    std::optional<QList<Entry>> list(const QString &relativePath) const;
+    std::optional<QList<Folder>> folders(const QString &relativePath) const;
+    std::optional<qint64> totalSize(const QString &relativePath) const;
+
+    // Changes whenever the listing of the folder would, so a client holding the same
+    // token can keep what it has. Tokens of a loaded or rescanned index never match older ones
+    std::optional<QString> version(const QString &relativePath) const;
+
+    // Names below the folder matching the pattern, at most limit of them. The cursor
+    // continues where the last page stopped and is set for the next one, or cleared
+    // after the last. Nothing for an unknown folder or a cursor of an older index
+    std::optional<QList<Match>> search(const QString &pattern, const QString &relativePath, QString &cursor, int limit) const;
+
+    // Bytes stored under the root. Before the index is loaded this is the total of the
+    // last snapshot, and without one a walk of the disk shared by every caller
+    qint64 usedBytes();
+    qint64 reservedBytes() const;
+    std::shared_ptr<Reservation> reserve(qint64 bytes, qint64 limit);
+
+    // Reads the path again from disk, whether it was added, changed or removed
+    void refresh(const QString &relativePath);
+    void move(const QString &fromPath, const QString &toPath);
+
+private:
+    struct Node {
+        bool isDir = false;
+        bool scanned = false;
+        qint64 size = 0;
+        qint64 totalSize = 0;
+        qint64 modified = 0;
+        quint32 folderCount = 0;
+        quint64 version = 0;
+        quint32 searchId = SearchIndex::NONE;
+        std::map<QString, std::unique_ptr<Node>> children;
+    };
+
+    static QThreadPool* pool();
+    static bool splitPath(const QString &relativePath, QStringList &parts);
+    static std::unique_ptr<Node> stat(const QFileInfo &info);
+    static std::unique_ptr<Node> scan(const QFileInfo &info, qint64 &count, bool throttled);
+    static qint64 sumFileSizes(const QString &path);
+    static void writeNode(QDataStream &out, const Node &node);
+    static std::unique_ptr<Node> readNode(QDataStream &in);
+    static void indexTree(SearchIndex &search, Node *node, quint32 parent, const QString &name);
+    static void unindexTree(SearchIndex &search, const Node &node);
+
+    QString absolutePath(const QStringList &parts) const;
+    QString snapshotPath() const;
+
+    void maintain();
+    void readSavedUsage();
+    void load();
+    void reconcile();
+    void save();
+
+    Node* findLocked(const QStringList &parts) const;
+    bool setLocked(const QStringList &parts, std::unique_ptr<Node> node);
+    void adjustLocked(const QStringList &parentParts, qint64 delta);
+    void touchLocked(const QStringList &parts, qint64 modified);
+    void stampLocked(Node *node);
+    void noteChangeLocked(const QString &relativePath);
+
+    QString m_rootPath;
+    qint64 m_reconcileInterval;
+
+    mutable QReadWriteLock m_lock;
+    std::unique_ptr<Node> m_root;
+    SearchIndex m_search;
+    quint64 m_epoch;
+    quint64 m_versionCounter;
+    bool m_reconciling;
+    QSet<QString> m_changed;
+    std::atomic<bool> m_dirty;
+    qint64 m_savedUsage;
+    QFuture<qint64> m_usageWalk;
+
+    mutable QMutex m_reservationMutex;
+    qint64 m_reserved;
+
+    QMutex m_stateMutex;
+    bool m_taskRunning;
+    qint64 m_lastReconcile;
+    qint64 m_lastSave;
+};
+
+#endif // METADATAINDEX_H
@@ -0,0 +1,63 @@
+#ifndef PATHRESOLVER_H
+#define PATHRESOLVER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <memory>
+#include <optional>
+
+// Checks that client paths stay inside a storage root. On Linux the check is a single
+// openat2 with RESOLVE_BENEATH against a descriptor of the root kept open for the life
+// of the server, so links are followed only while they stay inside. Elsewhere, or on
+// kernels without openat2, the path is canonicalized instead, and folders found inside
+// are remembered for a few seconds since one operation usually checks several paths in
+// the same folder. The last component is checked every time either way.
+// A yes or no only holds until the path is used again by name, a link swapped in
+// meanwhile still redirects it. Operations that must not be redirected go through
+// open or openParent and act on the returned descriptor instead
+class PathResolver
+{
+public:
+    static std::shared_ptr<PathResolver> forRoot(const QString &rootPath);
+
+    // Without kernelResolve only the canonical check is used, as on other systems
+    explicit PathResolver(const QString &rootPath, bool kernelResolve = true);
+    ~PathResolver();
+
+    // Missing components are accepted once the part of the path that exists is inside
+    bool isBeneath(const QString &relativePath);
+
+    // Forgets the path and everything below it, after it was removed, moved or renamed
+    void invalidate(const QString &relativePath);
+
+    // Opens the path, or the folder holding it with name set to the last component,
+    // resolving every component beneath the root. The descriptor belongs to the caller
+    // and is -1 when it cannot be opened or leads out of the root. Nothing when openat2
+    // is not available and the caller has to check the path and use it by name
+    std::optional<int> open(const QString &relativePath, int flags, int mode = 0);
+    std::optional<int> openParent(const QString &relativePath, QString &name);
+
+private:
+    static bool normalize(const QString &relativePath, QStringList &parts);
+    // Drops ".." on paper, only valid for parts that went through normalize
+    static QStringList collapse(const QStringList &parts);
+
+    // Nothing when openat2 is not available and the canonical check has to decide
+    std::optional<bool> resolveBeneath(const QStringList &parts);
+    std::optional<int> openBeneath(const QStringList &parts, int flags, int mode);
+    bool resolveFallback(const QStringList &parts);
+    bool resolveCanonical(const QStringList &parts) const;
+
+    QString m_rootPath;
+    QString m_canonicalRoot;
+    int m_rootFd;
+    std::atomic<bool> m_openat2;
+
+    QMutex m_cacheMutex;
+    QHash<QString, qint64> m_cache;
+};
+
+#endif // PATHRESOLVER_H
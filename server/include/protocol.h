@@ -3,8 +3,45 @@
 #define PROTOCOL_H
 
 #include <QString>
+#include <QtEndian>
 
 namespace Protocol {
+namespace Fields {
+// Optional on every command, echoed back on every response and error it produces
+constexpr const char* REQUEST_ID = "requestId";
+// Requested by the client in authenticate, confirmed by the server in its reply
+constexpr const char* ENCODING = "encoding";
+// Chosen by the client for every upload and download, tags the DATA frames of that transfer
+constexpr const char* STREAM_ID = "streamId";
+// Assigned by the server in upload_ready, used by resume_upload after a reconnect
+constexpr const char* UPLOAD_ID = "uploadId";
+}
+
+namespace Encodings {
+constexpr const char* JSON = "json";
+constexpr const char* CBOR = "cbor";
+}
+
+namespace Frames {
+// Every binary frame starts with one of these, CONTROL is only used once CBOR is negotiated
+constexpr char CONTROL = 0x00;
+constexpr char DATA = 0x01;
+
+// DATA frames carry the kind, the big endian stream id and then the payload
+constexpr int DATA_HEADER_SIZE = 5;
+
+inline void writeDataHeader(char *frame, quint32 streamId)
+{
+    frame[0] = DATA;
+    qToBigEndian(streamId, frame + 1);
+}
+
+inline quint32 readStreamId(const char *frame)
+{
+    return qFromBigEndian<quint32>(frame + 1);
+}
+}
+
 namespace Commands {
 // Authentication
 constexpr const char* AUTHENTICATE = "authenticate";
@@ -15,11 +52,18 @@ constexpr const char* LIST_DIRECTORY = "list_directory";
 constexpr const char* CREATE_DIRECTORY = "create_directory";
 constexpr const char* DELETE_DIRECTORY = "delete_directory";
 constexpr const char* GET_FOLDER_TREE = "get_folder_tree";
+// One level of folders, each with a flag telling whether it has folders of its own
+constexpr const char* GET_CHILDREN = "get_children";
+// The tree stopped showing the children of a folder, no more changes below it. No reply
+constexpr const char* RELEASE_CHILDREN = "release_children";
+// Names matching a pattern anywhere below a folder, in pages
+constexpr const char* SEARCH = "search";
 
 // File operations
 constexpr const char* DELETE_FILE = "delete_file";
 constexpr const char* DELETE_MULTIPLE = "delete_multiple";
 constexpr const char* UPLOAD_FILE = "upload_file";
+constexpr const char* RESUME_UPLOAD = "resume_upload";
 constexpr const char* UPLOAD_FOLDER = "upload_folder";      // NEW
 constexpr const char* UPLOAD_MIXED = "upload_mixed";        // NEW
 constexpr const char* DOWNLOAD_FILE = "download_file";
@@ -37,6 +81,7 @@ constexpr const char* RENAME_ITEM = "rename_item";
 constexpr const char* GET_STORAGE_INFO = "get_storage_info";
 constexpr const char* GET_SERVER_INFO = "get_server_info";
 constexpr const char* GET_THUMBNAIL = "get_thumbnail";
+constexpr const char* GET_TRANSFER_STATS = "get_transfer_stats";
 
 // User management
 constexpr const char* GET_USER_LIST = "get_user_list";
@@ -53,12 +98,16 @@ constexpr const char* ERROR = "error";
 constexpr const char* PING = "ping";
 constexpr const char* AUTHENTICATE = "authenticate";
 constexpr const char* LIST_DIRECTORY = "list_directory";
+// The version sent with list_directory is still current, the client keeps its listing
+constexpr const char* NOT_MODIFIED = "not_modified";
 constexpr const char* CREATE_DIRECTORY = "create_directory";
 constexpr const char* DELETE_FILE = "delete_file";
 constexpr const char* DELETE_DIRECTORY = "delete_directory";
 constexpr const char* DELETE_MULTIPLE = "delete_multiple";
 constexpr const char* UPLOAD_READY = "upload_ready";
 constexpr const char* UPLOAD_COMPLETE = "upload_complete";
+// Bytes of an upload on disk, the client keeps at most the announced window unacknowledged
+constexpr const char* UPLOAD_ACK = "upload_ack";
 constexpr const char* UPLOAD_CANCELLED = "upload_cancelled";
 constexpr const char* FOLDER_UPLOAD_STARTED = "folder_upload_started";   // NEW
 constexpr const char* MIXED_UPLOAD_STARTED = "mixed_upload_started";     // NEW
@@ -78,6 +127,12 @@ constexpr const char* USER_DELETED = "user_deleted";
 constexpr const char* USER_LIST = "user_list";
 constexpr const char* SHARE_LINK_GENERATED = "share_link_generated";
 constexpr const char* FOLDER_TREE = "folder_tree";
+constexpr const char* CHILDREN = "children";
+constexpr const char* SEARCH_RESULTS = "search_results";
+// Pushed without a request id: kind (created, changed, deleted, moved, renamed), path,
+// toPath for moves and renames, and item with the entry as it is now
+constexpr const char* CHANGE = "change";
+constexpr const char* TRANSFER_STATS = "transfer_stats";
 }
 }
 
@@ -0,0 +1,69 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QRegularExpression>
+#include <QString>
+#include <vector>
+
+// Trigrams of every name under a storage root, so a search only looks at the names
+// sharing the rarest trigram of the pattern instead of walking the tree. Owned by
+// MetadataIndex, which updates it with its tree and guards it with the same lock.
+// Removed names are skipped at once and their postings dropped in bulk later. Ids are
+// never handed out twice, so a search cursor stays valid until the index is rebuilt
+class SearchIndex
+{
+public:
+    static constexpr quint32 NONE = 0;
+
+    // Same matching as the filter of the file view: with * or ? the pattern must match
+    // the whole name, otherwise it is found anywhere in it, ignoring case
+    class Matcher
+    {
+    public:
+        explicit Matcher(const QString &pattern);
+
+        bool matches(const QString &name) const;
+        const QList<quint64>& trigrams() const { return m_trigrams; }
+
+    private:
+        QString m_pattern;
+        bool m_wildcard;
+        QRegularExpression m_regex;
+        QList<quint64> m_trigrams;
+    };
+
+    SearchIndex();
+
+    quint32 add(quint32 parent, const QString &name);
+    void remove(quint32 id);
+    void move(quint32 id, quint32 parent, const QString &name);
+
+    bool isLive(quint32 id) const;
+    QString path(quint32 id) const;
+
+    // Matching ids after the given one, in ascending order. Only ids below scope
+    // unless it is NONE. More is set when there are others past the limit
+    QList<quint32> find(const Matcher &matcher, quint32 scope, quint32 after, int limit, bool &more) const;
+
+private:
+    struct Slot {
+        QString name;
+        quint32 parent = NONE;
+        bool live = false;
+    };
+
+    static QList<quint64> trigramsOf(const QString &text);
+
+    bool isBelow(quint32 id, quint32 ancestor) const;
+    void indexName(quint32 id, const QString &name, const QString &previous);
+    void compact();
+
+    std::vector<Slot> m_slots;
+    QHash<quint64, std::vector<quint32>> m_postings;
+    qint64 m_postingCount;
+    qint64 m_staleCount;
+};
+
+#endif // SEARCHINDEX_H
@@ -0,0 +1,44 @@
+#ifndef TARSTREAMWRITER_H
+#define TARSTREAMWRITER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <functional>
+#include "zipstreamwriter.h"
+
+class ArchiveSink;
+
+// Writes a POSIX tar archive front to back. Every entry is a header followed by
+// its data, so output starts with the first file and nothing is kept around for
+// the end. Names longer than ustar allows and files of 8 GiB or more get a pax
+// extended header.
+class TarStreamWriter
+{
+public:
+    explicit TarStreamWriter(ArchiveSink *sink);
+
+    void setProgressCallback(std::function<void(qint64)> callback) { m_progressCallback = std::move(callback); }
+
+    // Exact archive size, known from the listing alone
+    static qint64 archiveSize(const QList<ZipEntry> &entries);
+
+    bool addEntry(const ZipEntry &entry);
+    bool finish();
+
+    QString errorString() const { return m_error; }
+
+private:
+    static QByteArray header(const QByteArray &name, qint64 size, quint32 mode, qint64 mtime, char type);
+    static QByteArray paxRecords(const ZipEntry &entry);
+    static qint64 padding(qint64 size);
+
+    bool output(const QByteArray &data);
+    bool fail(const QString &error);
+
+    ArchiveSink *m_sink;
+    std::function<void(qint64)> m_progressCallback;
+    QString m_error;
+};
+
+#endif // TARSTREAMWRITER_H
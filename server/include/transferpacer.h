@@ -0,0 +1,132 @@
+#ifndef TRANSFERPACER_H
+#define TRANSFERPACER_H
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QtGlobal>
+
+// Sizes data chunks and the amount of unsent bytes allowed on a socket from
+// the measured drain rate and round trip time. Used by both server and client.
+class TransferPacer
+{
+public:
+    static constexpr qint64 MIN_CHUNK_SIZE = 64 * 1024;
+    static constexpr qint64 MAX_CHUNK_SIZE = 8 * 1024 * 1024;
+    static constexpr qint64 MIN_WINDOW = 2 * MIN_CHUNK_SIZE;
+    static constexpr qint64 MAX_WINDOW = 64 * 1024 * 1024;
+
+    TransferPacer()
+        : m_window(2 * 1024 * 1024)
+        , m_chunkSize(1024 * 1024)
+        , m_throughput(0)
+        , m_smoothedRtt(0)
+        , m_minRtt(0)
+        , m_intervalBytes(0)
+        , m_totalBytes(0)
+        , m_appLimited(false)
+    {
+    }
+
+    qint64 window() const { return m_window; }
+    qint64 chunkSize() const { return m_chunkSize; }
+    qint64 smoothedRtt() const { return m_smoothedRtt; }
+    double throughput() const { return m_throughput; }
+
+    bool canSend(qint64 bytesToWrite) const { return bytesToWrite < m_window; }
+
+    // Called from the socket's bytesWritten signal with what is still queued
+    void onBytesWritten(qint64 bytes, qint64 bytesToWrite)
+    {
+        if (!m_sampleTimer.isValid()) {
+            m_sampleTimer.start();
+        }
+
+        m_intervalBytes += bytes;
+        m_totalBytes += bytes;
+
+        // An empty queue means we, not the link, were the bottleneck
+        if (bytesToWrite == 0) {
+            m_appLimited = true;
+        }
+
+        qint64 elapsed = m_sampleTimer.elapsed();
+        if (elapsed < SAMPLE_INTERVAL_MS) {
+            return;
+        }
+
+        double rate = m_intervalBytes * 1000.0 / elapsed;
+        if (!m_appLimited || rate > m_throughput) {
+            m_throughput = m_throughput > 0 ? m_throughput * 0.75 + rate * 0.25 : rate;
+        }
+
+        m_intervalBytes = 0;
+        m_appLimited = false;
+        m_sampleTimer.restart();
+
+        update();
+    }
+
+    void onRttSample(qint64 rttMs)
+    {
+        rttMs = qMax<qint64>(rttMs, 1);
+
+        m_minRtt = m_minRtt > 0 ? qMin(m_minRtt, rttMs) : rttMs;
+        m_smoothedRtt = m_smoothedRtt > 0 ? (m_smoothedRtt * 7 + rttMs) / 8 : rttMs;
+
+        update();
+    }
+
+    QJsonObject stats() const
+    {
+        QJsonObject stats;
+        stats["window"] = m_window;
+        stats["chunkSize"] = m_chunkSize;
+        stats["throughput"] = qint64(m_throughput);
+        stats["rtt"] = m_smoothedRtt;
+        stats["minRtt"] = m_minRtt;
+        stats["bytesSent"] = m_totalBytes;
+        return stats;
+    }
+
+private:
+    static constexpr qint64 SAMPLE_INTERVAL_MS = 200;
+    static constexpr qint64 DEFAULT_RTT_MS = 50;
+
+    void update()
+    {
+        qint64 baseRtt = m_minRtt > 0 ? m_minRtt : DEFAULT_RTT_MS;
+
+        // Twice the bandwidth-delay product keeps the link busy between refills,
+        // while a window limited link measures close to window / rtt and keeps growing
+        qint64 target = qint64(m_throughput * baseRtt / 1000.0 * 2);
+
+        // Round trips well above the base RTT mean data is piling up in a queue somewhere
+        if (m_minRtt > 0 && m_smoothedRtt > 2 * m_minRtt) {
+            target /= 2;
+        }
+
+        target = qBound(MIN_WINDOW, target, MAX_WINDOW);
+
+        // Move gradually so a single odd sample does not cause a burst or a stall
+        if (target > m_window) {
+            m_window = qMin(target, m_window * 3 / 2);
+        } else {
+            m_window = qMax(target, m_window * 3 / 4);
+        }
+
+        m_chunkSize = qBound(MIN_CHUNK_SIZE, (m_window / 4) & ~(MIN_CHUNK_SIZE - 1), MAX_CHUNK_SIZE);
+    }
+
+    qint64 m_window;
+    qint64 m_chunkSize;
+    double m_throughput;
+    qint64 m_smoothedRtt;
+    qint64 m_minRtt;
+
+    QElapsedTimer m_sampleTimer;
+    qint64 m_intervalBytes;
+    qint64 m_totalBytes;
+    bool m_appLimited;
+};
+
+#endif // TRANSFERPACER_H
@@ -0,0 +1,64 @@
+#ifndef UPLOADSESSIONMANAGER_H
+#define UPLOADSESSIONMANAGER_H
+
+#include <QObject>
+#include <QString>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QTimer>
+#include <memory>
+#include <optional>
+#include "metadataindex.h"
+
+struct UploadSession {
+    QString id;
+    QString username;
+    QString path;
+    QString targetPath;
+    QString partPath;
+    qint64 size = 0;
+    QDateTime lastActivity;
+    bool attached = false;
+    // Quota held for the whole file until the session ends, whichever way
+    std::shared_ptr<MetadataIndex::Reservation> reservation;
+};
+
+// Keeps track of uploads in progress so a client can continue one after a
+// reconnect. Data is written to a hidden part file next to the destination
+// and renamed over it once complete. Shared by every worker thread.
+class UploadSessionManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    static UploadSessionManager& instance();
+
+    // Must be called from the main thread, the timer lives there
+    void startGarbageCollection();
+
+    static bool isPartFile(const QString &fileName);
+
+    UploadSession create(const QString &username, const QString &path, const QString &targetPath, qint64 size,
+                         std::shared_ptr<MetadataIndex::Reservation> reservation);
+    std::optional<UploadSession> attach(const QString &id, const QString &username);
+    void detach(const QString &id);
+    void finish(const QString &id);
+    void discard(const QString &id);
+
+private slots:
+    void collectGarbage();
+
+private:
+    UploadSessionManager();
+    UploadSessionManager(const UploadSessionManager&) = delete;
+    UploadSessionManager& operator=(const UploadSessionManager&) = delete;
+
+    void removeOrphanParts(const QString &rootPath);
+
+    mutable QMutex m_mutex;
+    QHash<QString, UploadSession> m_sessions;
+    QTimer *m_gcTimer;
+};
+
+#endif // UPLOADSESSIONMANAGER_H
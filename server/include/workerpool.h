@@ -0,0 +1,65 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QWebSocketServer>
+#include <QThread>
+#include <QTimer>
+#include <QList>
+#include <QAtomicInt>
+
+class ClientConnection;
+class HttpServer;
+
+// Owns a share of the client sockets and runs them on its own event loop
+class ConnectionWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ConnectionWorker(HttpServer *httpServer, QObject *parent = nullptr);
+
+    int load() const { return m_load.loadRelaxed(); }
+    void reserve() { m_load.ref(); }
+
+public slots:
+    void addConnection(qintptr socketDescriptor);
+    void closeAll();
+
+private slots:
+    void onNewConnection();
+    void onClientDisconnected();
+
+private:
+    HttpServer *m_httpServer;
+    QWebSocketServer *m_server;
+    QList<ClientConnection*> m_clients;
+    QAtomicInt m_load;
+};
+
+// Accepts sockets on the main thread and hands them to the least loaded worker
+class WorkerPool : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit WorkerPool(HttpServer *httpServer, QObject *parent = nullptr);
+    ~WorkerPool();
+
+    void start(int threadCount);
+    void stop();
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    ConnectionWorker* leastLoadedWorker() const;
+
+    HttpServer *m_httpServer;
+    QList<QThread*> m_threads;
+    QList<ConnectionWorker*> m_workers;
+    QTimer *m_maintainTimer;
+};
+
+#endif // WORKERPOOL_H
@@ -0,0 +1,135 @@
+#ifndef ZIPSTREAMWRITER_H
+#define ZIPSTREAMWRITER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QFuture>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QString>
+#include <functional>
+#include <memory>
+#include "deflateblobcache.h"
+
+class ArchiveSink;
+class QThreadPool;
+
+struct ZipEntry {
+    QString filePath;
+    QString name;
+    qint64 size = 0;
+    QDateTime modified;
+    QFile::Permissions permissions;
+};
+
+// Writes a zip archive front to back without seeking, so it can be sent while
+// it is produced. Entries use data descriptors for their CRC and sizes, and
+// ZIP64 records whenever a size or offset does not fit in 32 bits.
+//
+// Files are deflated in blocks on a shared compression pool, several blocks
+// at once, and written out in order. Each block is primed with the end of the
+// previous one, so the ratio stays close to deflating the file in one go.
+// Content that is already compressed is stored instead, see looksCompressed().
+// Files deflated for an earlier archive are copied from the DeflateBlobCache.
+class ZipStreamWriter
+{
+public:
+    struct Stats {
+        int storedEntries = 0;
+        qint64 storedBytes = 0;
+        qint64 deflatedInput = 0;
+        qint64 deflatedOutput = 0;
+        qint64 deflateNsecs = 0;
+        int reusedEntries = 0;
+        qint64 reusedBytes = 0;
+    };
+
+    ZipStreamWriter(ArchiveSink *sink, int compressionLevel);
+    ~ZipStreamWriter();
+
+    static QThreadPool* compressionPool();
+
+    // Called with the number of source bytes read, on the thread adding entries
+    void setProgressCallback(std::function<void(qint64)> callback) { m_progressCallback = std::move(callback); }
+
+    // Lists the files below absPath, named relative to baseDir like the old QuaZip archives
+    static void collectEntries(const QString &absPath, const QString &baseDir, QList<ZipEntry> &entries);
+
+    // Regular file mode bits, as stored in zip and tar headers
+    static quint32 unixMode(QFile::Permissions permissions);
+
+    // Exact archive size for entries written without compression
+    static qint64 storedArchiveSize(const QList<ZipEntry> &entries);
+
+    // Judged by the extension first, then by the byte entropy of the first block
+    static bool looksCompressed(const QString &name, const QByteArray &head);
+
+    bool addEntry(const ZipEntry &entry);
+    bool finish();
+
+    QString errorString() const { return m_error; }
+    Stats stats() const { return m_stats; }
+
+private:
+    struct CentralRecord {
+        QByteArray name;
+        quint16 method = 0;
+        quint16 dosTime = 0;
+        quint16 dosDate = 0;
+        quint32 crc = 0;
+        qint64 compressedSize = 0;
+        qint64 size = 0;
+        qint64 offset = 0;
+        quint32 externalAttributes = 0;
+        bool zip64 = false;
+    };
+
+    struct CompressedBlock {
+        QByteArray data;
+        quint32 crc = 0;
+        qint64 size = 0;
+        qint64 nsecs = 0;
+        bool ok = true;
+    };
+
+    // Output is queued so blocks go out in archive order. Raw data was compressed before
+    struct PendingOutput {
+        enum Kind { Header, Block, Raw, Descriptor };
+        Kind kind = Header;
+        int record = 0;
+        QFuture<CompressedBlock> block;
+        QByteArray raw;
+    };
+
+    // Level 0 only computes the CRC and passes the data through
+    static CompressedBlock compressBlock(const QByteArray &input, const QByteArray &dictionary, bool last, int level);
+
+    static bool needsZip64(qint64 size, int compressionLevel);
+    static int centralExtraSize(bool zip64, qint64 offset);
+    static bool needsZip64End(qint64 entryCount, qint64 centralSize, qint64 centralOffset);
+
+    bool writeHeader(CentralRecord &record);
+    bool writeDescriptor(const CentralRecord &record);
+    bool writeStored(QFile &file, const ZipEntry &entry, CentralRecord &record);
+    bool queueBlocks(QFile &file, const ZipEntry &entry, int recordIndex, QByteArray input);
+    bool queueCached(QFile &blob, int recordIndex);
+    bool flushPending(int maxBlocksInFlight);
+    bool output(const QByteArray &data);
+    bool fail(const QString &error);
+
+    ArchiveSink *m_sink;
+    int m_compressionLevel;
+    qint64 m_offset;
+    QList<CentralRecord> m_records;
+    QQueue<PendingOutput> m_pending;
+    int m_blocksInFlight;
+    int m_maxBlocksInFlight;
+    std::function<void(qint64)> m_progressCallback;
+    QHash<int, std::shared_ptr<DeflateBlobCache::BlobWriter>> m_blobWriters;
+    Stats m_stats;
+    QString m_error;
+};
+
+#endif // ZIPSTREAMWRITER_H
@@ -0,0 +1,264 @@
+#include "archivecache.h"
+#include "archivepipe.h"
+#include "config.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QUuid>
+#include <QDebug>
+
+// An archive taking more than this share of the budget would push out most others
+// and likely be pushed out itself before anyone asks for it again
+static const int MAX_BUDGET_SHARE = 4;
+
+ArchiveCache::Build::Build(const QByteArray &key, const QString &spoolPath, qint64 spoolLimit, std::shared_ptr<ArchivePipe> pipe)
+    : m_key(key)
+    , m_spool(spoolPath)
+    , m_spoolLimit(spoolLimit)
+    , m_spoolFailed(false)
+    , m_pipe(std::move(pipe))
+{
+    m_spoolFailed = !m_spool.open(QIODevice::WriteOnly | QIODevice::Truncate);
+}
+
+bool ArchiveCache::Build::write(const QByteArray &data)
+{
+    // Blocks while the connection is behind, returns right away once it left
+    m_pipe->write(data);
+
+    if (!m_spoolFailed && (m_spool.pos() + data.size() > m_spoolLimit || m_spool.write(data) != data.size())) {
+        // Larger than estimated or out of disk space, which only means it is not cached
+        dropSpool();
+    }
+
+    return !isCancelled();
+}
+
+bool ArchiveCache::Build::isCancelled() const
+{
+    if (!m_pipe->isCancelled()) {
+        return false;
+    }
+
+    // The connection that started the build is gone, finish it only for those waiting.
+    // Once the spool is dropped nobody waits anymore
+    QMutexLocker locker(&m_mutex);
+    return !hasWaitersLocked();
+}
+
+bool ArchiveCache::Build::hasWaitersLocked() const
+{
+    for (const Waiter &waiter : m_waiters) {
+        if (!waiter.pipe->isCancelled()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ArchiveCache::Build::dropSpool()
+{
+    // The disk space is given back now rather than at the end
+    m_spoolFailed = true;
+    m_spool.remove();
+
+    // The waiters missed what was sent so far and cannot get it from the spool anymore
+    ArchiveCache::instance().release(this);
+    QList<Waiter> waiters;
+    {
+        QMutexLocker locker(&m_mutex);
+        waiters.swap(m_waiters);
+    }
+    handOver(waiters, QString());
+}
+
+ArchiveCache::ArchiveCache()
+    : m_directory(Config::instance().getArchiveCacheDir())
+    , m_budget(Config::instance().getArchiveCacheSize())
+    , m_totalSize(0)
+{
+    load();
+}
+
+ArchiveCache& ArchiveCache::instance()
+{
+    static ArchiveCache instance;
+    return instance;
+}
+
+QByteArray ArchiveCache::signature(const QList<ZipEntry> &entries, const QString &format, int compressionLevel)
+{
+    // Absolute paths rather than archive names, so two users with identical looking
+    // folders never share an archive
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(format.toUtf8() + ":" + QByteArray::number(compressionLevel));
+
+    for (const ZipEntry &entry : entries) {
+        QByteArray record;
+        record.append('\0').append(entry.filePath.toUtf8());
+        record.append('\0').append(entry.name.toUtf8());
+        record.append('\0').append(QByteArray::number(entry.size));
+        record.append('\0').append(QByteArray::number(entry.modified.toMSecsSinceEpoch()));
+        record.append('\0').append(QByteArray::number(entry.permissions.toInt()));
+        hash.addData(record);
+    }
+
+    return hash.result().toHex();
+}
+
+bool ArchiveCache::isEnabled() const
+{
+    return m_budget > 0;
+}
+
+bool ArchiveCache::accepts(qint64 sourceBytes) const
+{
+    // Source bytes bound a deflated archive from above, apart from headers
+    return isEnabled() && sourceBytes <= m_budget / MAX_BUDGET_SHARE;
+}
+
+ArchiveCache::Lookup ArchiveCache::acquire(const QByteArray &key, std::shared_ptr<ArchivePipe> pipe, Handover handover)
+{
+    QMutexLocker locker(&m_mutex);
+    Lookup lookup;
+
+    auto cached = m_archives.find(key);
+    if (cached != m_archives.end()) {
+        if (QFileInfo::exists(cached->filePath)) {
+            cached->lastUsed = QDateTime::currentMSecsSinceEpoch();
+            lookup.filePath = cached->filePath;
+            return lookup;
+        }
+
+        // Removed from the spool directory behind our back
+        m_totalSize -= cached->size;
+        m_archives.erase(cached);
+    }
+
+    auto building = m_builds.find(key);
+    if (building != m_builds.end()) {
+        QMutexLocker buildLocker(&(*building)->m_mutex);
+        (*building)->m_waiters.append({ pipe, std::move(handover) });
+        return lookup;
+    }
+
+    QDir().mkpath(m_directory);
+    QString spoolPath = QDir(m_directory).filePath(QUuid::createUuid().toString(QUuid::WithoutBraces) + ".tmp");
+
+    lookup.build = std::make_shared<Build>(key, spoolPath, m_budget / MAX_BUDGET_SHARE, pipe);
+    m_builds.insert(key, lookup.build);
+    return lookup;
+}
+
+void ArchiveCache::release(const Build *build)
+{
+    // A build that dropped its spool may already have been replaced by a new one
+    QMutexLocker locker(&m_mutex);
+    auto it = m_builds.find(build->m_key);
+    if (it != m_builds.end() && it->get() == build) {
+        m_builds.erase(it);
+    }
+}
+
+void ArchiveCache::handOver(const QList<Build::Waiter> &waiters, const QString &filePath)
+{
+    for (const Build::Waiter &waiter : waiters) {
+        if (!waiter.pipe->isCancelled()) {
+            waiter.handover(filePath);
+        }
+    }
+}
+
+void ArchiveCache::complete(const std::shared_ptr<Build> &build, bool success)
+{
+    release(build.get());
+
+    // Nobody can join anymore, the waiters list is final
+    QList<Build::Waiter> waiters;
+    {
+        QMutexLocker locker(&build->m_mutex);
+        waiters = build->m_waiters;
+        build->m_waiters.clear();
+    }
+
+    QString spoolPath = build->m_spool.fileName();
+    bool stored = success && !build->m_spoolFailed && build->m_spool.flush();
+    build->m_spool.close();
+
+    QString filePath = QDir(m_directory).filePath(QString::fromLatin1(build->m_key) + ".archive");
+    if (stored) {
+        QFile::remove(filePath);
+        stored = QFile::rename(spoolPath, filePath);
+    }
+
+    if (!stored) {
+        // Whatever went wrong, the waiters try on their own rather than fail with the cache
+        QFile::remove(spoolPath);
+        handOver(waiters, QString());
+        return;
+    }
+
+    qint64 size = QFileInfo(filePath).size();
+
+    // Waiters open the file before anything is evicted, an open file outlives its removal
+    handOver(waiters, filePath);
+
+    QMutexLocker locker(&m_mutex);
+    CachedArchive archive;
+    archive.filePath = filePath;
+    archive.size = size;
+    archive.lastUsed = QDateTime::currentMSecsSinceEpoch();
+    m_archives.insert(build->m_key, archive);
+    m_totalSize += size;
+    evictLocked();
+}
+
+void ArchiveCache::load()
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    QDir dir(m_directory);
+    const QFileInfoList files = dir.entryInfoList(QDir::Files);
+    for (const QFileInfo &file : files) {
+        // Builds interrupted by a restart
+        if (file.suffix() == "tmp") {
+            QFile::remove(file.absoluteFilePath());
+            continue;
+        }
+
+        if (file.suffix() != "archive") {
+            continue;
+        }
+
+        CachedArchive archive;
+        archive.filePath = file.absoluteFilePath();
+        archive.size = file.size();
+        archive.lastUsed = file.lastModified().toMSecsSinceEpoch();
+        m_archives.insert(file.completeBaseName().toLatin1(), archive);
+        m_totalSize += archive.size;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    evictLocked();
+
+    qInfo() << "Archive cache:" << m_archives.size() << "archive(s)," << m_totalSize << "bytes in" << m_directory;
+}
+
+void ArchiveCache::evictLocked()
+{
+    while (m_totalSize > m_budget && !m_archives.isEmpty()) {
+        auto oldest = m_archives.begin();
+        for (auto it = m_archives.begin(); it != m_archives.end(); ++it) {
+            if (it->lastUsed < oldest->lastUsed) {
+                oldest = it;
+            }
+        }
+
+        QFile::remove(oldest->filePath);
+        m_totalSize -= oldest->size;
+        m_archives.erase(oldest);
+    }
+}
@@ -0,0 +1,282 @@
+#include "archivejobmanager.h"
+#include "archivepipe.h"
+#include "archivecache.h"
+#include "config.h"
+#include "gzipsink.h"
+#include "tarstreamwriter.h"
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QDebug>
+
+static const qint64 PROGRESS_INTERVAL_MS = 250;
+
+ArchiveJobManager::ArchiveJobManager()
+    : m_nextJobId(1)
+{
+    m_pool.setObjectName("archive");
+    m_pool.setMaxThreadCount(Config::instance().getMaxArchiveJobs());
+}
+
+ArchiveJobManager& ArchiveJobManager::instance()
+{
+    static ArchiveJobManager instance;
+    return instance;
+}
+
+std::optional<ArchiveFormat> ArchiveJobManager::parseFormat(const QString &name)
+{
+    if (name.isEmpty() || name == "zip") {
+        return ArchiveFormat::Zip;
+    }
+    if (name == "tar") {
+        return ArchiveFormat::Tar;
+    }
+    if (name == "tar.gz" || name == "tgz") {
+        return ArchiveFormat::TarGz;
+    }
+    return std::nullopt;
+}
+
+QString ArchiveJobManager::formatExtension(ArchiveFormat format)
+{
+    switch (format) {
+    case ArchiveFormat::Tar:
+        return ".tar";
+    case ArchiveFormat::TarGz:
+        return ".tar.gz";
+    default:
+        return ".zip";
+    }
+}
+
+quint64 ArchiveJobManager::submit(std::shared_ptr<ArchivePipe> pipe, const QStringList &absPaths, const QString &baseDir,
+                                  ArchiveFormat format, int compressionLevel, ProgressCallback onProgress)
+{
+    auto job = std::make_shared<Job>();
+    job->pipe = std::move(pipe);
+    job->absPaths = absPaths;
+    job->baseDir = baseDir;
+    job->format = format;
+    job->compressionLevel = compressionLevel;
+    job->onProgress = std::move(onProgress);
+
+    {
+        QMutexLocker locker(&m_mutex);
+        job->id = m_nextJobId++;
+        m_jobs.insert(job->id, job);
+    }
+
+    // Jobs past the limit stay in the pool's queue
+    m_pool.start([this, job]() {
+        if (run(job, true)) {
+            remove(job->id);
+        }
+    });
+
+    return job->id;
+}
+
+void ArchiveJobManager::cancel(quint64 jobId)
+{
+    std::shared_ptr<Job> job;
+    {
+        QMutexLocker locker(&m_mutex);
+        job = m_jobs.take(jobId);
+    }
+
+    if (!job) {
+        return;
+    }
+
+    // Also wakes the producer if it is waiting for the client to catch up
+    job->cancelled.storeRelaxed(1);
+    job->pipe->cancel();
+}
+
+void ArchiveJobManager::shutdown()
+{
+    QList<quint64> jobIds;
+    {
+        QMutexLocker locker(&m_mutex);
+        jobIds = m_jobs.keys();
+    }
+
+    for (quint64 jobId : std::as_const(jobIds)) {
+        cancel(jobId);
+    }
+
+    m_pool.waitForDone();
+}
+
+// Zip and tar writers share addEntry(), finish() and errorString(). A build for the
+// cache carries on after its own connection left while others wait for it
+template<typename Writer>
+static bool writeEntries(Writer &writer, ArchiveSink *sink, const QList<ZipEntry> &entries,
+                         ArchiveProgress &progress, QString &error)
+{
+    for (const ZipEntry &entry : entries) {
+        if (sink->isCancelled()) {
+            error = "Cancelled";
+            return false;
+        }
+
+        if (!writer.addEntry(entry)) {
+            error = writer.errorString();
+            return false;
+        }
+        ++progress.filesDone;
+    }
+
+    bool success = writer.finish();
+    error = writer.errorString();
+    return success;
+}
+
+bool ArchiveJobManager::run(const std::shared_ptr<Job> &job, bool useCache)
+{
+    ArchivePipe *pipe = job->pipe.get();
+
+    // Cancelled while queued, nothing was read yet
+    if (job->cancelled.loadRelaxed()) {
+        return true;
+    }
+
+    QList<ZipEntry> entries;
+    for (const QString &absPath : std::as_const(job->absPaths)) {
+        if (job->cancelled.loadRelaxed()) {
+            return true;
+        }
+        ZipStreamWriter::collectEntries(absPath, job->baseDir, entries);
+    }
+
+    ArchiveProgress progress;
+    progress.jobId = job->id;
+    progress.totalFiles = entries.size();
+    for (const ZipEntry &entry : std::as_const(entries)) {
+        progress.totalBytes += entry.size;
+    }
+    report(job, progress);
+
+    ArchiveSink *sink = pipe;
+    std::shared_ptr<ArchiveCache::Build> build;
+
+    // Stored archives are read back as fast as they are written, only compression is worth
+    // keeping, and only when the archive is small next to the cache
+    bool compressed = job->format == ArchiveFormat::TarGz
+                      || (job->format == ArchiveFormat::Zip && job->compressionLevel > 0);
+    ArchiveCache &cache = ArchiveCache::instance();
+    if (useCache && compressed && cache.accepts(progress.totalBytes)) {
+        QByteArray key = ArchiveCache::signature(entries, formatExtension(job->format), job->compressionLevel);
+        ArchiveCache::Lookup lookup = cache.acquire(key, job->pipe, [this, job](const QString &filePath) {
+            if (filePath.isEmpty()) {
+                // The build could not be cached, this job makes its own archive after all
+                m_pool.start([this, job]() {
+                    run(job, false);
+                    remove(job->id);
+                });
+                return;
+            }
+            job->pipe->serveFile(filePath);
+            remove(job->id);
+        });
+        if (!lookup.filePath.isEmpty()) {
+            qInfo() << "Archive job" << job->id << "served from cache";
+            pipe->serveFile(lookup.filePath);
+            return true;
+        }
+
+        // Another job is building the same archive, the job stays listed until it is handed over
+        if (!lookup.build) {
+            return false;
+        }
+
+        build = lookup.build;
+        sink = build.get();
+    }
+
+    // Without compression the final size is known before the first byte
+    qint64 totalSize = -1;
+    if (job->format == ArchiveFormat::Tar) {
+        totalSize = TarStreamWriter::archiveSize(entries);
+    } else if (job->format == ArchiveFormat::Zip && job->compressionLevel == 0) {
+        totalSize = ZipStreamWriter::storedArchiveSize(entries);
+    }
+    pipe->start(totalSize);
+
+    QElapsedTimer reportTimer;
+    reportTimer.start();
+    auto onBytes = [this, job, &progress, &reportTimer](qint64 bytes) {
+        progress.bytesDone += bytes;
+        if (reportTimer.elapsed() >= PROGRESS_INTERVAL_MS) {
+            reportTimer.restart();
+            report(job, progress);
+        }
+    };
+
+    bool success = false;
+    QString error;
+
+    if (job->format == ArchiveFormat::Zip) {
+        ZipStreamWriter writer(sink, job->compressionLevel);
+        writer.setProgressCallback(onBytes);
+        success = writeEntries(writer, sink, entries, progress, error);
+        if (success) {
+            logStats(job->id, writer.stats());
+        }
+    } else if (job->format == ArchiveFormat::Tar) {
+        TarStreamWriter writer(sink);
+        writer.setProgressCallback(onBytes);
+        success = writeEntries(writer, sink, entries, progress, error);
+    } else {
+        // A plain gzip stream has no use for stored entries, level 0 gets the default instead
+        GzipSink gzip(sink, job->compressionLevel > 0 ? job->compressionLevel : Z_DEFAULT_COMPRESSION);
+        TarStreamWriter writer(&gzip);
+        writer.setProgressCallback(onBytes);
+        success = writeEntries(writer, &gzip, entries, progress, error) && gzip.finish();
+        if (!success && error.isEmpty()) {
+            error = "Cancelled";
+        }
+    }
+
+    report(job, progress);
+    pipe->finish(success, error);
+
+    if (build) {
+        cache.complete(build, success);
+    }
+    return true;
+}
+
+void ArchiveJobManager::logStats(quint64 jobId, const ZipStreamWriter::Stats &stats)
+{
+    if (stats.deflatedInput == 0 && stats.storedEntries == 0 && stats.reusedEntries == 0) {
+        return;
+    }
+
+    // What storing already compressed entries spared, estimated from this job's own deflate speed
+    qint64 savedMs = 0;
+    if (stats.deflatedInput > 0) {
+        savedMs = qint64(double(stats.deflateNsecs) / stats.deflatedInput * stats.storedBytes / 1000000);
+    }
+
+    qInfo() << "Archive job" << jobId << "deflated" << stats.deflatedInput << "bytes to" << stats.deflatedOutput
+            << "(saved" << stats.deflatedInput - stats.deflatedOutput << "bytes), stored"
+            << stats.storedEntries << "already compressed entries of" << stats.storedBytes
+            << "bytes without deflating (about" << savedMs << "ms of CPU saved), reused"
+            << stats.reusedEntries << "previously deflated entries of" << stats.reusedBytes << "bytes";
+}
+
+void ArchiveJobManager::report(const std::shared_ptr<Job> &job, const ArchiveProgress &progress)
+{
+    // A cancelled job no longer has anyone to report to
+    QMutexLocker locker(&m_mutex);
+    if (job->onProgress && m_jobs.contains(job->id)) {
+        job->onProgress(progress);
+    }
+}
+
+void ArchiveJobManager::remove(quint64 jobId)
+{
+    QMutexLocker locker(&m_mutex);
+    m_jobs.remove(jobId);
+}
@@ -0,0 +1,177 @@
+#include "archivepipe.h"
+#include "downloadsource.h"
+#include <cstring>
+
+ArchivePipe::ArchivePipe(qint64 capacity)
+    : m_sourceRead(0)
+    , m_readOffset(0)
+    , m_buffered(0)
+    , m_capacity(capacity)
+    , m_totalSize(-1)
+    , m_started(false)
+    , m_finished(false)
+    , m_success(false)
+    , m_cancelled(false)
+{
+}
+
+ArchivePipe::~ArchivePipe()
+{
+}
+
+bool ArchivePipe::write(const QByteArray &data)
+{
+    if (data.isEmpty()) {
+        return !isCancelled();
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    while (!m_cancelled && m_buffered > 0 && m_buffered + data.size() > m_capacity) {
+        m_notFull.wait(&m_mutex);
+    }
+
+    if (m_cancelled) {
+        return false;
+    }
+
+    // The consumer stops polling once it drained everything, wake it up again
+    bool wasEmpty = m_buffered == 0;
+    m_chunks.append(data);
+    m_buffered += data.size();
+
+    if (wasEmpty) {
+        notifyLocked();
+    }
+    return true;
+}
+
+void ArchivePipe::start(qint64 totalSize)
+{
+    QMutexLocker locker(&m_mutex);
+    m_totalSize = totalSize;
+    m_started = true;
+    notifyLocked();
+}
+
+void ArchivePipe::finish(bool success, const QString &error)
+{
+    QMutexLocker locker(&m_mutex);
+    m_started = true;
+    m_finished = true;
+    m_success = success;
+    m_error = error;
+    notifyLocked();
+}
+
+bool ArchivePipe::serveFile(const QString &filePath)
+{
+    auto source = std::make_unique<DownloadSource>(filePath);
+    if (!source->open()) {
+        finish(false, "Failed to open cached archive");
+        return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_totalSize = source->size();
+    m_source = std::move(source);
+    m_started = true;
+    m_finished = true;
+    m_success = true;
+    notifyLocked();
+    return true;
+}
+
+bool ArchivePipe::isCancelled() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_cancelled;
+}
+
+qint64 ArchivePipe::read(char *dst, qint64 maxLength)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_source) {
+        qint64 read = m_source->read(dst, maxLength);
+        if (read > 0) {
+            m_sourceRead += read;
+        }
+        return read;
+    }
+
+    qint64 copied = 0;
+    while (copied < maxLength && !m_chunks.isEmpty()) {
+        const QByteArray &chunk = m_chunks.first();
+        qint64 length = qMin(maxLength - copied, chunk.size() - m_readOffset);
+        std::memcpy(dst + copied, chunk.constData() + m_readOffset, length);
+        copied += length;
+        m_readOffset += length;
+
+        if (m_readOffset == chunk.size()) {
+            m_chunks.removeFirst();
+            m_readOffset = 0;
+        }
+    }
+
+    m_buffered -= copied;
+    if (copied > 0) {
+        m_notFull.wakeAll();
+    }
+    return copied;
+}
+
+bool ArchivePipe::isStarted() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_started;
+}
+
+qint64 ArchivePipe::totalSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_totalSize;
+}
+
+bool ArchivePipe::atEnd() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_finished && m_buffered == 0 && (!m_source || m_sourceRead >= m_totalSize);
+}
+
+bool ArchivePipe::succeeded() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_success;
+}
+
+QString ArchivePipe::errorString() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_error;
+}
+
+void ArchivePipe::cancel()
+{
+    QMutexLocker locker(&m_mutex);
+    m_cancelled = true;
+    m_readyCallback = nullptr;
+    m_source.reset();
+    m_chunks.clear();
+    m_buffered = 0;
+    m_readOffset = 0;
+    m_notFull.wakeAll();
+}
+
+void ArchivePipe::setReadyCallback(std::function<void()> callback)
+{
+    QMutexLocker locker(&m_mutex);
+    m_readyCallback = std::move(callback);
+}
+
+void ArchivePipe::notifyLocked()
+{
+    if (m_readyCallback) {
+        m_readyCallback();
+    }
+}
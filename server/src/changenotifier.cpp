@@ -0,0 +1,201 @@
+#include "changenotifier.h"
+#include "clientconnection.h"
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QMetaObject>
+
+ChangeNotifier& ChangeNotifier::instance()
+{
+    static ChangeNotifier instance;
+    return instance;
+}
+
+void ChangeNotifier::attach(ClientConnection *connection, const QString &rootPath)
+{
+    QMutexLocker locker(&m_mutex);
+    Subscriber &subscriber = m_subscribers[connection];
+    subscriber.rootPath = rootPath;
+    subscriber.listedFolder.clear();
+    subscriber.treeFolders.clear();
+}
+
+void ChangeNotifier::detach(ClientConnection *connection)
+{
+    QMutexLocker locker(&m_mutex);
+    m_subscribers.remove(connection);
+}
+
+void ChangeNotifier::setListedFolder(ClientConnection *connection, const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_subscribers.find(connection);
+    if (it != m_subscribers.end()) {
+        it->listedFolder = normalize(path);
+    }
+}
+
+void ChangeNotifier::addTreeFolder(ClientConnection *connection, const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_subscribers.find(connection);
+    if (it != m_subscribers.end()) {
+        it->treeFolders.insert(normalize(path));
+    }
+}
+
+void ChangeNotifier::removeTreeFolder(ClientConnection *connection, const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_subscribers.find(connection);
+    if (it != m_subscribers.end()) {
+        removeTreeFolders(*it, normalize(path));
+    }
+}
+
+void ChangeNotifier::created(const QString &rootPath, const QString &path)
+{
+    publish(rootPath, "created", path, QString());
+}
+
+void ChangeNotifier::changed(const QString &rootPath, const QString &path)
+{
+    publish(rootPath, "changed", path, QString());
+}
+
+void ChangeNotifier::deleted(const QString &rootPath, const QString &path)
+{
+    publish(rootPath, "deleted", path, QString());
+}
+
+void ChangeNotifier::moved(const QString &rootPath, const QString &fromPath, const QString &toPath)
+{
+    publish(rootPath, "moved", fromPath, toPath);
+}
+
+void ChangeNotifier::renamed(const QString &rootPath, const QString &fromPath, const QString &toPath)
+{
+    publish(rootPath, "renamed", fromPath, toPath);
+}
+
+QString ChangeNotifier::normalize(const QString &path)
+{
+    return path.split('/', Qt::SkipEmptyParts).join('/');
+}
+
+QString ChangeNotifier::parentOf(const QString &path)
+{
+    int slash = path.lastIndexOf('/');
+    return slash >= 0 ? path.left(slash) : QString("");
+}
+
+QJsonObject ChangeNotifier::describe(const QString &rootPath, const QString &path)
+{
+    // Same fields as an entry of list_directory, plus what the tree needs for folders
+    QFileInfo info(QDir(rootPath).filePath(path));
+    if (!info.exists()) {
+        return QJsonObject();
+    }
+
+    QJsonObject item;
+    item["name"] = info.fileName();
+    item["path"] = path;
+    item["isDir"] = info.isDir();
+    item["size"] = info.size();
+    item["modified"] = info.lastModified().toString(Qt::ISODate);
+    if (info.isDir()) {
+        item["hasChildren"] = QDirIterator(info.absoluteFilePath(), QDir::Dirs | QDir::NoDotAndDotDot).hasNext();
+    }
+    return item;
+}
+
+bool ChangeNotifier::concerns(const Subscriber &subscriber, const QString &path, bool isDir)
+{
+    QString parent = parentOf(path);
+    if (parent == subscriber.listedFolder) {
+        return true;
+    }
+
+    // Files are not shown in the tree
+    if (!isDir) {
+        return false;
+    }
+    if (subscriber.treeFolders.contains(parent)) {
+        return true;
+    }
+
+    // A folder shown collapsed in the tree may need an expander for a new subfolder
+    return !parent.isEmpty() && subscriber.treeFolders.contains(parentOf(parent));
+}
+
+void ChangeNotifier::removeTreeFolders(Subscriber &subscriber, const QString &path)
+{
+    // Everything is below the root
+    if (path.isEmpty()) {
+        subscriber.treeFolders.clear();
+        return;
+    }
+
+    QString prefix = path + '/';
+    for (auto it = subscriber.treeFolders.begin(); it != subscriber.treeFolders.end();) {
+        if (*it == path || it->startsWith(prefix)) {
+            it = subscriber.treeFolders.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ChangeNotifier::publish(const QString &rootPath, const QString &kind, const QString &path, const QString &toPath)
+{
+    QString from = normalize(path);
+    QString to = toPath.isEmpty() ? QString() : normalize(toPath);
+
+    QJsonObject change;
+    change["kind"] = kind;
+    change["path"] = from;
+    if (!to.isEmpty()) {
+        change["toPath"] = to;
+    }
+
+    // Read from disk before taking the lock, it is shared by every connection
+    QJsonObject item;
+    if (kind != "deleted") {
+        item = describe(rootPath, to.isEmpty() ? from : to);
+        if (item.isEmpty()) {
+            return;
+        }
+        change["item"] = item;
+    }
+
+    // Whatever was deleted may have been a folder in someone's tree
+    bool isDir = kind == "deleted" || item["isDir"].toBool();
+
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_subscribers.begin(); it != m_subscribers.end(); ++it) {
+        Subscriber &subscriber = it.value();
+        if (subscriber.rootPath != rootPath) {
+            continue;
+        }
+
+        bool concerned = concerns(subscriber, from, isDir) || (!to.isEmpty() && concerns(subscriber, to, isDir));
+
+        // The folder is gone from where the trees loaded it, a moved one is asked for
+        // again under its new path once it is expanded there
+        if (isDir && kind != "created" && kind != "changed") {
+            removeTreeFolders(subscriber, from);
+        }
+
+        if (!concerned) {
+            continue;
+        }
+
+        // Queued to the thread of the connection. Posted under the lock, so a connection
+        // being destroyed either is no longer listed or drops the call with its other events
+        ClientConnection *connection = it.key();
+        QMetaObject::invokeMethod(connection, [connection, change]() {
+            connection->sendChange(change);
+        }, Qt::QueuedConnection);
+    }
+}
@@ -1,9 +1,14 @@
 #include "clientconnection.h"
 #include "config.h"
 #include "protocol.h"
+#include "uploadsessionmanager.h"
+#include "metadataindex.h"
+#include "changenotifier.h"
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QCborValue>
+#include <QCborMap>
 #include <QFileInfo>
 #include <QDir>
 #include <QBuffer>
@@ -12,23 +17,80 @@
 #include <QDirIterator>
 #include <QCoreApplication>
 #include <QDateTime>
+#include <QThreadPool>
+#include <QPromise>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <memory>
 #include "version.h"
 
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <cerrno>
+#endif
+
+// Reserves disk blocks for the rest of an upload without changing the file size,
+// which the resume offset relies on. Only fails when the disk is actually full.
+static bool preallocate(QFile *file, qint64 offset, qint64 length)
+{
+#ifdef Q_OS_LINUX
+    if (length > 0 && fallocate(file->handle(), FALLOC_FL_KEEP_SIZE, offset, length) != 0) {
+        return errno != ENOSPC && errno != EDQUOT;
+    }
+#else
+    Q_UNUSED(file)
+    Q_UNUSED(offset)
+    Q_UNUSED(length)
+#endif
+    return true;
+}
+
+// Search results are capped so one request cannot hold a command thread for long
+static const int SEARCH_PAGE_SIZE = 100;
+static const int MAX_SEARCH_PAGE_SIZE = 1000;
+
+// Images get a preview url the client loads thumbnails from
+static void addPreviewUrls(QJsonArray &files)
+{
+    for (int i = 0; i < files.size(); ++i) {
+        QJsonObject fileObj = files[i].toObject();
+
+        if (!fileObj["isDir"].toBool()) {
+            QString fileName = fileObj["name"].toString().toLower();
+            if (fileName.endsWith(".jpg") || fileName.endsWith(".jpeg") ||
+                fileName.endsWith(".png") || fileName.endsWith(".gif") ||
+                fileName.endsWith(".bmp") || fileName.endsWith(".webp")) {
+
+                QString previewUrl = "preview://" + fileObj["path"].toString();
+                fileObj["previewUrl"] = previewUrl;
+                files[i] = fileObj;
+            }
+        }
+    }
+}
+
+static QThreadPool* commandPool()
+{
+    // Kept apart from the global pool so long running zip jobs never delay listings
+    static QThreadPool pool;
+    return &pool;
+}
+
 ClientConnection::ClientConnection(QWebSocket *socket, FileManager *fileManager, QObject *parent)
     : QObject(parent)
     , m_socket(socket)
     , m_fileManager(nullptr)
     , m_authenticated(false)
-    , m_uploadFile(nullptr)
-    , m_uploadExpectedSize(0)
-    , m_uploadReceivedSize(0)
-    , m_downloadFile(nullptr)
-    , m_downloadTotalSize(0)
-    , m_downloadSentSize(0)
-    , m_isZipDownload(false)
+    , m_cborEncoding(false)
+    , m_httpServer(nullptr)
+    , m_lastDownloadStream(0)
     , m_authDelayTimer(new QTimer(this))
+    , m_diskWriter(new DiskWriter())
+    , m_pendingWriteBytes(0)
+    , m_rttProbePending(false)
     , m_pingTimer(new QTimer(this))
     , m_pongTimeoutTimer(new QTimer(this))
+    , m_waitingForPong(false)
 {
     Q_UNUSED(fileManager)
     connect(m_socket, &QWebSocket::textMessageReceived, this, &ClientConnection::onTextMessageReceived);
@@ -43,16 +105,29 @@ ClientConnection::ClientConnection(QWebSocket *socket, FileManager *fileManager,
     m_pingTimer->setInterval(30000);
     m_pongTimeoutTimer->setInterval(10000);
     m_pongTimeoutTimer->setSingleShot(true);
+
+    connect(m_diskWriter, &DiskWriter::written, this, &ClientConnection::onUploadWritten);
+    connect(m_diskWriter, &DiskWriter::failed, this, &ClientConnection::onUploadWriteFailed);
+    connect(m_diskWriter, &DiskWriter::closed, this, &ClientConnection::onUploadClosed);
 }
 
 ClientConnection::~ClientConnection()
 {
-    cleanupDownload();
+    ChangeNotifier::instance().detach(this);
+
+    const QList<quint32> uploads = m_uploads.keys();
+    for (quint32 streamId : uploads) {
+        closeUpload(streamId, false);
+    }
 
-    if (m_isZipDownload && !m_downloadPath.isEmpty()) {
-        QFile::remove(m_downloadPath);
+    const QList<quint32> downloads = m_downloads.keys();
+    for (quint32 streamId : downloads) {
+        closeDownload(streamId);
     }
 
+    // Deleted on the I/O thread once the closes queued above are done
+    m_diskWriter->deleteLater();
+
     if (m_socket) {
         m_socket->close();
         m_socket->deleteLater();
@@ -82,40 +157,186 @@ void ClientConnection::onBinaryMessageReceived(const QByteArray &message)
         return;
     }
 
-    if (!m_uploadFile || !m_uploadFile->isOpen()) {
-        sendError("No upload in progress");
+    if (message.isEmpty()) {
+        sendError("Empty frame");
+        return;
+    }
+
+    if (message.at(0) == Protocol::Frames::CONTROL && m_cborEncoding) {
+        handleControlFrame(QByteArrayView(message).sliced(1));
+    } else if (message.at(0) == Protocol::Frames::DATA && message.size() >= Protocol::Frames::DATA_HEADER_SIZE) {
+        quint32 streamId = Protocol::Frames::readStreamId(message.constData());
+        writeUploadData(streamId, QByteArrayView(message).sliced(Protocol::Frames::DATA_HEADER_SIZE));
+    } else {
+        sendError("Unknown frame kind");
+    }
+}
+
+void ClientConnection::handleControlFrame(QByteArrayView payload)
+{
+    if (m_waitingForPong) {
+        m_pongTimeoutTimer->stop();
+        m_waitingForPong = false;
+    }
+
+    QCborValue command = QCborValue::fromCbor(payload.data(), payload.size());
+    if (!command.isMap()) {
+        sendError("Invalid CBOR format");
         return;
     }
 
-    qint64 written = m_uploadFile->write(message);
-    if (written != message.size()) {
-        sendError("Failed to write to file");
-        m_uploadFile->close();
-        delete m_uploadFile;
-        m_uploadFile = nullptr;
-        m_uploadPath.clear();
+    handleCommand(command.toMap().toJsonObject());
+}
+
+void ClientConnection::writeUploadData(quint32 streamId, QByteArrayView payload)
+{
+    auto it = m_uploads.find(streamId);
+    if (it == m_uploads.end() || it->committing) {
+        // Frames already in flight when an upload got cancelled end up here
         return;
     }
 
-    m_uploadReceivedSize += written;
+    UploadStream &upload = it.value();
+    qint64 length = qMin<qint64>(payload.size(), upload.expectedSize - upload.receivedSize);
 
-    if (m_uploadReceivedSize >= m_uploadExpectedSize) {
-        m_uploadFile->flush();
-        m_uploadFile->close();
-        delete m_uploadFile;
-        m_uploadFile = nullptr;
+    // Clients keep at most WRITE_WINDOW bytes unacknowledged, so memory stays bounded
+    // even when the disk is slower than the network
+    if (m_pendingWriteBytes + length > WRITE_WINDOW) {
+        QJsonValue requestId = upload.requestId;
+        closeUpload(streamId, false);
+        sendError("Upload window exceeded", requestId);
+        return;
+    }
 
-        QJsonObject data;
-        data["path"] = m_uploadPath;
-        data["size"] = m_uploadReceivedSize;
-        sendResponse(Protocol::Responses::UPLOAD_COMPLETE, data);
+    m_diskWriter->write(upload.writerId, payload.first(length).toByteArray());
+    upload.receivedSize += length;
+    m_pendingWriteBytes += length;
 
-        m_uploadPath.clear();
-        m_uploadExpectedSize = 0;
-        m_uploadReceivedSize = 0;
+    if (upload.receivedSize >= upload.expectedSize) {
+        completeUpload(streamId);
     }
 }
 
+void ClientConnection::completeUpload(quint32 streamId)
+{
+    UploadStream &upload = m_uploads[streamId];
+    upload.committing = true;
+
+    // upload_complete is only sent from onUploadClosed, once the file is synced and in place
+    QString sessionId = upload.sessionId;
+    QString path = upload.path;
+    QString rootPath = m_fileManager->rootPath();
+    bool replacing = QFileInfo(upload.targetPath).isFile();
+    std::shared_ptr<MetadataIndex> index = m_fileManager->index();
+    m_diskWriter->close(upload.writerId, DiskWriter::CloseMode::Commit, upload.targetPath, [sessionId, path, rootPath, replacing, index](bool success) {
+        if (success) {
+            // Counted as stored before its reservation goes away with the session
+            index->refresh(path);
+            UploadSessionManager::instance().finish(sessionId);
+            if (replacing) {
+                ChangeNotifier::instance().changed(rootPath, path);
+            } else {
+                ChangeNotifier::instance().created(rootPath, path);
+            }
+        } else {
+            UploadSessionManager::instance().discard(sessionId);
+        }
+    });
+}
+
+void ClientConnection::closeUpload(quint32 streamId, bool discard)
+{
+    auto it = m_uploads.find(streamId);
+    if (it == m_uploads.end()) {
+        return;
+    }
+
+    UploadStream upload = *it;
+    m_uploads.erase(it);
+    m_pendingWriteBytes -= upload.receivedSize - upload.writtenSize;
+
+    if (upload.committing) {
+        // Too late to cancel, the commit finishes on its own
+        return;
+    }
+
+    // Unless cancelled, the part file is kept so the client can resume later. The
+    // session is only released once the writer is done with the file
+    QString sessionId = upload.sessionId;
+    DiskWriter::CloseMode mode = discard ? DiskWriter::CloseMode::Discard : DiskWriter::CloseMode::Keep;
+    m_diskWriter->close(upload.writerId, mode, QString(), [sessionId, discard](bool) {
+        if (discard) {
+            UploadSessionManager::instance().discard(sessionId);
+        } else {
+            UploadSessionManager::instance().detach(sessionId);
+        }
+    });
+}
+
+QHash<quint32, ClientConnection::UploadStream>::iterator ClientConnection::findUploadByWriter(quint64 writerId)
+{
+    for (auto it = m_uploads.begin(); it != m_uploads.end(); ++it) {
+        if (it->writerId == writerId) {
+            return it;
+        }
+    }
+    return m_uploads.end();
+}
+
+void ClientConnection::onUploadWritten(quint64 writerId, qint64 bytes)
+{
+    auto it = findUploadByWriter(writerId);
+    if (it == m_uploads.end()) {
+        return;
+    }
+
+    it->writtenSize += bytes;
+    m_pendingWriteBytes -= bytes;
+
+    QJsonObject data;
+    data[Protocol::Fields::STREAM_ID] = qint64(it.key());
+    data["size"] = it->writtenSize;
+    sendResponse(Protocol::Responses::UPLOAD_ACK, data, QJsonValue());
+}
+
+void ClientConnection::onUploadWriteFailed(quint64 writerId, const QString &error)
+{
+    auto it = findUploadByWriter(writerId);
+    if (it == m_uploads.end()) {
+        return;
+    }
+
+    qWarning() << "Failed to write upload" << it->path << ":" << error;
+
+    QJsonValue requestId = it->requestId;
+    closeUpload(it.key(), false);
+    sendError("Failed to write to file", requestId);
+}
+
+void ClientConnection::onUploadClosed(quint64 writerId, bool success)
+{
+    auto it = findUploadByWriter(writerId);
+    if (it == m_uploads.end() || !it->committing) {
+        return;
+    }
+
+    quint32 streamId = it.key();
+    UploadStream upload = *it;
+    m_uploads.erase(it);
+    m_pendingWriteBytes -= upload.receivedSize - upload.writtenSize;
+
+    if (!success) {
+        sendError("Failed to store uploaded file", upload.requestId);
+        return;
+    }
+
+    QJsonObject data;
+    data["path"] = upload.path;
+    data["size"] = upload.receivedSize;
+    data[Protocol::Fields::STREAM_ID] = qint64(streamId);
+    sendResponse(Protocol::Responses::UPLOAD_COMPLETE, data, upload.requestId);
+}
+
 void ClientConnection::onDisconnected()
 {
     m_pingTimer->stop();
@@ -125,13 +346,18 @@ void ClientConnection::onDisconnected()
 
 void ClientConnection::onBytesWritten(qint64 bytes)
 {
-    Q_UNUSED(bytes)
+    m_pacer.onBytesWritten(bytes, m_socket->bytesToWrite());
 
-    if (m_downloadFile && m_downloadFile->isOpen()) {
-        if (m_socket->bytesToWrite() < CHUNK_SIZE * 2) {
-            sendNextDownloadChunk();
-        }
+    if (m_downloads.isEmpty()) {
+        return;
     }
+
+    // Pings double as RTT probes, send them more often while data is flowing
+    if (!m_rttProbePending && m_pingSentTimer.isValid() && m_pingSentTimer.elapsed() > RTT_PROBE_INTERVAL) {
+        sendPing();
+    }
+
+    pumpDownloads();
 }
 
 void ClientConnection::handleCommand(const QJsonObject &command)
@@ -139,6 +365,15 @@ void ClientConnection::handleCommand(const QJsonObject &command)
     QString type = command["type"].toString();
     QJsonObject params = command["params"].toObject();
 
+    // Responses sent while the command is dispatched carry its request id,
+    // asynchronous work captures it before returning
+    m_currentRequestId = command.value(Protocol::Fields::REQUEST_ID);
+    dispatchCommand(type, params);
+    m_currentRequestId = QJsonValue();
+}
+
+void ClientConnection::dispatchCommand(const QString &type, const QJsonObject &params)
+{
     if (type == Protocol::Commands::AUTHENTICATE) {
         handleAuthenticate(params);
         return;
@@ -171,6 +406,8 @@ void ClientConnection::handleCommand(const QJsonObject &command)
         handleDownloadMultiple(params);
     } else if (type == Protocol::Commands::UPLOAD_FILE) {
         handleUploadFile(params);
+    } else if (type == Protocol::Commands::RESUME_UPLOAD) {
+        handleResumeUpload(params);
     } else if (type == Protocol::Commands::CANCEL_UPLOAD) {
         handleCancelUpload(params);
     } else if (type == Protocol::Commands::CANCEL_DOWNLOAD) {
@@ -187,8 +424,16 @@ void ClientConnection::handleCommand(const QJsonObject &command)
         handleGetServerInfo();
     } else if (type == Protocol::Commands::GET_THUMBNAIL) {
         handleGetThumbnail(params);
+    } else if (type == Protocol::Commands::GET_TRANSFER_STATS) {
+        handleGetTransferStats();
     } else if (type == Protocol::Commands::GET_FOLDER_TREE) {
         handleGetFolderTree(params);
+    } else if (type == Protocol::Commands::GET_CHILDREN) {
+        handleGetChildren(params);
+    } else if (type == Protocol::Commands::RELEASE_CHILDREN) {
+        handleReleaseChildren(params);
+    } else if (type == Protocol::Commands::SEARCH) {
+        handleSearch(params);
     } else if (type == Protocol::Commands::CREATE_USER) {
         handleCreateUser(params);
     } else if (type == Protocol::Commands::EDIT_USER) {
@@ -217,19 +462,26 @@ void ClientConnection::handleAuthenticate(const QJsonObject &params)
     m_pendingAuthUsername = username;
     m_pendingAuthPassword = password;
     m_pendingAuthClientVersion = clientVersion;
+    m_pendingAuthRequestId = m_currentRequestId;
 
     QString errorMessage;
     AuthResult result = authenticate(username, password, clientVersion, errorMessage);
 
     if (result == AuthResult::Success) {
-        User* user = Config::instance().getUser(username);
+        std::optional<User> user = Config::instance().getUser(username);
         QJsonObject data;
         data["success"] = true;
         data["serverVersion"] = APP_VERSION_STRING;
         data["isAdmin"] = user ? user->isAdmin : false;
+
+        // The reply itself is always JSON, the negotiated encoding applies from the next message on
+        bool useCbor = params[Protocol::Fields::ENCODING].toString() == Protocol::Encodings::CBOR;
+        data[Protocol::Fields::ENCODING] = useCbor ? Protocol::Encodings::CBOR : Protocol::Encodings::JSON;
         sendResponse(Protocol::Responses::AUTHENTICATE, data);
+        m_cborEncoding = useCbor;
 
         m_pingTimer->start();
+        sendPing();
         m_pendingAuthUsername.clear();
         m_pendingAuthPassword.clear();
         m_pendingAuthClientVersion.clear();
@@ -241,6 +493,12 @@ void ClientConnection::handleAuthenticate(const QJsonObject &params)
 
 void ClientConnection::handleDownloadMultiple(const QJsonObject &params)
 {
+    quint32 streamId = params[Protocol::Fields::STREAM_ID].toInteger();
+    if (isDownloadStreamBusy(streamId)) {
+        sendError("Download stream already in use");
+        return;
+    }
+
     QJsonArray pathsArray = params["paths"].toArray();
     QStringList paths;
 
@@ -256,85 +514,51 @@ void ClientConnection::handleDownloadMultiple(const QJsonObject &params)
         return;
     }
 
-    // Create temp directory for zip file
-    QString tempDir = QDir::temp().filePath("odzndrive-" + QString::number(QCoreApplication::applicationPid()));
-    QDir().mkpath(tempDir);
+    std::optional<ArchiveFormat> format = ArchiveJobManager::parseFormat(params["format"].toString());
+    if (!format) {
+        sendError("Unsupported archive format");
+        return;
+    }
 
-    QString zipFileName = params["zipName"].toString() + ".zip";
-    QString zipPath = QDir(tempDir).filePath(zipFileName);
+    QString zipFileName = params["zipName"].toString() + ArchiveJobManager::formatExtension(*format);
 
-    // Notify client that zipping has started
+    // The job may have to wait for a free archive slot, progress follows once it runs
     QJsonObject zipData;
-    zipData["status"] = "zipping";
+    zipData["status"] = "queued";
     zipData["name"] = zipFileName;
+    zipData[Protocol::Fields::STREAM_ID] = qint64(streamId);
     zipData["count"] = paths.size();
     sendResponse(Protocol::Responses::DOWNLOAD_ZIPPING, zipData);
 
-    // Remove any existing zip file
-    QFile::remove(zipPath);
-
-    int compressionLevel = Config::instance().getCompressionLevel();
-
-    // Connect to completion signal (use single-shot connection)
-    connect(m_fileManager, &FileManager::zipCreationComplete, this,
-            [this, zipFileName](bool success, const QString &zipPath) {
-                if (!success) {
-                    sendError("Failed to create zip file");
-                    QFile::remove(zipPath);
-                    return;
-                }
-
-                // Check if zip file was created
-                QFileInfo zipInfo(zipPath);
-                if (!zipInfo.exists()) {
-                    sendError("Zip file was not created");
-                    return;
-                }
-
-                // Clean up any existing download
-                cleanupDownload();
-
-                // Open the zip file for download
-                m_downloadFile = new QFile(zipPath);
-                if (!m_downloadFile->open(QIODevice::ReadOnly)) {
-                    sendError("Failed to open zip file");
-                    delete m_downloadFile;
-                    m_downloadFile = nullptr;
-                    QFile::remove(zipPath);
-                    return;
-                }
-
-                // Set download state
-                m_downloadPath = zipPath;
-                m_downloadTotalSize = zipInfo.size();
-                m_downloadSentSize = 0;
-                m_isZipDownload = true;
-
-                // Send download start metadata
-                QJsonObject metadata;
-                metadata["name"] = zipFileName;
-                metadata["size"] = m_downloadTotalSize;
-                sendResponse(Protocol::Responses::DOWNLOAD_START, metadata);
-
-                // Start sending chunks
-                for (int i = 0; i < 3 && m_downloadSentSize < m_downloadTotalSize; ++i) {
-                    sendNextDownloadChunk();
-                }
-            }, Qt::SingleShotConnection);
+    QStringList absPaths;
+    for (const QString &path : std::as_const(paths)) {
+        absPaths.append(m_fileManager->getAbsolutePath(path));
+    }
 
-    // Start async compression
-    m_fileManager->createZipFromMultiplePathsAsync(paths, zipPath, compressionLevel);
+    startArchiveDownload(streamId, zipFileName, *format, absPaths, m_fileManager->rootPath());
 }
 
 void ClientConnection::handleDownloadDirectory(const QJsonObject &params)
 {
     QString path = params["path"].toString();
+    quint32 streamId = params[Protocol::Fields::STREAM_ID].toInteger();
+
+    if (isDownloadStreamBusy(streamId)) {
+        sendError("Download stream already in use");
+        return;
+    }
 
     if (!m_fileManager->isValidPath(path)) {
         sendError("Invalid directory path");
         return;
     }
 
+    std::optional<ArchiveFormat> format = ArchiveJobManager::parseFormat(params["format"].toString());
+    if (!format) {
+        sendError("Unsupported archive format");
+        return;
+    }
+
     QString absPath = m_fileManager->getAbsolutePath(path);
     QFileInfo fileInfo(absPath);
 
@@ -348,91 +572,80 @@ void ClientConnection::handleDownloadDirectory(const QJsonObject &params)
         dirName = "root";
     }
 
-    // Create temp directory for zip file
-    QString tempDir = QDir::temp().filePath("odzndrive-" + QString::number(QCoreApplication::applicationPid()));
-    QDir().mkpath(tempDir);
-
-    QString zipFileName = dirName + ".zip";
-    QString zipPath = QDir(tempDir).filePath(zipFileName);
+    QString zipFileName = dirName + ArchiveJobManager::formatExtension(*format);
 
-    // Notify client that zipping has started
     QJsonObject zipData;
-    zipData["status"] = "zipping";
+    zipData["status"] = "queued";
     zipData["name"] = zipFileName;
+    zipData[Protocol::Fields::STREAM_ID] = qint64(streamId);
     sendResponse(Protocol::Responses::DOWNLOAD_ZIPPING, zipData);
 
-    // Remove any existing zip file
-    QFile::remove(zipPath);
-
-    int compressionLevel = Config::instance().getCompressionLevel();
-
-    // Connect to completion signal (use single-shot connection)
-    connect(m_fileManager, &FileManager::zipCreationComplete, this,
-            [this, zipFileName](bool success, const QString &zipPath) {
-                if (!success) {
-                    sendError("Failed to create zip file");
-                    QFile::remove(zipPath);
-                    return;
-                }
+    // Entries are named relative to the parent so the archive contains the folder itself
+    startArchiveDownload(streamId, zipFileName, *format, QStringList() << absPath, fileInfo.absolutePath());
+}
 
-                // Check if zip file was created
-                QFileInfo zipInfo(zipPath);
-                if (!zipInfo.exists()) {
-                    sendError("Zip file was not created");
-                    return;
-                }
+void ClientConnection::startArchiveDownload(quint32 streamId, const QString &zipFileName, ArchiveFormat format,
+                                            const QStringList &absPaths, const QString &baseDir)
+{
+    auto pipe = std::make_shared<ArchivePipe>();
+    pipe->setReadyCallback([this]() {
+        QMetaObject::invokeMethod(this, [this]() { pumpDownloads(); }, Qt::QueuedConnection);
+    });
 
-                // Clean up any existing download
-                cleanupDownload();
-
-                // Open the zip file for download
-                m_downloadFile = new QFile(zipPath);
-                if (!m_downloadFile->open(QIODevice::ReadOnly)) {
-                    sendError("Failed to open zip file");
-                    delete m_downloadFile;
-                    m_downloadFile = nullptr;
-                    QFile::remove(zipPath);
-                    return;
-                }
+    // The archive is written straight into the pipe, which holds the producer back
+    // whenever the client is slower than the compression
+    int compressionLevel = Config::instance().getCompressionLevel();
+    quint64 jobId = ArchiveJobManager::instance().submit(pipe, absPaths, baseDir, format, compressionLevel,
+                                                         [this, streamId](const ArchiveProgress &progress) {
+        QMetaObject::invokeMethod(this, [this, streamId, progress]() {
+            sendArchiveProgress(streamId, progress);
+        }, Qt::QueuedConnection);
+    });
+
+    DownloadStream download;
+    download.path = zipFileName;
+    download.pipe = pipe;
+    download.archiveJobId = jobId;
+    download.announced = false;
+    download.totalSize = -1;
+    download.requestId = m_currentRequestId;
+    m_downloads.insert(streamId, download);
+}
 
-                // Set download state
-                m_downloadPath = zipPath;
-                m_downloadTotalSize = zipInfo.size();
-                m_downloadSentSize = 0;
-                m_isZipDownload = true;
-
-                // Send download start metadata
-                QJsonObject metadata;
-                metadata["name"] = zipFileName;
-                metadata["size"] = m_downloadTotalSize;
-                sendResponse(Protocol::Responses::DOWNLOAD_START, metadata);
-
-                // Start sending chunks
-                for (int i = 0; i < 3 && m_downloadSentSize < m_downloadTotalSize; ++i) {
-                    sendNextDownloadChunk();
-                }
-            }, Qt::SingleShotConnection);
+void ClientConnection::sendArchiveProgress(quint32 streamId, const ArchiveProgress &progress)
+{
+    auto it = m_downloads.find(streamId);
+    if (it == m_downloads.end() || it->archiveJobId != progress.jobId) {
+        return;
+    }
 
-    // Start async compression
-    m_fileManager->createZipFromDirectoryAsync(path, zipPath, compressionLevel);
+    QJsonObject data;
+    data["status"] = "zipping";
+    data["name"] = it->path;
+    data[Protocol::Fields::STREAM_ID] = qint64(streamId);
+    data["filesDone"] = progress.filesDone;
+    data["totalFiles"] = progress.totalFiles;
+    data["bytesDone"] = progress.bytesDone;
+    data["totalBytes"] = progress.totalBytes;
+    sendResponse(Protocol::Responses::DOWNLOAD_ZIPPING, data);
 }
 
 void ClientConnection::handleCancelDownload(const QJsonObject &params)
 {
-    Q_UNUSED(params)
-
-    // Clean up download state
-    cleanupDownload();
+    QJsonObject data;
 
-    // Clean up temp zip file if it exists
-    if (m_isZipDownload && !m_downloadPath.isEmpty()) {
-        QFile::remove(m_downloadPath);
+    if (params.contains(Protocol::Fields::STREAM_ID)) {
+        quint32 streamId = params[Protocol::Fields::STREAM_ID].toInteger();
+        closeDownload(streamId);
+        data[Protocol::Fields::STREAM_ID] = qint64(streamId);
+    } else {
+        // Without a stream id every download of the connection is cancelled
+        const QList<quint32> downloads = m_downloads.keys();
+        for (quint32 streamId : downloads) {
+            closeDownload(streamId);
+        }
     }
 
-    m_downloadPath.clear();
-    m_isZipDownload = false;
-
-    QJsonObject data;
     data["success"] = true;
     sendResponse(Protocol::Responses::DOWNLOAD_CANCELLED, data);
 }
@@ -472,50 +685,57 @@ void ClientConnection::handleDeleteMultiple(const QJsonObject &params)
         return;
     }
 
-    QStringList deletedFiles;
-    QStringList deletedDirs;
-    QStringList failed;
+    QString rootPath = m_fileManager->rootPath();
+    HttpServer *httpServer = m_httpServer;
 
-    for (int i = 0; i < pathsArray.size(); ++i) {
-        QString path = pathsArray[i].toString();
+    runAsync([rootPath, httpServer, pathsArray]() -> CommandReply {
+        FileManager fileManager(rootPath);
+        QStringList deletedFiles;
+        QStringList deletedDirs;
+        QStringList failed;
 
-        if (!m_fileManager->isValidPath(path)) {
-            failed.append(path);
-            continue;
-        }
+        for (int i = 0; i < pathsArray.size(); ++i) {
+            QString path = pathsArray[i].toString();
 
-        QString absPath = m_fileManager->getAbsolutePath(path);
-        QFileInfo info(absPath);
+            if (!fileManager.isValidPath(path)) {
+                failed.append(path);
+                continue;
+            }
 
-        if (!info.exists()) {
-            failed.append(path);
-            continue;
-        }
+            QString absPath = fileManager.getAbsolutePath(path);
+            QFileInfo info(absPath);
 
-        if (info.isDir()) {
-            if (m_fileManager->deleteDirectory(path)) {
-                deletedDirs.append(path);
-            } else {
+            if (!info.exists()) {
                 failed.append(path);
+                continue;
             }
-        } else {
-            if (m_fileManager->deleteFile(path)) {
-                deletedFiles.append(path);
-                // Remove share link if the file was shared
-                m_httpServer->removeShareLink(absPath);
+
+            if (info.isDir()) {
+                if (fileManager.deleteDirectory(path)) {
+                    deletedDirs.append(path);
+                    httpServer->removeShareLinksInDirectory(absPath);
+                } else {
+                    failed.append(path);
+                }
             } else {
-                failed.append(path);
+                if (fileManager.deleteFile(path)) {
+                    deletedFiles.append(path);
+                    // Remove share link if the file was shared
+                    httpServer->removeShareLink(absPath);
+                } else {
+                    failed.append(path);
+                }
             }
         }
-    }
 
-    QJsonObject data;
-    data["deletedFiles"] = QJsonArray::fromStringList(deletedFiles);
-    data["deletedDirs"] = QJsonArray::fromStringList(deletedDirs);
-    data["failed"] = QJsonArray::fromStringList(failed);
-    data["success"] = failed.isEmpty();
+        QJsonObject data;
+        data["deletedFiles"] = QJsonArray::fromStringList(deletedFiles);
+        data["deletedDirs"] = QJsonArray::fromStringList(deletedDirs);
+        data["failed"] = QJsonArray::fromStringList(failed);
+        data["success"] = failed.isEmpty();
 
-    sendResponse(Protocol::Responses::DELETE_MULTIPLE, data);
+        return { Protocol::Responses::DELETE_MULTIPLE, data };
+    });
 }
 
 void ClientConnection::handleGetThumbnail(const QJsonObject &params)
@@ -529,26 +749,29 @@ void ClientConnection::handleGetThumbnail(const QJsonObject &params)
     }
 
     QString absPath = m_fileManager->getAbsolutePath(path);
-    QImage image(absPath);
 
-    if (image.isNull()) {
-        return;
-    }
+    runAsync([path, absPath, maxSize]() -> CommandReply {
+        QImage image(absPath);
 
-    if (image.width() > maxSize || image.height() > maxSize) {
-        image = image.scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-    }
+        if (image.isNull()) {
+            return {};
+        }
 
-    QByteArray imageData;
-    QBuffer buffer(&imageData);
-    buffer.open(QIODevice::WriteOnly);
-    image.save(&buffer, "JPEG", 85);
+        if (image.width() > maxSize || image.height() > maxSize) {
+            image = image.scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        }
 
-    QJsonObject data;
-    data["path"] = path;
-    data["data"] = QString::fromUtf8(imageData.toBase64());
+        QByteArray imageData;
+        QBuffer buffer(&imageData);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "JPEG", 85);
+
+        QJsonObject data;
+        data["path"] = path;
+        data["data"] = QString::fromUtf8(imageData.toBase64());
 
-    sendResponse(Protocol::Responses::THUMBNAIL_DATA, data);
+        return { Protocol::Responses::THUMBNAIL_DATA, data };
+    });
 }
 
 void ClientConnection::handleGetServerInfo()
@@ -560,50 +783,143 @@ void ClientConnection::handleGetServerInfo()
     sendResponse(Protocol::Responses::SERVER_INFO, data);
 }
 
-void ClientConnection::handleCancelUpload(const QJsonObject &params)
+void ClientConnection::handleGetTransferStats()
 {
-    Q_UNUSED(params)
-
-    if (m_uploadFile) {
-        QString absPath = m_uploadFile->fileName();
-        m_uploadFile->close();
-        delete m_uploadFile;
-        m_uploadFile = nullptr;
-
-        QFile::remove(absPath);
+    QJsonObject data = m_pacer.stats();
+    data["bytesToWrite"] = m_socket->bytesToWrite();
+    data["uploads"] = m_uploads.size();
+    data["downloads"] = m_downloads.size();
+    sendResponse(Protocol::Responses::TRANSFER_STATS, data);
+}
 
-        m_uploadPath.clear();
-        m_uploadExpectedSize = 0;
-        m_uploadReceivedSize = 0;
+void ClientConnection::handleCancelUpload(const QJsonObject &params)
+{
+    QJsonObject data;
 
-        QJsonObject data;
-        data["success"] = true;
-        sendResponse(Protocol::Responses::UPLOAD_CANCELLED, data);
+    if (params.contains(Protocol::Fields::STREAM_ID)) {
+        quint32 streamId = params[Protocol::Fields::STREAM_ID].toInteger();
+        if (!m_uploads.contains(streamId)) {
+            return;
+        }
+        closeUpload(streamId, true);
+        data[Protocol::Fields::STREAM_ID] = qint64(streamId);
+    } else {
+        if (m_uploads.isEmpty()) {
+            return;
+        }
+        // Without a stream id every upload of the connection is cancelled
+        const QList<quint32> uploads = m_uploads.keys();
+        for (quint32 streamId : uploads) {
+            closeUpload(streamId, true);
+        }
     }
+
+    data["success"] = true;
+    sendResponse(Protocol::Responses::UPLOAD_CANCELLED, data);
 }
 
 void ClientConnection::sendResponse(const QString &type, const QJsonObject &data)
+{
+    sendResponse(type, data, m_currentRequestId);
+}
+
+void ClientConnection::sendResponse(const QString &type, const QJsonObject &data, const QJsonValue &requestId)
 {
     QJsonObject response;
     response["type"] = type;
     response["data"] = data;
 
+    if (!requestId.isUndefined() && !requestId.isNull()) {
+        response[Protocol::Fields::REQUEST_ID] = requestId;
+    }
+
+    if (m_cborEncoding) {
+        QByteArray frame(1, Protocol::Frames::CONTROL);
+        frame.append(QCborValue::fromJsonValue(response).toCbor());
+        m_socket->sendBinaryMessage(frame);
+        return;
+    }
+
     QJsonDocument doc(response);
     m_socket->sendTextMessage(QString::fromUtf8(doc.toJson(QJsonDocument::Compact)));
 }
 
+void ClientConnection::sendChange(const QJsonObject &change)
+{
+    sendResponse(Protocol::Responses::CHANGE, change, QJsonValue());
+}
+
 void ClientConnection::sendError(const QString &message)
+{
+    sendError(message, m_currentRequestId);
+}
+
+void ClientConnection::sendError(const QString &message, const QJsonValue &requestId)
+{
+    QJsonObject error;
+    error["error"] = message;
+    sendResponse(Protocol::Responses::ERROR, error, requestId);
+}
+
+ClientConnection::CommandReply ClientConnection::errorReply(const QString &message)
 {
     QJsonObject error;
     error["error"] = message;
-    sendResponse(Protocol::Responses::ERROR, error);
+    return { Protocol::Responses::ERROR, error };
+}
+
+void ClientConnection::runAsync(const std::function<CommandReply()> &job)
+{
+    // The reply is delivered back on this connection's thread, or dropped
+    // if the connection is gone by the time the job finishes
+    QJsonValue requestId = m_currentRequestId;
+    auto promise = std::make_shared<QPromise<CommandReply>>();
+
+    promise->future().then(this, [this, requestId](const CommandReply &reply) {
+        if (!reply.type.isEmpty()) {
+            sendResponse(reply.type, reply.data, requestId);
+        }
+    });
+
+    promise->start();
+    commandPool()->start([promise, job]() {
+        promise->addResult(job());
+        promise->finish();
+    });
+}
+
+void ClientConnection::runAsyncStream(const std::function<void(const ReplySink&)> &job)
+{
+    // The watcher belongs to the connection, replies still coming once it is gone are dropped
+    QJsonValue requestId = m_currentRequestId;
+    auto promise = std::make_shared<QPromise<CommandReply>>();
+    auto *watcher = new QFutureWatcher<CommandReply>(this);
+
+    connect(watcher, &QFutureWatcherBase::resultsReadyAt, this, [this, watcher, requestId](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            CommandReply reply = watcher->resultAt(i);
+            if (!reply.type.isEmpty()) {
+                sendResponse(reply.type, reply.data, requestId);
+            }
+        }
+    });
+    connect(watcher, &QFutureWatcherBase::finished, watcher, &QObject::deleteLater);
+
+    watcher->setFuture(promise->future());
+    promise->start();
+    commandPool()->start([promise, job]() {
+        job([&promise](const CommandReply &reply) {
+            promise->addResult(reply);
+        });
+        promise->finish();
+    });
 }
 
 ClientConnection::AuthResult ClientConnection::authenticate(const QString &username, const QString &password, const QString &clientVersion, QString &errorMessage)
 {
     QString clientIP = m_socket->peerAddress().toString();
 
-    User* user = Config::instance().getUser(username);
+    std::optional<User> user = Config::instance().getUser(username);
     if (!user) {
         Config::instance().recordFailedAttempt(clientIP);
         errorMessage = "Invalid username or password";
@@ -640,6 +956,7 @@ ClientConnection::AuthResult ClientConnection::authenticate(const QString &usern
     m_fileManager = new FileManager(user->storagePath);
     m_currentUsername = username;
     m_authenticated = true;
+    ChangeNotifier::instance().attach(this, m_fileManager->rootPath());
     Config::instance().clearFailedAttempts(clientIP);
 
     return AuthResult::Success;
@@ -648,30 +965,57 @@ ClientConnection::AuthResult ClientConnection::authenticate(const QString &usern
 void ClientConnection::handleListDirectory(const QJsonObject &params)
 {
     QString path = params["path"].toString();
-    bool foldersFirst = params["foldersFirst"].toBool();
-    QJsonArray files = m_fileManager->listDirectory(path, foldersFirst);
 
-    for (int i = 0; i < files.size(); ++i) {
-        QJsonObject fileObj = files[i].toObject();
-
-        if (!fileObj["isDir"].toBool()) {
-            QString fileName = fileObj["name"].toString().toLower();
-            if (fileName.endsWith(".jpg") || fileName.endsWith(".jpeg") ||
-                fileName.endsWith(".png") || fileName.endsWith(".gif") ||
-                fileName.endsWith(".bmp") || fileName.endsWith(".webp")) {
+    std::optional<FileManager::SortKey> sortBy = FileManager::parseSortKey(params["sortBy"].toString());
+    if (!sortBy) {
+        sendError("Unsupported sort key");
+        return;
+    }
 
-                QString previewUrl = "preview://" + fileObj["path"].toString();
-                fileObj["previewUrl"] = previewUrl;
-                files[i] = fileObj;
-            }
+    FileManager::ListOptions options;
+    options.sortBy = *sortBy;
+    options.descending = params["descending"].toBool();
+    options.foldersFirst = params["foldersFirst"].toBool();
+    options.cursor = params["cursor"].toString();
+    options.limit = qMax(0, params["limit"].toInt());
+    options.stream = params["stream"].toBool();
+    QString knownVersion = params["version"].toString();
+
+    QString rootPath = m_fileManager->rootPath();
+    ChangeNotifier::instance().setListedFolder(this, path);
+
+    runAsyncStream([rootPath, path, options, knownVersion](const ReplySink &reply) {
+        FileManager fileManager(rootPath);
+
+        // Taken before listing, a change made meanwhile then shows up as a newer version next time
+        QString version = fileManager.directoryVersion(path);
+        if (!version.isEmpty() && version == knownVersion && options.cursor.isEmpty()) {
+            QJsonObject data;
+            data["path"] = path;
+            data["version"] = version;
+            reply({ Protocol::Responses::NOT_MODIFIED, data });
+            return;
         }
-    }
 
-    QJsonObject data;
-    data["path"] = path;
-    data["files"] = files;
+        bool valid = fileManager.listDirectory(path, options, [&reply, &path, &version](const FileManager::ListBatch &batch) {
+            QJsonArray files = batch.files;
+            addPreviewUrls(files);
+
+            QJsonObject data;
+            data["path"] = path;
+            data["files"] = files;
+            data["offset"] = batch.offset;
+            data["total"] = batch.total;
+            data["nextCursor"] = batch.nextCursor;
+            data["version"] = version;
 
-    sendResponse(Protocol::Responses::LIST_DIRECTORY, data);
+            reply({ Protocol::Responses::LIST_DIRECTORY, data });
+        });
+
+        if (!valid) {
+            reply(errorReply("Invalid cursor"));
+        }
+    });
 }
 
 void ClientConnection::handleCreateDirectory(const QJsonObject &params)
@@ -709,24 +1053,36 @@ void ClientConnection::handleDeleteFile(const QJsonObject &params)
 void ClientConnection::handleDeleteDirectory(const QJsonObject &params)
 {
     QString path = params["path"].toString();
-    QString absPath = m_fileManager->getAbsolutePath(path);
+    QString rootPath = m_fileManager->rootPath();
+    HttpServer *httpServer = m_httpServer;
+
+    runAsync([rootPath, httpServer, path]() -> CommandReply {
+        FileManager fileManager(rootPath);
+        QString absPath = fileManager.getAbsolutePath(path);
+
+        if (!fileManager.deleteDirectory(path)) {
+            return errorReply("Failed to delete directory");
+        }
 
-    if (m_fileManager->deleteDirectory(path)) {
         // Remove share links for all files in the deleted directory
-        m_httpServer->removeShareLinksInDirectory(absPath);
+        httpServer->removeShareLinksInDirectory(absPath);
 
         QJsonObject data;
         data["path"] = path;
         data["success"] = true;
-        sendResponse(Protocol::Responses::DELETE_DIRECTORY, data);
-    } else {
-        sendError("Failed to delete directory");
-    }
+        return { Protocol::Responses::DELETE_DIRECTORY, data };
+    });
 }
 
 void ClientConnection::handleDownloadFile(const QJsonObject &params)
 {
     QString path = params["path"].toString();
+    quint32 streamId = params[Protocol::Fields::STREAM_ID].toInteger();
+
+    if (isDownloadStreamBusy(streamId)) {
+        sendError("Download stream already in use");
+        return;
+    }
 
     if (!m_fileManager->isValidPath(path)) {
         sendError("Invalid file path");
@@ -741,81 +1097,155 @@ void ClientConnection::handleDownloadFile(const QJsonObject &params)
         return;
     }
 
-    cleanupDownload();
-
-    m_downloadFile = new QFile(absPath);
-    if (!m_downloadFile->open(QIODevice::ReadOnly)) {
+    DownloadSource *source = new DownloadSource(absPath);
+    if (!source->open(*m_fileManager, path)) {
         sendError("Failed to open file");
-        delete m_downloadFile;
-        m_downloadFile = nullptr;
+        delete source;
         return;
     }
 
-    m_downloadPath = path;
-    m_downloadTotalSize = fileInfo.size();
-    m_downloadSentSize = 0;
-    m_isZipDownload = false;
+    qint64 modified = fileInfo.lastModified().toMSecsSinceEpoch();
+    qint64 offset = params["offset"].toInteger(0);
+    qint64 length = params["length"].toInteger(-1);
 
+    // Like an HTTP If-Range, a resume against a file that changed since gets the whole file
+    if (params.contains("modified") && params["modified"].toInteger() != modified) {
+        offset = 0;
+        length = -1;
+    }
+
+    if (offset < 0 || offset > source->size() || !source->seek(offset)) {
+        sendError("Invalid download range");
+        delete source;
+        return;
+    }
+
+    qint64 remaining = source->size() - offset;
+    if (length < 0 || length > remaining) {
+        length = remaining;
+    }
+
+    DownloadStream download;
+    download.path = path;
+    download.source = source;
+    download.totalSize = length;
+    download.requestId = m_currentRequestId;
+    m_downloads.insert(streamId, download);
+
+    // size is what this stream carries, fileSize the whole file
     QJsonObject metadata;
     metadata["path"] = path;
     metadata["name"] = fileInfo.fileName();
-    metadata["size"] = m_downloadTotalSize;
+    metadata["size"] = download.totalSize;
+    metadata["offset"] = offset;
+    metadata["fileSize"] = source->size();
+    metadata["modified"] = modified;
     metadata["isDirectory"] = false;
+    metadata[Protocol::Fields::STREAM_ID] = qint64(streamId);
     sendResponse(Protocol::Responses::DOWNLOAD_START, metadata);
 
-    for (int i = 0; i < 3 && m_downloadSentSize < m_downloadTotalSize; ++i) {
-        sendNextDownloadChunk();
-    }
+    pumpDownloads();
 }
 
-void ClientConnection::sendNextDownloadChunk()
+bool ClientConnection::isDownloadStreamBusy(quint32 streamId) const
 {
-    if (!m_downloadFile || !m_downloadFile->isOpen()) {
-        return;
-    }
+    return m_downloads.contains(streamId) || m_downloads.size() >= MAX_STREAMS;
+}
 
-    if (m_downloadSentSize >= m_downloadTotalSize) {
-        cleanupDownload();
+void ClientConnection::pumpDownloads()
+{
+    // Streams take turns so one large download does not starve the others. Archives
+    // with nothing buffered yet are skipped, their producer wakes us up again
+    int idleStreams = 0;
+    while (!m_downloads.isEmpty() && idleStreams < m_downloads.size() && m_pacer.canSend(m_socket->bytesToWrite())) {
+        auto it = m_downloads.upperBound(m_lastDownloadStream);
+        if (it == m_downloads.end()) {
+            it = m_downloads.begin();
+        }
 
-        QJsonObject data;
-        data["path"] = m_downloadPath;
-        data["success"] = true;
-        sendResponse(Protocol::Responses::DOWNLOAD_COMPLETE, data);
+        quint32 streamId = it.key();
+        DownloadStream &download = it.value();
+        m_lastDownloadStream = streamId;
+
+        if (download.pipe && !download.announced) {
+            if (!download.pipe->isStarted()) {
+                ++idleStreams;
+                continue;
+            }
 
-        if (m_isZipDownload) {
-            QFile::remove(m_downloadPath);
+            download.announced = true;
+            download.totalSize = download.pipe->totalSize();
+
+            QJsonObject metadata;
+            metadata["name"] = download.path;
+            metadata["size"] = download.totalSize;
+            metadata[Protocol::Fields::STREAM_ID] = qint64(streamId);
+            sendResponse(Protocol::Responses::DOWNLOAD_START, metadata, download.requestId);
         }
 
-        m_downloadPath.clear();
-        m_isZipDownload = false;
-        return;
-    }
+        bool finished = download.pipe ? download.pipe->atEnd() : download.sentSize >= download.totalSize;
+        if (finished) {
+            QJsonValue requestId = download.requestId;
 
-    if (m_socket->bytesToWrite() >= CHUNK_SIZE * 2) {
-        return;
-    }
+            if (download.pipe && !download.pipe->succeeded()) {
+                QString error = download.pipe->errorString();
+                closeDownload(streamId);
+                sendError("Failed to create archive: " + error, requestId);
+                continue;
+            }
 
-    QByteArray chunk = m_downloadFile->read(CHUNK_SIZE);
-    if (chunk.isEmpty() && m_downloadSentSize < m_downloadTotalSize) {
-        sendError("Failed to read file chunk");
-        cleanupDownload();
-        return;
-    }
+            QJsonObject data;
+            data["path"] = download.path;
+            data["success"] = true;
+            data[Protocol::Fields::STREAM_ID] = qint64(streamId);
+
+            closeDownload(streamId);
+            sendResponse(Protocol::Responses::DOWNLOAD_COMPLETE, data, requestId);
+            idleStreams = 0;
+            continue;
+        }
+
+        // The socket copies the frame into its own buffer, so one buffer is reused
+        // for every chunk instead of allocating a new one each time
+        qint64 length = m_pacer.chunkSize();
+        if (!download.pipe) {
+            length = qMin(length, download.totalSize - download.sentSize);
+        }
+        m_frameBuffer.resize(Protocol::Frames::DATA_HEADER_SIZE + length);
+        Protocol::Frames::writeDataHeader(m_frameBuffer.data(), streamId);
+
+        char *payload = m_frameBuffer.data() + Protocol::Frames::DATA_HEADER_SIZE;
+        qint64 read = download.pipe ? download.pipe->read(payload, length) : download.source->read(payload, length);
+        if (read == 0 && download.pipe) {
+            ++idleStreams;
+            continue;
+        }
+
+        if (read <= 0) {
+            QJsonValue requestId = download.requestId;
+            closeDownload(streamId);
+            sendError("Failed to read file chunk", requestId);
+            continue;
+        }
 
-    m_socket->sendBinaryMessage(chunk);
-    m_downloadSentSize += chunk.size();
+        idleStreams = 0;
+        m_frameBuffer.resize(Protocol::Frames::DATA_HEADER_SIZE + read);
+        download.sentSize += read;
+        m_socket->sendBinaryMessage(m_frameBuffer);
+    }
 }
 
-void ClientConnection::cleanupDownload()
+void ClientConnection::closeDownload(quint32 streamId)
 {
-    if (m_downloadFile) {
-        m_downloadFile->close();
-        delete m_downloadFile;
-        m_downloadFile = nullptr;
+    DownloadStream download = m_downloads.take(streamId);
+
+    // Stops the producer right away, or drops the job if it is still queued
+    if (download.pipe) {
+        ArchiveJobManager::instance().cancel(download.archiveJobId);
+        download.pipe->cancel();
     }
 
-    m_downloadTotalSize = 0;
-    m_downloadSentSize = 0;
+    delete download.source;
 }
 
 void ClientConnection::handleUploadFile(const QJsonObject &params)
@@ -823,16 +1253,15 @@ void ClientConnection::handleUploadFile(const QJsonObject &params)
     QString path = params["path"].toString();
     qint64 size = params["size"].toVariant().toLongLong();
 
-    User* user = Config::instance().getUser(m_currentUsername);
-    if (!user) {
-        sendError("User not found");
+    // Before anything is reserved or created, a rejected stream must leave nothing behind
+    quint32 streamId = params[Protocol::Fields::STREAM_ID].toInteger();
+    if (isUploadStreamBusy(streamId)) {
         return;
     }
 
-    qint64 available = m_fileManager->getAvailableSpace(user->storageLimit);
-
-    if (size > available) {
-        sendError("Insufficient storage space");
+    std::optional<User> user = Config::instance().getUser(m_currentUsername);
+    if (!user) {
+        sendError("User not found");
         return;
     }
 
@@ -844,49 +1273,165 @@ void ClientConnection::handleUploadFile(const QJsonObject &params)
     QString absPath = m_fileManager->getAbsolutePath(path);
     QFileInfo fileInfo(absPath);
 
-    QDir().mkpath(fileInfo.absolutePath());
+    // Taken from the usage counter rather than a walk of the storage. The space stays
+    // reserved until the upload ends, so concurrent uploads cannot share the same bytes.
+    // A file being replaced only needs what it grows by
+    qint64 replaced = fileInfo.isFile() ? fileInfo.size() : 0;
+    std::shared_ptr<MetadataIndex::Reservation> reservation =
+        m_fileManager->index()->reserve(qMax<qint64>(0, size - replaced), user->storageLimit);
+    if (!reservation) {
+        sendError("Insufficient storage space");
+        return;
+    }
+
+    m_fileManager->makePath(path.section('/', 0, -2, QString::SectionSkipEmpty));
 
-    if (m_uploadFile) {
-        m_uploadFile->close();
-        delete m_uploadFile;
-        m_uploadFile = nullptr;
+    QJsonObject data;
+    data["path"] = path;
+    data[Protocol::Fields::STREAM_ID] = qint64(streamId);
+
+    UploadSession session = UploadSessionManager::instance().create(m_currentUsername, path, absPath, size, reservation);
+
+    QFile *file = new QFile(session.partPath);
+    if (!file->open(QIODevice::WriteOnly)) {
+        sendError("Failed to open file for writing");
+        delete file;
+        UploadSessionManager::instance().discard(session.id);
+        return;
     }
 
-    m_uploadFile = new QFile(absPath);
-    if (!m_uploadFile->open(QIODevice::WriteOnly)) {
+    // Allocating everything up front keeps large files contiguous and fails a full disk now rather than at 90%
+    if (!preallocate(file, 0, size)) {
+        sendError("Insufficient disk space");
+        delete file;
+        UploadSessionManager::instance().discard(session.id);
+        return;
+    }
+
+    UploadStream upload;
+    upload.path = path;
+    upload.sessionId = session.id;
+    upload.targetPath = absPath;
+    upload.writerId = m_diskWriter->addFile(file);
+    upload.expectedSize = size;
+    upload.requestId = m_currentRequestId;
+    m_uploads.insert(streamId, upload);
+
+    if (size <= 0) {
+        // No data frame will follow, the empty part file is committed like any other
+        completeUpload(streamId);
+        return;
+    }
+
+    data["ready"] = true;
+    data[Protocol::Fields::UPLOAD_ID] = session.id;
+    data["offset"] = 0;
+    data["window"] = WRITE_WINDOW;
+    sendResponse(Protocol::Responses::UPLOAD_READY, data);
+}
+
+void ClientConnection::handleResumeUpload(const QJsonObject &params)
+{
+    QString uploadId = params[Protocol::Fields::UPLOAD_ID].toString();
+    quint32 streamId = params[Protocol::Fields::STREAM_ID].toInteger();
+
+    if (isUploadStreamBusy(streamId)) {
+        return;
+    }
+
+    std::optional<UploadSession> session = UploadSessionManager::instance().attach(uploadId, m_currentUsername);
+    if (!session) {
+        sendError("Upload session not found");
+        return;
+    }
+
+    QFile *file = new QFile(session->partPath);
+    if (!file->open(QIODevice::WriteOnly | QIODevice::Append)) {
         sendError("Failed to open file for writing");
-        delete m_uploadFile;
-        m_uploadFile = nullptr;
+        delete file;
+        UploadSessionManager::instance().discard(session->id);
+        return;
+    }
+
+    // Whatever reached the part file before the connection dropped is kept
+    qint64 offset = file->size();
+    if (offset > session->size) {
+        sendError("Upload session is corrupted");
+        delete file;
+        UploadSessionManager::instance().discard(session->id);
+        return;
+    }
+
+    if (!preallocate(file, offset, session->size - offset)) {
+        sendError("Insufficient disk space");
+        delete file;
+        UploadSessionManager::instance().discard(session->id);
         return;
     }
 
-    m_uploadPath = path;
-    m_uploadExpectedSize = size;
-    m_uploadReceivedSize = 0;
+    UploadStream upload;
+    upload.path = session->path;
+    upload.sessionId = session->id;
+    upload.targetPath = session->targetPath;
+    upload.writerId = m_diskWriter->addFile(file);
+    upload.expectedSize = session->size;
+    upload.receivedSize = offset;
+    upload.writtenSize = offset;
+    upload.requestId = m_currentRequestId;
+    m_uploads.insert(streamId, upload);
+
+    if (offset == session->size) {
+        completeUpload(streamId);
+        return;
+    }
 
     QJsonObject data;
+    data["path"] = session->path;
     data["ready"] = true;
+    data[Protocol::Fields::STREAM_ID] = qint64(streamId);
+    data[Protocol::Fields::UPLOAD_ID] = session->id;
+    data["offset"] = offset;
+    data["window"] = WRITE_WINDOW;
     sendResponse(Protocol::Responses::UPLOAD_READY, data);
 }
 
+bool ClientConnection::isUploadStreamBusy(quint32 streamId)
+{
+    if (m_uploads.contains(streamId)) {
+        sendError("Upload stream already in use");
+        return true;
+    }
+
+    if (m_uploads.size() >= MAX_STREAMS) {
+        sendError("Too many concurrent uploads");
+        return true;
+    }
+
+    return false;
+}
+
 void ClientConnection::handleGetStorageInfo()
 {
-    User* user = Config::instance().getUser(m_currentUsername);
+    std::optional<User> user = Config::instance().getUser(m_currentUsername);
     if (!user) {
         sendError("User not found");
         return;
     }
 
     qint64 total = user->storageLimit;
-    qint64 used = m_fileManager->getTotalSize();
-    qint64 available = total - used;
+    QString rootPath = m_fileManager->rootPath();
 
-    QJsonObject data;
-    data["total"] = total;
-    data["used"] = used;
-    data["available"] = available;
+    runAsync([rootPath, total]() -> CommandReply {
+        qint64 used = FileManager(rootPath).getTotalSize();
+        qint64 available = total - used;
 
-    sendResponse(Protocol::Responses::STORAGE_INFO, data);
+        QJsonObject data;
+        data["total"] = total;
+        data["used"] = used;
+        data["available"] = available;
+
+        return { Protocol::Responses::STORAGE_INFO, data };
+    });
 }
 
 void ClientConnection::handleMoveItem(const QJsonObject &params)
@@ -923,7 +1468,7 @@ void ClientConnection::onAuthDelayTimeout()
     if (!m_pendingAuthUsername.isEmpty()) {
         qWarning() << "Delayed failed auth for user:" << m_pendingAuthUsername;
 
-        sendError(m_pendingAuthErrorMessage);
+        sendError(m_pendingAuthErrorMessage, m_pendingAuthRequestId);
 
         m_pendingAuthUsername.clear();
         m_pendingAuthPassword.clear();
@@ -939,7 +1484,7 @@ void ClientConnection::handleCreateUser(const QJsonObject &params)
         return;
     }
 
-    User* currentUser = Config::instance().getUser(m_currentUsername);
+    std::optional<User> currentUser = Config::instance().getUser(m_currentUsername);
     if (!currentUser || !currentUser->isAdmin) {
         sendError("Admin privileges required");
         return;
@@ -972,7 +1517,7 @@ void ClientConnection::handleEditUser(const QJsonObject &params)
         return;
     }
 
-    User* currentUser = Config::instance().getUser(m_currentUsername);
+    std::optional<User> currentUser = Config::instance().getUser(m_currentUsername);
     if (!currentUser || !currentUser->isAdmin) {
         sendError("Admin privileges required");
         return;
@@ -988,23 +1533,11 @@ void ClientConnection::handleEditUser(const QJsonObject &params)
         return;
     }
 
-    User* user = Config::instance().getUser(username);
-    if (!user) {
+    if (!Config::instance().updateUser(username, password, isAdmin, storageLimit)) {
         sendError("User not found");
         return;
     }
 
-    // Update password if provided
-    if (!password.isEmpty()) {
-        user->salt = Config::generateSalt();
-        user->passwordHash = Config::hashPassword(password, user->salt);
-    }
-
-    user->storageLimit = storageLimit * 1024 * 1024;
-    user->isAdmin = isAdmin;
-
-    Config::instance().saveUsers();
-
     QJsonObject data;
     data["username"] = username;
     data["success"] = true;
@@ -1018,7 +1551,7 @@ void ClientConnection::handleDeleteUser(const QJsonObject &params)
         return;
     }
 
-    User* currentUser = Config::instance().getUser(m_currentUsername);
+    std::optional<User> currentUser = Config::instance().getUser(m_currentUsername);
     if (!currentUser || !currentUser->isAdmin) {
         sendError("Admin privileges required");
         return;
@@ -1055,7 +1588,7 @@ void ClientConnection::handleGetUserList(const QJsonObject &params)
         return;
     }
 
-    User* currentUser = Config::instance().getUser(m_currentUsername);
+    std::optional<User> currentUser = Config::instance().getUser(m_currentUsername);
     if (!currentUser || !currentUser->isAdmin) {
         sendError("Admin privileges required");
         return;
@@ -1138,7 +1671,13 @@ void ClientConnection::sendPing()
     if (!m_authenticated) {
         return;
     }
-    sendResponse(Protocol::Responses::PING, QJsonObject());
+    // The client paces its uploads with the RTT measured here
+    QJsonObject data;
+    data["rtt"] = m_pacer.smoothedRtt();
+    sendResponse(Protocol::Responses::PING, data, QJsonValue());
+
+    m_pingSentTimer.start();
+    m_rttProbePending = true;
     m_waitingForPong = true;
     m_pongTimeoutTimer->start();
 }
@@ -1155,17 +1694,89 @@ void ClientConnection::handleGetFolderTree(const QJsonObject &params)
 {
     QString path = params["path"].toString();
     int maxDepth = params["maxDepth"].toInt(-1);
+    QString rootPath = m_fileManager->rootPath();
 
-    QJsonObject tree = m_fileManager->getFolderTree(path, maxDepth);
+    runAsync([rootPath, path, maxDepth]() -> CommandReply {
+        QJsonObject data;
+        data["tree"] = FileManager(rootPath).getFolderTree(path, maxDepth);
+        return { Protocol::Responses::FOLDER_TREE, data };
+    });
+}
 
-    QJsonObject data;
-    data["tree"] = tree;
-    sendResponse(Protocol::Responses::FOLDER_TREE, data);
+void ClientConnection::handleGetChildren(const QJsonObject &params)
+{
+    QString path = params["path"].toString();
+    QString rootPath = m_fileManager->rootPath();
+    ChangeNotifier::instance().addTreeFolder(this, path);
+
+    runAsync([rootPath, path]() -> CommandReply {
+        FileManager fileManager(rootPath);
+
+        // A folder removed since the client last saw it simply has no children
+        QJsonObject data;
+        data["path"] = path;
+        data["name"] = fileManager.folderName(path);
+        data["children"] = fileManager.getChildren(path);
+        return { Protocol::Responses::CHILDREN, data };
+    });
+}
+
+void ClientConnection::handleReleaseChildren(const QJsonObject &params)
+{
+    ChangeNotifier::instance().removeTreeFolder(this, params["path"].toString());
+}
+
+void ClientConnection::handleSearch(const QJsonObject &params)
+{
+    QString query = params["query"].toString().trimmed();
+    QString path = params["path"].toString();
+    QString cursor = params["cursor"].toString();
+    int limit = params["limit"].toInt(SEARCH_PAGE_SIZE);
+    limit = qBound(1, limit, MAX_SEARCH_PAGE_SIZE);
+
+    if (query.isEmpty()) {
+        sendError("Empty search");
+        return;
+    }
+    if (!m_fileManager->isValidPath(path)) {
+        sendError("Invalid path");
+        return;
+    }
+
+    QString rootPath = m_fileManager->rootPath();
+    runAsync([rootPath, query, path, cursor, limit]() -> CommandReply {
+        FileManager fileManager(rootPath);
+
+        // Walking the whole tree instead would take as long as the first scan does
+        if (!fileManager.index()->isReady()) {
+            return errorReply("Search is not available until the storage is indexed");
+        }
+
+        std::optional<FileManager::SearchPage> page = fileManager.search(query, path, cursor, limit);
+        if (!page) {
+            return errorReply(cursor.isEmpty() ? "Folder not found" : "Invalid cursor");
+        }
+
+        QJsonArray files = page->files;
+        addPreviewUrls(files);
+
+        QJsonObject data;
+        data["query"] = query;
+        data["path"] = path;
+        data["files"] = files;
+        data["nextCursor"] = page->nextCursor;
+        return { Protocol::Responses::SEARCH_RESULTS, data };
+    });
 }
 
 void ClientConnection::handlePong(const QJsonObject &params)
 {
     Q_UNUSED(params);
+
+    if (m_rttProbePending) {
+        m_rttProbePending = false;
+        m_pacer.onRttSample(m_pingSentTimer.elapsed());
+    }
 }
 
 void ClientConnection::handleMoveMultiple(const QJsonObject &params)
@@ -10,6 +10,7 @@
 #include <QCryptographicHash>
 #include <QRandomGenerator>
 #include <QPasswordDigestor>
+#include <QThread>
 
 Config::Config()
     : m_settings(QCoreApplication::organizationName(), QCoreApplication::applicationName())
@@ -24,6 +25,8 @@ Config& Config::instance()
 
 void Config::initSettings()
 {
+    QMutexLocker locker(&m_mutex);
+
     if (m_settings.allKeys().isEmpty()) {
         qInfo() << "Creating config file at" << m_settings.fileName();
         m_settings.setValue("server/port", 8888);
@@ -32,6 +35,15 @@ void Config::initSettings()
         m_settings.setValue("server/domain", "");
         m_settings.setValue("server/shortUrl", false);
         m_settings.setValue("server/compressionLevel", 0);
+        m_settings.setValue("server/workerThreads", 0);
+        m_settings.setValue("server/compressionThreads", 0);
+        m_settings.setValue("server/maxArchiveJobs", 2);
+        m_settings.setValue("server/archiveCacheDir", "");
+        m_settings.setValue("server/archiveCacheSize", 2048);
+        m_settings.setValue("server/deflateCacheSize", 4096);
+        m_settings.setValue("server/uploadSessionTimeout", 86400);
+        m_settings.setValue("server/indexDir", "");
+        m_settings.setValue("server/indexReconcileInterval", 3600);
     }
 
     if (!m_settings.contains("server/port")) {
@@ -57,6 +69,42 @@ void Config::initSettings()
     if (!m_settings.contains("server/compressionLevel")) {
         m_settings.setValue("server/compressionLevel", 0);
     }
+
+    if (!m_settings.contains("server/workerThreads")) {
+        m_settings.setValue("server/workerThreads", 0);
+    }
+
+    if (!m_settings.contains("server/compressionThreads")) {
+        m_settings.setValue("server/compressionThreads", 0);
+    }
+
+    if (!m_settings.contains("server/maxArchiveJobs")) {
+        m_settings.setValue("server/maxArchiveJobs", 2);
+    }
+
+    if (!m_settings.contains("server/archiveCacheDir")) {
+        m_settings.setValue("server/archiveCacheDir", "");
+    }
+
+    if (!m_settings.contains("server/archiveCacheSize")) {
+        m_settings.setValue("server/archiveCacheSize", 2048);
+    }
+
+    if (!m_settings.contains("server/deflateCacheSize")) {
+        m_settings.setValue("server/deflateCacheSize", 4096);
+    }
+
+    if (!m_settings.contains("server/uploadSessionTimeout")) {
+        m_settings.setValue("server/uploadSessionTimeout", 86400);
+    }
+
+    if (!m_settings.contains("server/indexDir")) {
+        m_settings.setValue("server/indexDir", "");
+    }
+
+    if (!m_settings.contains("server/indexReconcileInterval")) {
+        m_settings.setValue("server/indexReconcileInterval", 3600);
+    }
 }
 
 QString Config::hashPassword(const QString &password, const QByteArray &salt)
@@ -127,6 +175,8 @@ QString Config::generateUserStoragePath(const QString &username) const
 
 void Config::loadBannedIPs()
 {
+    QMutexLocker locker(&m_mutex);
+
     QString filePath = getBannedIPsFilePath();
     QFile file(filePath);
 
@@ -167,6 +217,8 @@ void Config::loadBannedIPs()
 
 void Config::saveBannedIPs()
 {
+    QMutexLocker locker(&m_mutex);
+
     QString filePath = getBannedIPsFilePath();
     QFile file(filePath);
 
@@ -198,6 +250,8 @@ void Config::saveBannedIPs()
 
 bool Config::isIPBanned(const QString &ip)
 {
+    QMutexLocker locker(&m_mutex);
+
     if (!m_bannedIPs.contains(ip)) {
         return false;
     }
@@ -216,6 +270,8 @@ bool Config::isIPBanned(const QString &ip)
 
 void Config::recordFailedAttempt(const QString &ip)
 {
+    QMutexLocker locker(&m_mutex);
+
     QDateTime now = QDateTime::currentDateTime();
 
     if (!m_bannedIPs.contains(ip)) {
@@ -237,6 +293,8 @@ void Config::recordFailedAttempt(const QString &ip)
 
 void Config::clearFailedAttempts(const QString &ip)
 {
+    QMutexLocker locker(&m_mutex);
+
     if (m_bannedIPs.contains(ip)) {
         m_bannedIPs.remove(ip);
         saveBannedIPs();
@@ -245,6 +303,8 @@ void Config::clearFailedAttempts(const QString &ip)
 
 void Config::loadUsers()
 {
+    QMutexLocker locker(&m_mutex);
+
     QString filePath = getUsersFilePath();
     QFile file(filePath);
 
@@ -322,6 +382,8 @@ void Config::loadUsers()
 
 void Config::saveUsers()
 {
+    QMutexLocker locker(&m_mutex);
+
     QString filePath = getUsersFilePath();
     QFile file(filePath);
 
@@ -349,22 +411,35 @@ void Config::saveUsers()
     file.close();
 }
 
-User* Config::getUser(const QString &username)
+int Config::findUserIndex(const QString &username) const
 {
     QString lowerUsername = username.toLower();
 
-    for (User &user : m_users) {
-        if (user.username.toLower() == lowerUsername) {
-            return &user;
+    for (int i = 0; i < m_users.size(); ++i) {
+        if (m_users[i].username.toLower() == lowerUsername) {
+            return i;
         }
     }
-    return nullptr;
+    return -1;
+}
+
+std::optional<User> Config::getUser(const QString &username) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    int index = findUserIndex(username);
+    if (index < 0) {
+        return std::nullopt;
+    }
+    return m_users[index];
 }
 
 bool Config::createUser(const QString &username, const QString &password, const bool &isAdmin,
                         const qint64 &storageLimit, const QString &storagePath)
 {
-    if (getUser(username)) {
+    QMutexLocker locker(&m_mutex);
+
+    if (findUserIndex(username) >= 0) {
         qWarning() << "User already exists:" << username << "(case-insensitive check)";
         return false;
     }
@@ -389,25 +464,63 @@ bool Config::createUser(const QString &username, const QString &password, const
     return true;
 }
 
+bool Config::updateUser(const QString &username, const QString &password, const bool &isAdmin,
+                        const qint64 &storageLimit)
+{
+    QMutexLocker locker(&m_mutex);
+
+    int index = findUserIndex(username);
+    if (index < 0) {
+        return false;
+    }
+
+    User &user = m_users[index];
+
+    // Update password if provided
+    if (!password.isEmpty()) {
+        user.salt = generateSalt();
+        user.passwordHash = hashPassword(password, user.salt);
+    }
+
+    user.storageLimit = storageLimit * 1024 * 1024;
+    user.isAdmin = isAdmin;
+
+    saveUsers();
+    return true;
+}
+
 bool Config::deleteUser(const QString &username)
 {
-    QString lowerUsername = username.toLower();
+    QMutexLocker locker(&m_mutex);
 
-    for (int i = 0; i < m_users.size(); i++) {
-        if (m_users[i].username.toLower() == lowerUsername) {
-            m_users.removeAt(i);
-            saveUsers();
-            return true;
-        }
+    int index = findUserIndex(username);
+    if (index < 0) {
+        return false;
     }
-    return false;
+
+    m_users.removeAt(index);
+    saveUsers();
+    return true;
 }
 
 QList<User> Config::getUsers() const
 {
+    QMutexLocker locker(&m_mutex);
     return m_users;
 }
 
+QString Config::storageRoot() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_storageRoot;
+}
+
+void Config::setStorageRoot(const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+    m_storageRoot = path;
+}
+
 QString Config::getDefaultLocalNetworkUrl()
 {
     QList<QNetworkInterface> interfaces = QNetworkInterface::allInterfaces();
@@ -432,12 +545,89 @@ QString Config::getDefaultLocalNetworkUrl()
 
 int Config::getCompressionLevel() const
 {
+    QMutexLocker locker(&m_mutex);
     int level = m_settings.value("server/compressionLevel", 0).toInt();
     return qBound(0, level, 9);
 }
 
 void Config::setCompressionLevel(int level)
 {
+    QMutexLocker locker(&m_mutex);
     level = qBound(0, level, 9);
     m_settings.setValue("server/compressionLevel", level);
 }
+
+int Config::getWorkerThreadCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    int count = m_settings.value("server/workerThreads", 0).toInt();
+    if (count <= 0) {
+        count = QThread::idealThreadCount();
+    }
+    return qMax(1, count);
+}
+
+int Config::getCompressionThreadCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    int count = m_settings.value("server/compressionThreads", 0).toInt();
+    if (count <= 0) {
+        count = QThread::idealThreadCount();
+    }
+    return qMax(1, count);
+}
+
+int Config::getMaxArchiveJobs() const
+{
+    QMutexLocker locker(&m_mutex);
+    // Archives beyond this wait in a queue instead of competing for the disks
+    return qMax(1, m_settings.value("server/maxArchiveJobs", 2).toInt());
+}
+
+QString Config::getArchiveCacheDir() const
+{
+    QMutexLocker locker(&m_mutex);
+    QString path = m_settings.value("server/archiveCacheDir", "").toString();
+    if (path.isEmpty()) {
+        path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/archive-cache";
+    }
+    return path;
+}
+
+qint64 Config::getArchiveCacheSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    // Configured in MB, 0 turns the cache off
+    return qMax<qint64>(0, m_settings.value("server/archiveCacheSize", 2048).toLongLong()) * 1024 * 1024;
+}
+
+qint64 Config::getDeflateCacheSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    // Configured in MB, 0 turns the cache off
+    return qMax<qint64>(0, m_settings.value("server/deflateCacheSize", 4096).toLongLong()) * 1024 * 1024;
+}
+
+QString Config::getMetadataIndexDir() const
+{
+    QMutexLocker locker(&m_mutex);
+    QString path = m_settings.value("server/indexDir", "").toString();
+    if (path.isEmpty()) {
+        path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/index";
+    }
+    return path;
+}
+
+int Config::getIndexReconcileInterval() const
+{
+    QMutexLocker locker(&m_mutex);
+    // Seconds between two full scans comparing the metadata index with the disk
+    return qMax(60, m_settings.value("server/indexReconcileInterval", 3600).toInt());
+}
+
+int Config::getUploadSessionTimeout() const
+{
+    QMutexLocker locker(&m_mutex);
+    // Seconds an interrupted upload is kept around waiting for the client to resume it
+    return qMax(60, m_settings.value("server/uploadSessionTimeout", 86400).toInt());
+}
@@ -0,0 +1,217 @@
+#include "deflateblobcache.h"
+#include "config.h"
+#include "zipstreamwriter.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QUuid>
+#include <QtEndian>
+#include <QDebug>
+#include <cstring>
+
+static const char BLOB_MAGIC[4] = { 'O', 'D', 'Z', 'B' };
+
+DeflateBlobCache::BlobWriter::BlobWriter(const QByteArray &key, const QString &tempPath)
+    : m_key(key)
+    , m_file(tempPath)
+    , m_written(0)
+    , m_failed(false)
+{
+    // The header is filled in on commit, once the CRC is known
+    m_failed = !m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+               || m_file.write(QByteArray(HEADER_SIZE, '\0')) != HEADER_SIZE;
+}
+
+DeflateBlobCache::BlobWriter::~BlobWriter()
+{
+    // Still open means it was never committed
+    if (m_file.isOpen()) {
+        m_file.close();
+        m_file.remove();
+    }
+}
+
+void DeflateBlobCache::BlobWriter::append(const QByteArray &data)
+{
+    if (m_failed) {
+        return;
+    }
+
+    if (m_file.write(data) != data.size()) {
+        m_failed = true;
+        return;
+    }
+    m_written += data.size();
+}
+
+void DeflateBlobCache::BlobWriter::commit(quint32 crc, qint64 size)
+{
+    if (m_failed) {
+        return;
+    }
+
+    char header[HEADER_SIZE];
+    std::memcpy(header, BLOB_MAGIC, 4);
+    qToLittleEndian<quint32>(crc, header + 4);
+    qToLittleEndian<qint64>(size, header + 8);
+    qToLittleEndian<qint64>(m_written, header + 16);
+
+    if (!m_file.seek(0) || m_file.write(header, HEADER_SIZE) != HEADER_SIZE || !m_file.flush()) {
+        return;
+    }
+
+    QString tempPath = m_file.fileName();
+    m_file.close();
+
+    if (!DeflateBlobCache::instance().add(m_key, tempPath)) {
+        QFile::remove(tempPath);
+    }
+}
+
+DeflateBlobCache::DeflateBlobCache()
+    : m_directory(Config::instance().getArchiveCacheDir() + "/deflate")
+    , m_budget(Config::instance().getDeflateCacheSize())
+    , m_totalSize(0)
+{
+    load();
+}
+
+DeflateBlobCache& DeflateBlobCache::instance()
+{
+    static DeflateBlobCache instance;
+    return instance;
+}
+
+bool DeflateBlobCache::isEnabled() const
+{
+    return m_budget > 0;
+}
+
+QByteArray DeflateBlobCache::key(const ZipEntry &entry, int compressionLevel)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(entry.filePath.toUtf8());
+    hash.addData(QByteArray(1, '\0') + QByteArray::number(entry.size));
+    hash.addData(QByteArray(1, '\0') + QByteArray::number(entry.modified.toMSecsSinceEpoch()));
+    hash.addData(QByteArray(1, '\0') + QByteArray::number(compressionLevel));
+    return hash.result().toHex();
+}
+
+std::optional<DeflateBlobCache::Blob> DeflateBlobCache::lookup(const ZipEntry &entry, int compressionLevel)
+{
+    QString filePath;
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_blobs.find(key(entry, compressionLevel));
+        if (it == m_blobs.end()) {
+            return std::nullopt;
+        }
+        it->lastUsed = QDateTime::currentMSecsSinceEpoch();
+        filePath = it->filePath;
+    }
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return std::nullopt;
+    }
+
+    QByteArray header = file.read(HEADER_SIZE);
+    if (header.size() != HEADER_SIZE || std::memcmp(header.constData(), BLOB_MAGIC, 4) != 0) {
+        return std::nullopt;
+    }
+
+    Blob blob;
+    blob.filePath = filePath;
+    blob.crc = qFromLittleEndian<quint32>(header.constData() + 4);
+    blob.size = qFromLittleEndian<qint64>(header.constData() + 8);
+    blob.compressedSize = qFromLittleEndian<qint64>(header.constData() + 16);
+
+    // A blob that does not match the file it was made from is of no use
+    if (blob.size != entry.size || file.size() != HEADER_SIZE + blob.compressedSize) {
+        return std::nullopt;
+    }
+    return blob;
+}
+
+std::shared_ptr<DeflateBlobCache::BlobWriter> DeflateBlobCache::create(const ZipEntry &entry, int compressionLevel)
+{
+    QDir().mkpath(m_directory);
+    QString tempPath = QDir(m_directory).filePath(QUuid::createUuid().toString(QUuid::WithoutBraces) + ".tmp");
+    return std::make_shared<BlobWriter>(key(entry, compressionLevel), tempPath);
+}
+
+bool DeflateBlobCache::add(const QByteArray &key, const QString &tempPath)
+{
+    QMutexLocker locker(&m_mutex);
+
+    // Two archives of the same folder compressed the file at the same time
+    if (m_blobs.contains(key)) {
+        return false;
+    }
+
+    QString filePath = QDir(m_directory).filePath(QString::fromLatin1(key) + ".blob");
+    QFile::remove(filePath);
+    if (!QFile::rename(tempPath, filePath)) {
+        return false;
+    }
+
+    CachedBlob blob;
+    blob.filePath = filePath;
+    blob.fileSize = QFileInfo(filePath).size();
+    blob.lastUsed = QDateTime::currentMSecsSinceEpoch();
+    m_blobs.insert(key, blob);
+    m_totalSize += blob.fileSize;
+
+    evictLocked();
+    return true;
+}
+
+void DeflateBlobCache::load()
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    QDir dir(m_directory);
+    const QFileInfoList files = dir.entryInfoList(QDir::Files);
+    for (const QFileInfo &file : files) {
+        if (file.suffix() == "tmp") {
+            QFile::remove(file.absoluteFilePath());
+            continue;
+        }
+
+        if (file.suffix() != "blob") {
+            continue;
+        }
+
+        CachedBlob blob;
+        blob.filePath = file.absoluteFilePath();
+        blob.fileSize = file.size();
+        blob.lastUsed = file.lastModified().toMSecsSinceEpoch();
+        m_blobs.insert(file.completeBaseName().toLatin1(), blob);
+        m_totalSize += blob.fileSize;
+    }
+
+    evictLocked();
+
+    qInfo() << "Deflate cache:" << m_blobs.size() << "blob(s)," << m_totalSize << "bytes in" << m_directory;
+}
+
+void DeflateBlobCache::evictLocked()
+{
+    while (m_totalSize > m_budget && !m_blobs.isEmpty()) {
+        auto oldest = m_blobs.begin();
+        for (auto it = m_blobs.begin(); it != m_blobs.end(); ++it) {
+            if (it->lastUsed < oldest->lastUsed) {
+                oldest = it;
+            }
+        }
+
+        QFile::remove(oldest->filePath);
+        m_totalSize -= oldest->fileSize;
+        m_blobs.erase(oldest);
+    }
+}
@@ -0,0 +1,245 @@
+#include "diskwriter.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QAbstractEventDispatcher>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstdio>
+#endif
+#ifdef Q_OS_WIN
+#include <io.h>
+#endif
+
+// Makes the data of a file durable before it is reported as uploaded
+static bool syncFile(QFile *file)
+{
+#ifdef Q_OS_UNIX
+    return ::fsync(file->handle()) == 0;
+#elif defined(Q_OS_WIN)
+    return _commit(file->handle()) == 0;
+#else
+    Q_UNUSED(file)
+    return true;
+#endif
+}
+
+// Moves a finished upload over its destination so readers see either the old or the new file
+static bool replaceFile(const QString &from, const QString &to)
+{
+#ifdef Q_OS_UNIX
+    if (std::rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) != 0) {
+        return false;
+    }
+
+    // The rename itself only survives a crash once the directory is synced
+    int dirFd = ::open(QFile::encodeName(QFileInfo(to).absolutePath()).constData(), O_RDONLY);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+    return true;
+#else
+    QFile::remove(to);
+    return QFile::rename(from, to);
+#endif
+}
+
+QThread* DiskWriter::ioThread()
+{
+    static QThread *thread = []() {
+        QThread *thread = new QThread();
+        thread->setObjectName("disk-io");
+        thread->start();
+        return thread;
+    }();
+    return thread;
+}
+
+void DiskWriter::shutdown()
+{
+    QThread *thread = ioThread();
+    if (!thread->isRunning()) {
+        return;
+    }
+
+    // Queued behind the writes and closes of the connections that just went away
+    QMetaObject::invokeMethod(QAbstractEventDispatcher::instance(thread), [thread]() {
+        thread->quit();
+    }, Qt::QueuedConnection);
+    thread->wait();
+}
+
+DiskWriter::DiskWriter()
+    : QObject(nullptr)
+    , m_nextFileId(0)
+    , m_drainScheduled(false)
+{
+    moveToThread(ioThread());
+}
+
+DiskWriter::~DiskWriter()
+{
+    for (Target &target : m_targets) {
+        target.file->close();
+        delete target.file;
+    }
+}
+
+quint64 DiskWriter::addFile(QFile *file)
+{
+    file->moveToThread(ioThread());
+
+    QMutexLocker locker(&m_mutex);
+    quint64 fileId = ++m_nextFileId;
+    Target target;
+    target.file = file;
+    m_targets.insert(fileId, target);
+    return fileId;
+}
+
+void DiskWriter::write(quint64 fileId, const QByteArray &data)
+{
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_targets.find(fileId);
+    if (it == m_targets.end() || it->closing || it->failed) {
+        return;
+    }
+
+    it->pending.append(data);
+    scheduleDrain();
+}
+
+void DiskWriter::close(quint64 fileId, CloseMode mode, const QString &targetPath, std::function<void(bool)> onClosed)
+{
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_targets.find(fileId);
+    if (it == m_targets.end() || it->closing) {
+        return;
+    }
+
+    it->closing = true;
+    it->mode = mode;
+    it->targetPath = targetPath;
+    it->onClosed = std::move(onClosed);
+    if (mode == CloseMode::Discard) {
+        it->pending.clear();
+    }
+    scheduleDrain();
+}
+
+void DiskWriter::scheduleDrain()
+{
+    // Called with the mutex held. One queued drain picks up everything queued until it runs
+    if (!m_drainScheduled) {
+        m_drainScheduled = true;
+        QMetaObject::invokeMethod(this, &DiskWriter::drain, Qt::QueuedConnection);
+    }
+}
+
+void DiskWriter::drain()
+{
+    QList<quint64> fileIds;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_drainScheduled = false;
+        fileIds = m_targets.keys();
+    }
+
+    for (quint64 fileId : std::as_const(fileIds)) {
+        QFile *file = nullptr;
+        QList<QByteArray> pending;
+        bool closing = false;
+        bool failed = false;
+        {
+            QMutexLocker locker(&m_mutex);
+            Target &target = m_targets[fileId];
+            file = target.file;
+            pending.swap(target.pending);
+            closing = target.closing;
+            failed = target.failed;
+        }
+
+        if (!pending.isEmpty() && !failed) {
+            qint64 bytesWritten = 0;
+            if (!writePending(file, pending, bytesWritten)) {
+                failed = true;
+                QMutexLocker locker(&m_mutex);
+                m_targets[fileId].failed = true;
+                emit this->failed(fileId, file->errorString());
+            }
+            if (bytesWritten > 0) {
+                emit written(fileId, bytesWritten);
+            }
+        }
+
+        if (!closing) {
+            continue;
+        }
+
+        Target target;
+        {
+            QMutexLocker locker(&m_mutex);
+            target = m_targets.take(fileId);
+        }
+
+        bool success = !failed && finalize(target.file, target.mode, target.targetPath);
+        delete target.file;
+
+        if (target.onClosed) {
+            target.onClosed(success);
+        }
+        emit closed(fileId, success);
+    }
+}
+
+bool DiskWriter::writePending(QFile *file, QList<QByteArray> &pending, qint64 &bytesWritten)
+{
+    // Small frames are gathered into one buffer, anything big enough goes out as is
+    QByteArray merged;
+    auto flushMerged = [&]() {
+        if (merged.isEmpty()) {
+            return true;
+        }
+        if (file->write(merged) != merged.size()) {
+            return false;
+        }
+        bytesWritten += merged.size();
+        merged.clear();
+        return true;
+    };
+
+    for (const QByteArray &chunk : std::as_const(pending)) {
+        if (chunk.size() >= MERGE_SIZE) {
+            if (!flushMerged() || file->write(chunk) != chunk.size()) {
+                return false;
+            }
+            bytesWritten += chunk.size();
+            continue;
+        }
+
+        if (merged.size() + chunk.size() > MERGE_SIZE && !flushMerged()) {
+            return false;
+        }
+        merged.append(chunk);
+    }
+
+    return flushMerged() && file->flush();
+}
+
+bool DiskWriter::finalize(QFile *file, CloseMode mode, const QString &targetPath)
+{
+    QString partPath = file->fileName();
+
+    if (mode == CloseMode::Commit) {
+        bool synced = file->flush() && syncFile(file);
+        file->close();
+        return synced && replaceFile(partPath, targetPath);
+    }
+
+    file->close();
+    return true;
+}
@@ -0,0 +1,70 @@
+#include "downloadsource.h"
+#include "filemanager.h"
+
+DownloadSource::DownloadSource(const QString &filePath)
+    : m_file(filePath)
+    , m_position(0)
+    , m_size(0)
+{
+}
+
+DownloadSource::~DownloadSource()
+{
+    close();
+}
+
+bool DownloadSource::open()
+{
+    if (!m_file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    m_position = 0;
+    return true;
+}
+
+bool DownloadSource::open(const FileManager &fileManager, const QString &relativePath)
+{
+    if (!fileManager.openFile(relativePath, m_file, QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    m_position = 0;
+    return true;
+}
+
+void DownloadSource::close()
+{
+    m_file.close();
+}
+
+bool DownloadSource::seek(qint64 offset)
+{
+    if (offset < 0 || offset > m_size) {
+        return false;
+    }
+
+    m_position = offset;
+    return true;
+}
+
+qint64 DownloadSource::read(char *dst, qint64 length)
+{
+    length = qMin(length, m_size - m_position);
+    if (length <= 0) {
+        return 0;
+    }
+
+    if (m_file.pos() != m_position && !m_file.seek(m_position)) {
+        return -1;
+    }
+
+    // A file that shrank since it was opened reads short instead of faulting
+    qint64 read = m_file.read(dst, length);
+    if (read > 0) {
+        m_position += read;
+    }
+    return read;
+}
@@ -1,34 +1,208 @@
 #include "filemanager.h"
+#include "uploadsessionmanager.h"
+#include "changenotifier.h"
+#include "pathresolver.h"
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QJsonObject>
 #include <QDateTime>
-#include <QDirIterator>
 #include <QStorageInfo>
-#include <QThreadPool>
+#include <QDirIterator>
+#include <QCollator>
+#include <QJsonDocument>
+#include <algorithm>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#endif
+
+// Streamed listings without a page size are sent in batches of this many entries
+static const int STREAM_BATCH_SIZE = 1000;
+
+namespace {
+
+struct SortItem {
+    MetadataIndex::Entry entry;
+    QCollatorSortKey key;
+};
+
+qint64 sortValue(const FileManager::ListOptions &options, const MetadataIndex::Entry &entry)
+{
+    switch (options.sortBy) {
+    case FileManager::SortKey::Size:
+        return entry.size;
+    case FileManager::SortKey::Modified:
+        return entry.modified;
+    default:
+        return 0;
+    }
+}
+
+QString encodeCursor(const FileManager::ListOptions &options, const MetadataIndex::Entry &entry)
+{
+    // The last entry sent rather than a position, so the next page starts right
+    // after it even when entries were added or removed in between
+    QJsonArray cursor;
+    cursor.append(int(options.sortBy));
+    cursor.append(options.descending);
+    cursor.append(options.foldersFirst);
+    cursor.append(entry.isDir);
+    cursor.append(sortValue(options, entry));
+    cursor.append(entry.name);
+
+    QByteArray json = QJsonDocument(cursor).toJson(QJsonDocument::Compact);
+    return QString::fromLatin1(json.toBase64(QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals));
+}
+
+bool decodeCursor(const FileManager::ListOptions &options, MetadataIndex::Entry &entry)
+{
+    QByteArray json = QByteArray::fromBase64(options.cursor.toLatin1(), QByteArray::Base64UrlEncoding);
+    QJsonArray cursor = QJsonDocument::fromJson(json).array();
+    if (cursor.size() != 6 || cursor[0].toInt(-1) != int(options.sortBy)
+        || cursor[1].toBool() != options.descending || cursor[2].toBool() != options.foldersFirst) {
+        return false;
+    }
+
+    entry.isDir = cursor[3].toBool();
+    entry.size = entry.modified = cursor[4].toInteger();
+    entry.name = cursor[5].toString();
+    return !entry.name.isEmpty();
+}
+
+#ifdef Q_OS_LINUX
+// Removes a folder and everything in it below an already open parent. Links are
+// removed themselves and never followed, whatever they point to stays
+bool removeTreeAt(int parentFd, const char *name)
+{
+    int fd = ::openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return (errno == ELOOP || errno == ENOTDIR) && ::unlinkat(parentFd, name, 0) == 0;
+    }
+
+    DIR *dir = ::fdopendir(fd);
+    if (!dir) {
+        ::close(fd);
+        return false;
+    }
+
+    // Keeps going after a failure so as much as possible is removed, like QDir::removeRecursively
+    bool removed = true;
+    while (dirent *entry = ::readdir(dir)) {
+        if (std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (::unlinkat(fd, entry->d_name, 0) == 0) {
+            continue;
+        }
+        removed = errno == EISDIR && removeTreeAt(fd, entry->d_name) && removed;
+    }
+    ::closedir(dir);
+
+    return ::unlinkat(parentFd, name, AT_REMOVEDIR) == 0 && removed;
+}
+#endif
+
+// The removal and rename below act on the folder holding the path, opened beneath the
+// root, so a link swapped in after the path was checked cannot send them elsewhere.
+// Nothing when the folder cannot be opened that way and the checked path is used instead
+std::optional<bool> removeBeneath(PathResolver &resolver, const QString &relativePath, bool recursive)
+{
+#ifdef Q_OS_LINUX
+    QString name;
+    std::optional<int> parentFd = resolver.openParent(relativePath, name);
+    if (!parentFd || *parentFd < 0) {
+        return parentFd ? std::optional<bool>(false) : std::nullopt;
+    }
+
+    QByteArray encoded = QFile::encodeName(name);
+    bool removed = recursive ? removeTreeAt(*parentFd, encoded.constData())
+                             : ::unlinkat(*parentFd, encoded.constData(), 0) == 0;
+    ::close(*parentFd);
+    return removed;
+#else
+    Q_UNUSED(resolver)
+    Q_UNUSED(relativePath)
+    Q_UNUSED(recursive)
+    return std::nullopt;
+#endif
+}
+
+std::optional<bool> renameBeneath(PathResolver &resolver, const QString &fromPath, const QString &toPath)
+{
+#ifdef Q_OS_LINUX
+    QString fromName;
+    QString toName;
+    std::optional<int> fromFd = resolver.openParent(fromPath, fromName);
+    std::optional<int> toFd = resolver.openParent(toPath, toName);
+
+    std::optional<bool> renamed;
+    if (fromFd && toFd) {
+        renamed = false;
+        if (*fromFd >= 0 && *toFd >= 0) {
+            QByteArray from = QFile::encodeName(fromName);
+            QByteArray to = QFile::encodeName(toName);
+            // Like QFile::rename, an existing target is never replaced
+            renamed = ::renameat2(*fromFd, from.constData(), *toFd, to.constData(), RENAME_NOREPLACE) == 0;
+            if (!*renamed && errno == EINVAL) {
+                // Filesystems without RENAME_NOREPLACE
+                struct stat existing;
+                renamed = ::fstatat(*toFd, to.constData(), &existing, AT_SYMLINK_NOFOLLOW) != 0 && errno == ENOENT
+                          && ::renameat(*fromFd, from.constData(), *toFd, to.constData()) == 0;
+            }
+        }
+    }
+
+    if (fromFd && *fromFd >= 0) {
+        ::close(*fromFd);
+    }
+    if (toFd && *toFd >= 0) {
+        ::close(*toFd);
+    }
+    return renamed;
+#else
+    Q_UNUSED(resolver)
+    Q_UNUSED(fromPath)
+    Q_UNUSED(toPath)
+    return std::nullopt;
+#endif
+}
+
+}
 
 FileManager::FileManager(const QString &rootPath, QObject *parent)
     : QObject(parent)
     , m_rootPath(QDir(rootPath).absolutePath())
 {
     QDir().mkpath(m_rootPath);
+    m_index = MetadataIndex::forRoot(m_rootPath);
+    m_resolver = PathResolver::forRoot(m_rootPath);
 }
 
-bool FileManager::isValidPath(const QString &relativePath) const
+std::optional<FileManager::SortKey> FileManager::parseSortKey(const QString &name)
 {
-    if (relativePath.isEmpty()) {
-        return true;
+    if (name.isEmpty() || name == "name") {
+        return SortKey::Name;
     }
-
-    QString absPath = getAbsolutePath(relativePath);
-    QString canonicalPath = QFileInfo(absPath).canonicalFilePath();
-
-    if (canonicalPath.isEmpty()) {
-        canonicalPath = QDir(absPath).absolutePath();
+    if (name == "size") {
+        return SortKey::Size;
+    }
+    if (name == "modified") {
+        return SortKey::Modified;
     }
+    return std::nullopt;
+}
 
-    return canonicalPath.startsWith(m_rootPath);
+bool FileManager::isValidPath(const QString &relativePath) const
+{
+    return m_resolver->isBeneath(relativePath);
 }
 
 QString FileManager::getAbsolutePath(const QString &relativePath) const
@@ -45,50 +219,170 @@ QString FileManager::getAbsolutePath(const QString &relativePath) const
     return QDir(m_rootPath).filePath(cleanPath);
 }
 
-QJsonArray FileManager::listDirectory(const QString &relativePath, bool foldersFirst)
+bool FileManager::openFile(const QString &relativePath, QFile &file, QIODevice::OpenMode mode) const
+{
+    file.setFileName(getAbsolutePath(relativePath));
+
+#ifdef Q_OS_LINUX
+    int flags = mode.testFlag(QIODevice::WriteOnly) ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+    if (std::optional<int> fd = m_resolver->open(relativePath, flags, 0666)) {
+        if (*fd < 0) {
+            return false;
+        }
+        if (!file.open(*fd, mode, QFileDevice::AutoCloseHandle)) {
+            ::close(*fd);
+            return false;
+        }
+        return true;
+    }
+#endif
+
+    return isValidPath(relativePath) && file.open(mode);
+}
+
+QList<MetadataIndex::Entry> FileManager::readDirectory(const QString &relativePath) const
 {
-    QJsonArray result;
+    QList<MetadataIndex::Entry> entries;
 
     if (!isValidPath(relativePath)) {
-        return result;
+        return entries;
     }
 
-    QString absPath = getAbsolutePath(relativePath);
-    QDir dir(absPath);
+    if (std::optional<QList<MetadataIndex::Entry>> indexed = m_index->list(relativePath)) {
+        return *indexed;
+    }
+
+    QDir dir(getAbsolutePath(relativePath));
 
     if (!dir.exists()) {
-        return result;
+        return entries;
     }
 
-    QFileInfoList entries = dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot);
+    const QFileInfoList infos = dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot, QDir::Unsorted);
+    for (const QFileInfo &info : infos) {
+        // Dot files are only hidden on unix, never list uploads in progress
+        if (UploadSessionManager::isPartFile(info.fileName())) {
+            continue;
+        }
 
-    if (foldersFirst) {
-        std::sort(entries.begin(), entries.end(), [](const QFileInfo &a, const QFileInfo &b) {
-            if (a.isDir() != b.isDir()) {
-                return a.isDir();
-            }
-            return a.fileName().toLower() < b.fileName().toLower();
-        });
+        MetadataIndex::Entry entry;
+        entry.name = info.fileName();
+        entry.isDir = info.isDir();
+        entry.size = info.size();
+        entry.modified = info.lastModified().toMSecsSinceEpoch();
+        entries.append(entry);
     }
 
-    for (const QFileInfo &entry : std::as_const(entries)) {
-        QJsonObject item;
-        item["name"] = entry.fileName();
-        item["isDir"] = entry.isDir();
-        item["size"] = entry.size();
-        item["modified"] = entry.lastModified().toString(Qt::ISODate);
+    return entries;
+}
 
-        QString relPath = relativePath;
-        if (!relPath.isEmpty() && !relPath.endsWith('/')) {
-            relPath += '/';
+bool FileManager::listDirectory(const QString &relativePath, const ListOptions &options,
+                                const std::function<void(const ListBatch&)> &onBatch)
+{
+    std::optional<MetadataIndex::Entry> after;
+    if (!options.cursor.isEmpty()) {
+        MetadataIndex::Entry entry;
+        if (!decodeCursor(options, entry)) {
+            return false;
         }
-        relPath += entry.fileName();
-        item["path"] = relPath;
+        after = entry;
+    }
 
-        result.append(item);
+    QList<MetadataIndex::Entry> entries = readDirectory(relativePath);
+
+    // Collation keys are computed once per entry instead of twice per comparison
+    QCollator collator;
+    collator.setCaseSensitivity(Qt::CaseInsensitive);
+
+    std::vector<SortItem> items;
+    items.reserve(entries.size());
+    for (MetadataIndex::Entry &entry : entries) {
+        QCollatorSortKey key = collator.sortKey(entry.name);
+        items.push_back(SortItem{std::move(entry), std::move(key)});
     }
+    entries.clear();
 
-    return result;
+    // Names are unique in a folder, so ties always end on them and the order is total
+    auto less = [&options](const SortItem &a, const SortItem &b) {
+        if (options.foldersFirst && a.entry.isDir != b.entry.isDir) {
+            return a.entry.isDir;
+        }
+
+        qint64 valueA = sortValue(options, a.entry);
+        qint64 valueB = sortValue(options, b.entry);
+        int order = valueA < valueB ? -1 : (valueA > valueB ? 1 : 0);
+        if (order == 0) {
+            order = a.key.compare(b.key);
+        }
+        if (order == 0) {
+            order = a.entry.name.compare(b.entry.name);
+        }
+        return options.descending ? order > 0 : order < 0;
+    };
+
+    qint64 total = qint64(items.size());
+    if (after) {
+        SortItem cursorItem{*after, collator.sortKey(after->name)};
+        items.erase(std::remove_if(items.begin(), items.end(), [&](const SortItem &item) {
+            return !less(cursorItem, item);
+        }), items.end());
+    }
+    qint64 offset = total - qint64(items.size());
+
+    size_t pageSize = items.size();
+    if (options.limit > 0) {
+        pageSize = size_t(options.limit);
+    } else if (options.stream) {
+        pageSize = STREAM_BATCH_SIZE;
+    }
+
+    // A first page only needs its own entries in order, the rest is sorted once
+    // it is actually going to be sent
+    size_t firstEnd = qMin(items.size(), pageSize);
+    if (firstEnd < items.size()) {
+        std::partial_sort(items.begin(), items.begin() + firstEnd, items.end(), less);
+    } else {
+        std::sort(items.begin(), items.end(), less);
+    }
+
+    QString prefix = relativePath;
+    if (!prefix.isEmpty() && !prefix.endsWith('/')) {
+        prefix += '/';
+    }
+
+    size_t begin = 0;
+    while (true) {
+        size_t end = qMin(items.size(), begin + pageSize);
+
+        ListBatch batch;
+        batch.offset = offset + qint64(begin);
+        batch.total = total;
+        for (size_t i = begin; i < end; ++i) {
+            const MetadataIndex::Entry &entry = items[i].entry;
+
+            QJsonObject item;
+            item["name"] = entry.name;
+            item["isDir"] = entry.isDir;
+            item["size"] = entry.size;
+            item["modified"] = QDateTime::fromMSecsSinceEpoch(entry.modified).toString(Qt::ISODate);
+            item["path"] = prefix + entry.name;
+            batch.files.append(item);
+        }
+        if (end < items.size()) {
+            batch.nextCursor = encodeCursor(options, items[end - 1].entry);
+        }
+        onBatch(batch);
+
+        if (end >= items.size() || !options.stream) {
+            break;
+        }
+        if (begin == 0) {
+            std::sort(items.begin() + end, items.end(), less);
+        }
+        begin = end;
+    }
+
+    return true;
 }
 
 bool FileManager::createDirectory(const QString &relativePath)
@@ -97,8 +391,65 @@ bool FileManager::createDirectory(const QString &relativePath)
         return false;
     }
 
+    return makePath(relativePath);
+}
+
+bool FileManager::makePath(const QString &relativePath)
+{
+    QString created;
+    if (!createFolders(relativePath, created)) {
+        return false;
+    }
+
+    if (!created.isEmpty()) {
+        m_index->refresh(created);
+        ChangeNotifier::instance().created(m_rootPath, created);
+    }
+    return true;
+}
+
+bool FileManager::createFolders(const QString &relativePath, QString &created)
+{
+    // Only the outermost new folder shows up in a listing, everything else is inside it
+    created.clear();
+    QString current;
+    const QStringList parts = relativePath.split('/', Qt::SkipEmptyParts);
+    for (const QString &part : parts) {
+        current = current.isEmpty() ? part : current + '/' + part;
+        if (!QFileInfo::exists(getAbsolutePath(current))) {
+            created = current;
+            break;
+        }
+    }
+
     QString absPath = getAbsolutePath(relativePath);
-    return QDir().mkpath(absPath);
+    if (created.isEmpty()) {
+        return QFileInfo(absPath).isDir();
+    }
+
+    if (!QDir().mkpath(absPath)) {
+        removeFolders(relativePath, created);
+        created.clear();
+        return false;
+    }
+    return true;
+}
+
+void FileManager::removeFolders(const QString &relativePath, const QString &created)
+{
+    if (created.isEmpty()) {
+        return;
+    }
+
+    // rmdir leaves anything that is not empty, should something have landed there meanwhile
+    QString current = relativePath.split('/', Qt::SkipEmptyParts).join('/');
+    while (current.startsWith(created)) {
+        QDir().rmdir(getAbsolutePath(current));
+        if (current == created) {
+            break;
+        }
+        current = current.section('/', 0, -2);
+    }
 }
 
 bool FileManager::deleteFile(const QString &relativePath)
@@ -107,8 +458,14 @@ bool FileManager::deleteFile(const QString &relativePath)
         return false;
     }
 
-    QString absPath = getAbsolutePath(relativePath);
-    return QFile::remove(absPath);
+    std::optional<bool> unlinked = removeBeneath(*m_resolver, relativePath, false);
+    bool removed = unlinked ? *unlinked : QFile::remove(getAbsolutePath(relativePath));
+    if (removed) {
+        m_resolver->invalidate(relativePath);
+        m_index->refresh(relativePath);
+        ChangeNotifier::instance().deleted(m_rootPath, relativePath);
+    }
+    return removed;
 }
 
 bool FileManager::deleteDirectory(const QString &relativePath)
@@ -124,25 +481,137 @@ bool FileManager::deleteDirectory(const QString &relativePath)
         return false;
     }
 
-    return dir.removeRecursively();
+    // Even a partial failure removed some files
+    std::optional<bool> unlinked = removeBeneath(*m_resolver, relativePath, true);
+    bool removed = unlinked ? *unlinked : dir.removeRecursively();
+    m_resolver->invalidate(relativePath);
+    m_index->refresh(relativePath);
+    if (removed) {
+        ChangeNotifier::instance().deleted(m_rootPath, relativePath);
+    } else {
+        ChangeNotifier::instance().changed(m_rootPath, relativePath);
+    }
+    return removed;
 }
 
 QJsonObject FileManager::getFolderTree(const QString &relativePath, int maxDepth)
 {
-    QJsonObject result;
+    if (!isValidPath(relativePath)) {
+        return QJsonObject();
+    }
 
+    return buildFolderTree(relativePath, maxDepth);
+}
+
+std::optional<QList<MetadataIndex::Folder>> FileManager::readFolders(const QString &relativePath) const
+{
+    if (std::optional<QList<MetadataIndex::Folder>> indexed = m_index->folders(relativePath)) {
+        return indexed;
+    }
+
+    // Not indexed yet, or below a link, those are checked against the root on the way
     if (!isValidPath(relativePath)) {
-        return result;
+        return std::nullopt;
     }
 
     QString absPath = getAbsolutePath(relativePath);
     QFileInfo dirInfo(absPath);
 
     if (!dirInfo.exists() || !dirInfo.isDir()) {
+        return std::nullopt;
+    }
+
+    QList<MetadataIndex::Folder> folders;
+    const QFileInfoList entries = QDir(absPath).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+    for (const QFileInfo &info : entries) {
+        MetadataIndex::Folder folder;
+        folder.name = info.fileName();
+        // Stops at the first subfolder, a folder full of files is not read through
+        folder.hasFolders = QDirIterator(info.absoluteFilePath(), QDir::Dirs | QDir::NoDotAndDotDot).hasNext();
+        folders.append(folder);
+    }
+    return folders;
+}
+
+QString FileManager::directoryVersion(const QString &relativePath) const
+{
+    if (!isValidPath(relativePath)) {
+        return QString();
+    }
+    return m_index->version(relativePath).value_or(QString());
+}
+
+std::optional<FileManager::SearchPage> FileManager::search(const QString &pattern, const QString &relativePath,
+                                                           const QString &cursor, int limit) const
+{
+    SearchPage page;
+    page.nextCursor = cursor;
+    std::optional<QList<MetadataIndex::Match>> matches = m_index->search(pattern, relativePath, page.nextCursor, limit);
+    if (!matches) {
+        return std::nullopt;
+    }
+
+    for (const MetadataIndex::Match &match : std::as_const(*matches)) {
+        QJsonObject item;
+        item["name"] = match.entry.name;
+        item["isDir"] = match.entry.isDir;
+        item["size"] = match.entry.size;
+        item["modified"] = QDateTime::fromMSecsSinceEpoch(match.entry.modified).toString(Qt::ISODate);
+        item["path"] = match.path;
+        page.files.append(item);
+    }
+    return page;
+}
+
+QString FileManager::folderName(const QString &relativePath) const
+{
+    QString name = relativePath.section('/', -1, -1, QString::SectionSkipEmpty);
+    if (name.isEmpty()) {
+        name = QFileInfo(m_rootPath).fileName();
+    }
+    return name.isEmpty() ? "Root" : name;
+}
+
+QJsonArray FileManager::getChildren(const QString &relativePath)
+{
+    QJsonArray children;
+
+    if (!isValidPath(relativePath)) {
+        return children;
+    }
+
+    std::optional<QList<MetadataIndex::Folder>> folders = readFolders(relativePath);
+    if (!folders) {
+        return children;
+    }
+
+    QString prefix = relativePath;
+    if (!prefix.isEmpty() && !prefix.endsWith('/')) {
+        prefix += '/';
+    }
+
+    for (const MetadataIndex::Folder &folder : std::as_const(*folders)) {
+        QJsonObject child;
+        child["name"] = folder.name;
+        child["path"] = prefix + folder.name;
+        child["isDir"] = true;
+        child["hasChildren"] = folder.hasFolders;
+        children.append(child);
+    }
+
+    return children;
+}
+
+QJsonObject FileManager::buildFolderTree(const QString &relativePath, int maxDepth) const
+{
+    QJsonObject result;
+
+    std::optional<QList<MetadataIndex::Folder>> folders = readFolders(relativePath);
+    if (!folders) {
         return result;
     }
 
-    result["name"] = dirInfo.fileName().isEmpty() ? "Root" : dirInfo.fileName();
+    result["name"] = folderName(relativePath);
     result["path"] = relativePath;
     result["isDir"] = true;
 
@@ -150,18 +619,15 @@ QJsonObject FileManager::getFolderTree(const QString &relativePath, int maxDepth
         return result;
     }
 
-    QDir dir(absPath);
-    QFileInfoList entries = dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
-
     QJsonArray children;
-    for (const QFileInfo &info : std::as_const(entries)) {
+    for (const MetadataIndex::Folder &folder : std::as_const(*folders)) {
         QString relPath = relativePath;
         if (!relPath.isEmpty() && !relPath.endsWith('/')) {
             relPath += '/';
         }
-        relPath += info.fileName();
+        relPath += folder.name;
 
-        QJsonObject child = getFolderTree(relPath, maxDepth > 0 ? maxDepth - 1 : -1);
+        QJsonObject child = buildFolderTree(relPath, maxDepth > 0 ? maxDepth - 1 : -1);
         children.append(child);
     }
 
@@ -187,14 +653,32 @@ bool FileManager::moveItem(const QString &fromPath, const QString &toPath)
         return false;
     }
 
+    QString targetPath = toPath;
     if (toInfo.isDir()) {
         QString fileName = fromInfo.fileName();
         absTo = QDir(absTo).filePath(fileName);
+        targetPath = toPath + "/" + fileName;
+    }
+
+    // Missing folders are only announced once the move happened, and removed again if it did not
+    QString parentPath = targetPath.section('/', 0, -2, QString::SectionSkipEmpty);
+    QString created;
+    createFolders(parentPath, created);
+
+    std::optional<bool> renamed = renameBeneath(*m_resolver, fromPath, targetPath);
+    bool moved = renamed ? *renamed : QFile::rename(absFrom, absTo);
+    if (!moved) {
+        removeFolders(parentPath, created);
+    } else {
+        if (!created.isEmpty()) {
+            m_index->refresh(created);
+            ChangeNotifier::instance().created(m_rootPath, created);
+        }
+        m_resolver->invalidate(fromPath);
+        m_index->move(fromPath, targetPath);
+        ChangeNotifier::instance().moved(m_rootPath, fromPath, targetPath);
     }
-
-    QDir().mkpath(QFileInfo(absTo).absolutePath());
-
-    return QFile::rename(absFrom, absTo);
+    return moved;
 }
 
 bool FileManager::renameItem(const QString &path, const QString &newName)
@@ -210,32 +694,28 @@ bool FileManager::renameItem(const QString &path, const QString &newName)
         return false;
     }
 
-    QString newPath = info.absolutePath() + "/" + newName;
-    return QFile::rename(absPath, newPath);
-}
-
-qint64 FileManager::calculateDirectorySize(const QString &path) const
-{
-    qint64 size = 0;
-    QDirIterator it(path, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    int slash = path.lastIndexOf('/');
+    QString renamedPath = slash >= 0 ? path.left(slash + 1) + newName : newName;
 
-    while (it.hasNext()) {
-        it.next();
-        size += it.fileInfo().size();
+    std::optional<bool> renamedBeneath = renameBeneath(*m_resolver, path, renamedPath);
+    bool renamed = renamedBeneath ? *renamedBeneath : QFile::rename(absPath, info.absolutePath() + "/" + newName);
+    if (renamed) {
+        m_resolver->invalidate(path);
+        m_index->move(path, renamedPath);
+        ChangeNotifier::instance().renamed(m_rootPath, path, renamedPath);
     }
-
-    return size;
+    return renamed;
 }
 
 qint64 FileManager::getTotalSize() const
 {
-    return calculateDirectorySize(m_rootPath);
+    return m_index->usedBytes();
 }
 
 qint64 FileManager::getAvailableSpace(qint64 limit) const
 {
-    qint64 used = getTotalSize();
-    return limit - used;
+    // Uploads in progress already have their share set aside
+    return limit - getTotalSize() - m_index->reservedBytes();
 }
 
 bool FileManager::saveFile(const QString &relativePath, const QByteArray &data)
@@ -245,30 +725,30 @@ bool FileManager::saveFile(const QString &relativePath, const QByteArray &data)
     }
 
     QString absPath = getAbsolutePath(relativePath);
-    QFileInfo fileInfo(absPath);
-    QDir().mkpath(fileInfo.absolutePath());
+    bool existed = QFileInfo::exists(absPath);
+    makePath(relativePath.section('/', 0, -2, QString::SectionSkipEmpty));
 
-    QFile file(absPath);
-    if (!file.open(QIODevice::WriteOnly)) {
+    QFile file;
+    if (!openFile(relativePath, file, QIODevice::WriteOnly)) {
         return false;
     }
 
     qint64 written = file.write(data);
     file.close();
+    m_index->refresh(relativePath);
+    if (existed) {
+        ChangeNotifier::instance().changed(m_rootPath, relativePath);
+    } else {
+        ChangeNotifier::instance().created(m_rootPath, relativePath);
+    }
 
     return written == data.size();
 }
 
 QByteArray FileManager::readFile(const QString &relativePath)
 {
-    if (!isValidPath(relativePath)) {
-        return QByteArray();
-    }
-
-    QString absPath = getAbsolutePath(relativePath);
-    QFile file(absPath);
-
-    if (!file.open(QIODevice::ReadOnly)) {
+    QFile file;
+    if (!openFile(relativePath, file, QIODevice::ReadOnly)) {
         return QByteArray();
     }
 
@@ -284,210 +764,3 @@ qint64 FileManager::getFileSize(const QString &relativePath) const
     QString absPath = getAbsolutePath(relativePath);
     return QFileInfo(absPath).size();
 }
-
-bool FileManager::addFileToZip(QuaZip &zip, const QString &filePath, const QString &zipPath, int compressionLevel)
-{
-    QFile inFile(filePath);
-    if (!inFile.open(QIODevice::ReadOnly)) {
-        qWarning() << "Failed to open file for zipping:" << filePath;
-        return false;
-    }
-
-    QuaZipFile outFile(&zip);
-    QuaZipNewInfo info(zipPath, filePath);
-    info.setPermissions(QFile::permissions(filePath));
-
-    // Use specified compression level (0-9)
-    // method = Z_DEFLATED, level = compressionLevel
-    if (!outFile.open(QIODevice::WriteOnly, info, nullptr, 0, Z_DEFLATED, compressionLevel)) {
-        qWarning() << "Failed to create zip entry:" << zipPath;
-        inFile.close();
-        return false;
-    }
-
-    // Read and write in chunks to avoid memory issues
-    const qint64 chunkSize = 1024 * 1024; // 1MB chunks
-    while (!inFile.atEnd()) {
-        QByteArray chunk = inFile.read(chunkSize);
-        if (chunk.isEmpty() && !inFile.atEnd()) {
-            qWarning() << "Failed to read from file:" << filePath;
-            outFile.close();
-            inFile.close();
-            return false;
-        }
-
-        if (outFile.write(chunk) != chunk.size()) {
-            qWarning() << "Failed to write to zip:" << zipPath;
-            outFile.close();
-            inFile.close();
-            return false;
-        }
-    }
-
-    outFile.close();
-    inFile.close();
-
-    return outFile.getZipError() == UNZ_OK;
-}
-
-bool FileManager::addDirectoryToZip(QuaZip &zip, const QString &dirPath, const QString &baseDir, int compressionLevel)
-{
-    QDir dir(dirPath);
-    if (!dir.exists()) {
-        qWarning() << "Directory does not exist:" << dirPath;
-        return false;
-    }
-
-    QFileInfoList entries = dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot);
-
-    for (const QFileInfo &entry : entries) {
-        QString relativePath = entry.absoluteFilePath().mid(baseDir.length());
-        if (relativePath.startsWith('/') || relativePath.startsWith('\\')) {
-            relativePath = relativePath.mid(1);
-        }
-
-        if (entry.isDir()) {
-            // Recursively add subdirectory
-            if (!addDirectoryToZip(zip, entry.absoluteFilePath(), baseDir, compressionLevel)) {
-                return false;
-            }
-        } else {
-            // Add file
-            if (!addFileToZip(zip, entry.absoluteFilePath(), relativePath, compressionLevel)) {
-                return false;
-            }
-        }
-    }
-
-    return true;
-}
-
-bool FileManager::createZipFromDirectory(const QString &relativePath, const QString &zipPath, int compressionLevel)
-{
-    if (!isValidPath(relativePath)) {
-        qWarning() << "Invalid path for zipping:" << relativePath;
-        return false;
-    }
-
-    QString absPath = getAbsolutePath(relativePath);
-    QFileInfo dirInfo(absPath);
-
-    if (!dirInfo.exists() || !dirInfo.isDir()) {
-        qWarning() << "Directory not found:" << absPath;
-        return false;
-    }
-
-    // Remove existing zip file
-    QFile::remove(zipPath);
-
-    // Create zip file
-    QuaZip zip(zipPath);
-
-    // ADDED: Enable UTF-8 support
-    zip.setUtf8Enabled(true);
-
-    if (!zip.open(QuaZip::mdCreate)) {
-        qWarning() << "Failed to create zip file:" << zipPath;
-        return false;
-    }
-
-    // Add directory contents to zip with specified compression level
-    bool success = addDirectoryToZip(zip, absPath, dirInfo.absolutePath(), compressionLevel);
-
-    zip.close();
-
-    if (!success || zip.getZipError() != UNZ_OK) {
-        qWarning() << "Zip creation failed with error:" << zip.getZipError();
-        QFile::remove(zipPath);
-        return false;
-    }
-
-    qInfo() << "Successfully created zip:" << zipPath << "with compression level:" << compressionLevel;
-    return true;
-}
-
-bool FileManager::createZipFromMultiplePaths(const QStringList &paths, const QString &zipPath, int compressionLevel)
-{
-    if (paths.isEmpty()) {
-        qWarning() << "No paths provided for zipping";
-        return false;
-    }
-
-    QFile::remove(zipPath);
-
-    QuaZip zip(zipPath);
-
-    // ADDED: Enable UTF-8 support
-    zip.setUtf8Enabled(true);
-
-    if (!zip.open(QuaZip::mdCreate)) {
-        qWarning() << "Failed to create zip file:" << zipPath;
-        return false;
-    }
-
-    bool success = true;
-
-    for (const QString &path : paths) {
-        if (!isValidPath(path)) {
-            qWarning() << "Skipping invalid path:" << path;
-            continue;
-        }
-
-        QString absPath = getAbsolutePath(path);
-        QFileInfo info(absPath);
-
-        if (!info.exists()) {
-            qWarning() << "Path not found:" << absPath;
-            continue;
-        }
-
-        if (info.isDir()) {
-            if (!addDirectoryToZip(zip, absPath, m_rootPath, compressionLevel)) {
-                success = false;
-                break;
-            }
-        } else {
-            QString relativePath = path;
-            if (!addFileToZip(zip, absPath, relativePath, compressionLevel)) {
-                success = false;
-                break;
-            }
-        }
-    }
-
-    zip.close();
-
-    if (!success || zip.getZipError() != UNZ_OK) {
-        qWarning() << "Zip creation failed with error:" << zip.getZipError();
-        QFile::remove(zipPath);
-        return false;
-    }
-
-    return true;
-}
-
-void FileManager::createZipFromDirectoryAsync(const QString &relativePath, const QString &zipPath, int compressionLevel)
-{
-    // Run in background thread
-    QThreadPool::globalInstance()->start([this, relativePath, zipPath, compressionLevel]() {
-        bool success = createZipFromDirectory(relativePath, zipPath, compressionLevel);
-
-        // Emit signal on main thread
-        QMetaObject::invokeMethod(this, [this, success, zipPath]() {
-            emit zipCreationComplete(success, zipPath);
-        }, Qt::QueuedConnection);
-    });
-}
-
-void FileManager::createZipFromMultiplePathsAsync(const QStringList &paths, const QString &zipPath, int compressionLevel)
-{
-    // Run in background thread
-    QThreadPool::globalInstance()->start([this, paths, zipPath, compressionLevel]() {
-        bool success = createZipFromMultiplePaths(paths, zipPath, compressionLevel);
-
-        // Emit signal on main thread
-        QMetaObject::invokeMethod(this, [this, success, zipPath]() {
-            emit zipCreationComplete(success, zipPath);
-        }, Qt::QueuedConnection);
-    });
-}
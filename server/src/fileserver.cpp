@@ -1,5 +1,6 @@
 #include "fileserver.h"
-#include <QWebSocket>
+#include "config.h"
+#include "uploadsessionmanager.h"
 #include <QDebug>
 #include <QSettings>
 #include <QCoreApplication>
@@ -10,11 +11,9 @@
 
 FileServer::FileServer(QObject *parent)
     : QObject(parent)
-    , m_server(new QWebSocketServer(QStringLiteral("OdznDrive Server"),
-                                    QWebSocketServer::NonSecureMode, this))
     , m_httpServer(new HttpServer(this))
+    , m_workerPool(new WorkerPool(m_httpServer, this))
 {
-    connect(m_server, &QWebSocketServer::newConnection, this, &FileServer::onNewConnection);
 }
 
 FileServer::~FileServer()
@@ -36,7 +35,10 @@ bool FileServer::start()
     QString shareLinksPath = appDataPath + "/sharelinks.json";
     m_httpServer->loadShareLinksFromFile(shareLinksPath);
 
-    if (m_server->listen(QHostAddress::Any, port)) {
+    UploadSessionManager::instance().startGarbageCollection();
+    m_workerPool->start(Config::instance().getWorkerThreadCount());
+
+    if (m_workerPool->listen(QHostAddress::Any, port)) {
         qInfo() << "WebSocket Server listening on port" << port;
 
         if (m_httpServer->start(httpUrl, httpPort)) {
@@ -48,40 +50,15 @@ bool FileServer::start()
             return true;
         }
     } else {
-        qCritical() << "Failed to start WebSocket server:" << m_server->errorString();
+        qCritical() << "Failed to start WebSocket server:" << m_workerPool->errorString();
         return false;
     }
 }
 
 void FileServer::stop()
 {
-    m_server->close();
+    m_workerPool->stop();
     m_httpServer->stop();
-    qDeleteAll(m_clients);
-    m_clients.clear();
-}
-
-void FileServer::onNewConnection()
-{
-    QWebSocket *socket = m_server->nextPendingConnection();
-
-    qInfo() << "New client connected:" << socket->peerAddress().toString();
-
-    ClientConnection *client = new ClientConnection(socket, nullptr, this);
-    client->setHttpServer(m_httpServer);
-    connect(client, &ClientConnection::disconnected, this, &FileServer::onClientDisconnected);
-
-    m_clients.append(client);
-}
-
-void FileServer::onClientDisconnected()
-{
-    ClientConnection *client = qobject_cast<ClientConnection*>(sender());
-    if (client) {
-        qInfo() << "Client disconnected";
-        m_clients.removeAll(client);
-        client->deleteLater();
-    }
 }
 
 QString FileServer::getDefaultLocalNetworkUrl()
@@ -0,0 +1,68 @@
+#include "gzipsink.h"
+
+GzipSink::GzipSink(ArchiveSink *sink, int compressionLevel)
+    : m_sink(sink)
+    , m_stream()
+    , m_output(OUTPUT_BUFFER_SIZE, Qt::Uninitialized)
+    , m_outputUsed(0)
+    , m_ready(false)
+{
+    // 16 on top of the window bits asks zlib for a gzip header and trailer
+    m_ready = deflateInit2(&m_stream, compressionLevel, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+GzipSink::~GzipSink()
+{
+    if (m_ready) {
+        deflateEnd(&m_stream);
+    }
+}
+
+bool GzipSink::write(const QByteArray &data)
+{
+    return deflateInput(data.constData(), data.size(), Z_NO_FLUSH);
+}
+
+bool GzipSink::isCancelled() const
+{
+    return m_sink->isCancelled();
+}
+
+bool GzipSink::finish()
+{
+    return deflateInput(nullptr, 0, Z_FINISH);
+}
+
+bool GzipSink::deflateInput(const char *data, qint64 length, int flush)
+{
+    if (!m_ready) {
+        return false;
+    }
+
+    m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    m_stream.avail_in = length;
+
+    // Output is collected until the buffer is full, small tar headers do not cost a write each
+    while (true) {
+        m_stream.next_out = reinterpret_cast<Bytef*>(m_output.data() + m_outputUsed);
+        m_stream.avail_out = m_output.size() - m_outputUsed;
+
+        int result = deflate(&m_stream, flush);
+        if (result == Z_STREAM_ERROR) {
+            return false;
+        }
+        m_outputUsed = m_output.size() - m_stream.avail_out;
+
+        bool done = m_stream.avail_out > 0;
+        if (m_outputUsed == m_output.size() || (done && flush == Z_FINISH && m_outputUsed > 0)) {
+            if (!m_sink->write(m_output.left(m_outputUsed))) {
+                return false;
+            }
+            m_outputUsed = 0;
+        }
+
+        if (done) {
+            return true;
+        }
+    }
+}
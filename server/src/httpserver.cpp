@@ -33,6 +33,7 @@ QString generateRandomToken(int byteLength)
 HttpServer::HttpServer(QObject *parent)
     : QObject(parent)
     , m_tcpServer(new QTcpServer(this))
+    , m_port(0)
 {
     m_server.route("/share/<arg>", [this](const QString &shareToken, const QHttpServerRequest &request) {
         return handleShareRequest(request, shareToken);
@@ -75,6 +76,8 @@ bool HttpServer::start(const QString &url, int port)
         m_baseUrl = qUrl.toString();
     }
 
+    m_port = m_tcpServer->serverPort();
+
     qInfo() << "HTTP Server listening on port" << port;
     qInfo() << "Share links will use base URL:" << m_baseUrl;
     qInfo() << "Test URL:" << (m_baseUrl + "/share/test");
@@ -87,6 +90,7 @@ void HttpServer::stop()
 {
     if (m_tcpServer->isListening()) {
         m_tcpServer->close();
+        m_port = 0;
         emit stopped();
     }
 }
@@ -121,8 +125,8 @@ QString HttpServer::generateShareLink(const QString &filePath, const QString &ba
 
     if (domain.isEmpty()) {
         QUrl qUrl(url);
-        if (qUrl.port() == -1 && m_tcpServer->isListening()) {
-            qUrl.setPort(m_tcpServer->serverPort());
+        if (qUrl.port() == -1 && m_port > 0) {
+            qUrl.setPort(m_port);
             url = qUrl.toString();
         }
     }
@@ -136,14 +140,20 @@ QString HttpServer::registerFileForSharing(const QString &filePath, const bool &
         return QString();
     }
 
-    // Check if file is already shared
-    QString existingToken = getExistingShareToken(filePath);
-    if (!existingToken.isEmpty()) {
-        return existingToken;
+    QString token;
+    {
+        QWriteLocker locker(&m_sharedFilesLock);
+
+        // Check if file is already shared
+        QString existingToken = findShareToken(filePath);
+        if (!existingToken.isEmpty()) {
+            return existingToken;
+        }
+
+        token = generateShareToken(shortUrl);
+        m_sharedFiles[token] = filePath;
     }
 
-    QString token = generateShareToken(shortUrl);
-    m_sharedFiles[token] = filePath;
     persistShareLinks();
     return token;
 }
@@ -162,11 +172,11 @@ QHttpServerResponse HttpServer::handleShareRequest(const QHttpServerRequest &req
 
 QHttpServerResponse HttpServer::handleFileDownload(const QString &shareToken, const QHttpServerRequest &request)
 {
-    if (!m_sharedFiles.contains(shareToken)) {
+    QString filePath = sharedFilePath(shareToken);
+    if (filePath.isEmpty()) {
         return QHttpServerResponse("File not found", QHttpServerResponse::StatusCode::NotFound);
     }
 
-    QString filePath = m_sharedFiles[shareToken];
     QFileInfo fileInfo(filePath);
 
     if (!fileInfo.exists() || !fileInfo.isFile()) {
@@ -332,7 +342,8 @@ QString HttpServer::getFileTypeIcon(const QString &fileName)
 
 QHttpServerResponse HttpServer::handleDownloadPage(const QString &shareToken)
 {
-    if (!m_sharedFiles.contains(shareToken)) {
+    QString filePath = sharedFilePath(shareToken);
+    if (filePath.isEmpty()) {
         QFile htmlFile(":/html/error.html");
         if (!htmlFile.open(QIODevice::ReadOnly)) {
             return QHttpServerResponse("Error page not found", QHttpServerResponse::StatusCode::NotFound);
@@ -370,7 +381,6 @@ QHttpServerResponse HttpServer::handleDownloadPage(const QString &shareToken)
         return response;
     }
 
-    QString filePath = m_sharedFiles[shareToken];
     QFileInfo fileInfo(filePath);
 
     if (!fileInfo.exists() || !fileInfo.isFile()) {
@@ -432,6 +442,12 @@ QString HttpServer::generateShareToken(const bool &shortUrl)
 }
 
 QString HttpServer::getExistingShareToken(const QString &filePath) const
+{
+    QReadLocker locker(&m_sharedFilesLock);
+    return findShareToken(filePath);
+}
+
+QString HttpServer::findShareToken(const QString &filePath) const
 {
     for (auto it = m_sharedFiles.begin(); it != m_sharedFiles.end(); ++it) {
         if (it.value() == filePath) {
@@ -441,8 +457,15 @@ QString HttpServer::getExistingShareToken(const QString &filePath) const
     return QString();
 }
 
+QString HttpServer::sharedFilePath(const QString &shareToken) const
+{
+    QReadLocker locker(&m_sharedFilesLock);
+    return m_sharedFiles.value(shareToken);
+}
+
 void HttpServer::loadShareLinksFromFile(const QString &filePath)
 {
+    QWriteLocker locker(&m_sharedFilesLock);
     m_shareLinksFilePath = filePath;
 
     QFile file(filePath);
@@ -484,13 +507,18 @@ void HttpServer::loadShareLinksFromFile(const QString &filePath)
 
 void HttpServer::saveShareLinksToFile(const QString &filePath) const
 {
+    // Held from the copy to the write, a save that copied an older list can never land last
+    QMutexLocker persistLocker(&m_persistMutex);
     QJsonArray shareLinksArray;
 
-    for (auto it = m_sharedFiles.begin(); it != m_sharedFiles.end(); ++it) {
-        QJsonObject linkObj;
-        linkObj.insert("token", it.key());
-        linkObj.insert("path", it.value());
-        shareLinksArray.append(linkObj);
+    {
+        QReadLocker locker(&m_sharedFilesLock);
+        for (auto it = m_sharedFiles.begin(); it != m_sharedFiles.end(); ++it) {
+            QJsonObject linkObj;
+            linkObj.insert("token", it.key());
+            linkObj.insert("path", it.value());
+            shareLinksArray.append(linkObj);
+        }
     }
 
     QJsonObject root;
@@ -511,40 +539,52 @@ void HttpServer::saveShareLinksToFile(const QString &filePath) const
 
 void HttpServer::updateFilePathInShareLinks(const QString &oldPath, const QString &newPath)
 {
-    QString token = getExistingShareToken(oldPath);
-    if (!token.isEmpty()) {
+    {
+        QWriteLocker locker(&m_sharedFilesLock);
+        QString token = findShareToken(oldPath);
+        if (token.isEmpty()) {
+            return;
+        }
         m_sharedFiles[token] = newPath;
-        qInfo() << "Updated share link path from" << oldPath << "to" << newPath;
-        persistShareLinks();
     }
+
+    qInfo() << "Updated share link path from" << oldPath << "to" << newPath;
+    persistShareLinks();
 }
 
 void HttpServer::removeShareLink(const QString &filePath)
 {
-    QString token = getExistingShareToken(filePath);
-    if (!token.isEmpty()) {
+    {
+        QWriteLocker locker(&m_sharedFilesLock);
+        QString token = findShareToken(filePath);
+        if (token.isEmpty()) {
+            return;
+        }
         m_sharedFiles.remove(token);
-        qInfo() << "Removed share link for" << filePath;
-        persistShareLinks();
     }
+
+    qInfo() << "Removed share link for" << filePath;
+    persistShareLinks();
 }
 
 void HttpServer::removeShareLinksInDirectory(const QString &dirPath)
 {
-    QStringList tokensToRemove;
-
-    // Find all share links that start with the directory path
-    for (auto it = m_sharedFiles.begin(); it != m_sharedFiles.end(); ++it) {
-        if (it.value().startsWith(dirPath + "/") || it.value().startsWith(dirPath + "\\")) {
-            tokensToRemove.append(it.key());
+    {
+        QWriteLocker locker(&m_sharedFilesLock);
+        QStringList tokensToRemove;
+
+        // Find all share links that start with the directory path
+        for (auto it = m_sharedFiles.begin(); it != m_sharedFiles.end(); ++it) {
+            if (it.value().startsWith(dirPath + "/") || it.value().startsWith(dirPath + "\\")) {
+                tokensToRemove.append(it.key());
+            }
         }
-    }
 
-    // Remove the found share links
-    for (const QString &token : tokensToRemove) {
-        QString removedPath = m_sharedFiles[token];
-        m_sharedFiles.remove(token);
-        qInfo() << "Removed share link for" << removedPath << "(in deleted directory)";
+        // Remove the found share links
+        for (const QString &token : tokensToRemove) {
+            QString removedPath = m_sharedFiles.take(token);
+            qInfo() << "Removed share link for" << removedPath << "(in deleted directory)";
+        }
     }
 
     persistShareLinks();
@@ -552,7 +592,13 @@ void HttpServer::removeShareLinksInDirectory(const QString &dirPath)
 
 void HttpServer::persistShareLinks() const
 {
-    if (!m_shareLinksFilePath.isEmpty()) {
-        saveShareLinksToFile(m_shareLinksFilePath);
+    QString filePath;
+    {
+        QReadLocker locker(&m_sharedFilesLock);
+        filePath = m_shareLinksFilePath;
+    }
+
+    if (!filePath.isEmpty()) {
+        saveShareLinksToFile(filePath);
     }
 }
@@ -5,14 +5,6 @@
 #include "config.h"
 #include "version.h"
 #include <QStandardPaths>
-#include <QLinkedList>
-
-static void forceCore5CompatLink() {
-    QLinkedList<int> dummy;
-    (void)dummy.size();
-    // otherwise qt mess with deploying Core5Compat which
-    // is required for quazip. :shrug:
-}
 
 int main(int argc, char *argv[])
 {
@@ -21,8 +13,6 @@ int main(int argc, char *argv[])
     QCoreApplication::setApplicationName("OdznDriveServer");
     QCoreApplication::setApplicationVersion(APP_VERSION_STRING);
 
-    forceCore5CompatLink();
-
     qInfo() << "========================================";
     qInfo() << "          OdznDrive Server" ;
     qInfo() << "========================================";
@@ -81,7 +71,7 @@ int main(int argc, char *argv[])
             qInfo() << "Username:      " << username;
             qInfo() << "Is admin:      " << isAdmin;
 
-            User* user = Config::instance().getUser(username);
+            std::optional<User> user = Config::instance().getUser(username);
             if (user) {
                 qInfo() << "Storage path:  " << user->storagePath;
             }
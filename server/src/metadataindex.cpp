@@ -0,0 +1,838 @@
+#include "metadataindex.h"
+#include "config.h"
+#include "uploadsessionmanager.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPromise>
+#include <QRandomGenerator>
+#include <QSaveFile>
+#include <QThread>
+#include <QThreadPool>
+#include <QDebug>
+
+static const quint32 INDEX_MAGIC = 0x4f445a49; // "ODZI"
+static const quint32 INDEX_VERSION = 2;
+static const qint64 SAVE_INTERVAL_MS = 60 * 1000;
+
+// Background scans pause this often so they do not starve requests of disk time
+static const qint64 SCAN_PAUSE_INTERVAL = 1024;
+static const int SCAN_PAUSE_MS = 2;
+
+static const quint8 FLAG_DIR = 0x1;
+static const quint8 FLAG_SCANNED = 0x2;
+
+static QMutex s_registryMutex;
+static QHash<QString, std::shared_ptr<MetadataIndex>> s_indexes;
+static std::atomic<bool> s_stopping(false);
+
+std::shared_ptr<MetadataIndex> MetadataIndex::forRoot(const QString &rootPath)
+{
+    std::shared_ptr<MetadataIndex> index;
+    {
+        QMutexLocker locker(&s_registryMutex);
+        std::shared_ptr<MetadataIndex> &slot = s_indexes[rootPath];
+        if (!slot) {
+            slot = std::make_shared<MetadataIndex>(rootPath);
+        }
+        index = slot;
+    }
+
+    // Loaded as soon as it is first asked for, maintainAll keeps it fresh from then on
+    index->maintain();
+    return index;
+}
+
+void MetadataIndex::maintainAll()
+{
+    QList<std::shared_ptr<MetadataIndex>> indexes;
+    {
+        QMutexLocker locker(&s_registryMutex);
+        indexes = s_indexes.values();
+    }
+
+    for (const std::shared_ptr<MetadataIndex> &index : std::as_const(indexes)) {
+        index->maintain();
+    }
+}
+
+void MetadataIndex::saveAll()
+{
+    s_stopping = true;
+    pool()->clear();
+    pool()->waitForDone();
+
+    QList<std::shared_ptr<MetadataIndex>> indexes;
+    {
+        QMutexLocker locker(&s_registryMutex);
+        indexes = s_indexes.values();
+    }
+
+    for (const std::shared_ptr<MetadataIndex> &index : std::as_const(indexes)) {
+        index->save();
+    }
+}
+
+MetadataIndex::MetadataIndex(const QString &rootPath)
+    : m_rootPath(rootPath)
+    , m_reconcileInterval(Config::instance().getIndexReconcileInterval() * 1000LL)
+    , m_epoch(0)
+    , m_versionCounter(0)
+    , m_reconciling(true)
+    , m_dirty(false)
+    , m_savedUsage(-1)
+    , m_reserved(0)
+    , m_taskRunning(false)
+    , m_lastReconcile(0)
+    , m_lastSave(0)
+{
+    readSavedUsage();
+}
+
+MetadataIndex::Reservation::Reservation(std::shared_ptr<MetadataIndex> index, qint64 bytes)
+    : m_index(std::move(index))
+    , m_bytes(bytes)
+{
+}
+
+MetadataIndex::Reservation::~Reservation()
+{
+    QMutexLocker locker(&m_index->m_reservationMutex);
+    m_index->m_reserved -= m_bytes;
+}
+
+QThreadPool* MetadataIndex::pool()
+{
+    // One scan at a time, they all compete for the same disks
+    static QThreadPool *pool = []() {
+        QThreadPool *pool = new QThreadPool();
+        pool->setMaxThreadCount(1);
+        return pool;
+    }();
+    return pool;
+}
+
+bool MetadataIndex::splitPath(const QString &relativePath, QStringList &parts)
+{
+    parts = relativePath.split('/', Qt::SkipEmptyParts);
+    for (const QString &part : std::as_const(parts)) {
+        if (part == "." || part == "..") {
+            return false;
+        }
+    }
+    return true;
+}
+
+QString MetadataIndex::absolutePath(const QStringList &parts) const
+{
+    return parts.isEmpty() ? m_rootPath : m_rootPath + "/" + parts.join('/');
+}
+
+QString MetadataIndex::snapshotPath() const
+{
+    QByteArray name = QCryptographicHash::hash(m_rootPath.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QDir(Config::instance().getMetadataIndexDir()).filePath(QString::fromLatin1(name) + ".idx");
+}
+
+bool MetadataIndex::isReady() const
+{
+    QReadLocker locker(&m_lock);
+    return m_root != nullptr;
+}
+
+std::optional<QList<MetadataIndex::Entry>> MetadataIndex::list(const QString &relativePath) const
+{
+    QStringList parts;
+    if (!splitPath(relativePath, parts)) {
+        return std::nullopt;
+    }
+
+    QReadLocker locker(&m_lock);
+    const Node *node = findLocked(parts);
+    if (!node || !node->isDir || !node->scanned) {
+        return std::nullopt;
+    }
+
+    QList<Entry> entries;
+    entries.reserve(node->children.size());
+    for (const auto &[name, child] : node->children) {
+        Entry entry;
+        entry.name = name;
+        entry.isDir = child->isDir;
+        entry.size = child->size;
+        entry.modified = child->modified;
+        entries.append(entry);
+    }
+    return entries;
+}
+
+std::optional<QList<MetadataIndex::Folder>> MetadataIndex::folders(const QString &relativePath) const
+{
+    QStringList parts;
+    if (!splitPath(relativePath, parts)) {
+        return std::nullopt;
+    }
+
+    QReadLocker locker(&m_lock);
+    const Node *node = findLocked(parts);
+    if (!node || !node->isDir || !node->scanned) {
+        return std::nullopt;
+    }
+
+    QList<Folder> folders;
+    folders.reserve(node->folderCount);
+    for (const auto &[name, child] : node->children) {
+        if (child->isDir) {
+            Folder folder;
+            folder.name = name;
+            // Nothing is known below a link, let the client find out
+            folder.hasFolders = !child->scanned || child->folderCount > 0;
+            folders.append(folder);
+        }
+    }
+    return folders;
+}
+
+std::optional<qint64> MetadataIndex::totalSize(const QString &relativePath) const
+{
+    QStringList parts;
+    if (!splitPath(relativePath, parts)) {
+        return std::nullopt;
+    }
+
+    QReadLocker locker(&m_lock);
+    const Node *node = findLocked(parts);
+    if (!node || (node->isDir && !node->scanned)) {
+        return std::nullopt;
+    }
+    return node->totalSize;
+}
+
+std::optional<QString> MetadataIndex::version(const QString &relativePath) const
+{
+    QStringList parts;
+    if (!splitPath(relativePath, parts)) {
+        return std::nullopt;
+    }
+
+    QReadLocker locker(&m_lock);
+    const Node *node = findLocked(parts);
+    if (!node || !node->isDir || !node->scanned) {
+        return std::nullopt;
+    }
+    return QString::number(m_epoch, 16) + '.' + QString::number(node->version);
+}
+
+std::optional<QList<MetadataIndex::Match>> MetadataIndex::search(const QString &pattern, const QString &relativePath,
+                                                                 QString &cursor, int limit) const
+{
+    QStringList parts;
+    if (!splitPath(relativePath, parts)) {
+        return std::nullopt;
+    }
+    SearchIndex::Matcher matcher(pattern);
+
+    QReadLocker locker(&m_lock);
+    const Node *scope = findLocked(parts);
+    if (!scope || !scope->isDir) {
+        return std::nullopt;
+    }
+
+    // Ids are handed out again after a load or a scan, a cursor is only good for the same tree
+    quint32 after = SearchIndex::NONE;
+    if (!cursor.isEmpty()) {
+        QStringList fields = cursor.split('.');
+        bool ok = false;
+        if (fields.size() == 2 && fields[0] == QString::number(m_epoch, 16)) {
+            after = fields[1].toUInt(&ok);
+        }
+        if (!ok) {
+            return std::nullopt;
+        }
+    }
+
+    bool more = false;
+    const QList<quint32> ids = m_search.find(matcher, parts.isEmpty() ? SearchIndex::NONE : scope->searchId,
+                                             after, limit, more);
+
+    QList<Match> matches;
+    matches.reserve(ids.size());
+    for (quint32 id : ids) {
+        Match match;
+        match.path = m_search.path(id);
+        QStringList matchParts = match.path.split('/');
+        const Node *node = findLocked(matchParts);
+        if (!node) {
+            continue;
+        }
+        match.entry.name = matchParts.last();
+        match.entry.isDir = node->isDir;
+        match.entry.size = node->size;
+        match.entry.modified = node->modified;
+        matches.append(match);
+    }
+
+    cursor = more && !ids.isEmpty() ? QString::number(m_epoch, 16) + '.' + QString::number(ids.last()) : QString();
+    return matches;
+}
+
+qint64 MetadataIndex::usedBytes()
+{
+    {
+        QReadLocker locker(&m_lock);
+        if (m_root) {
+            return m_root->totalSize;
+        }
+        if (m_savedUsage >= 0) {
+            return m_savedUsage;
+        }
+    }
+
+    // No snapshot yet, the result stands in until the first scan is done. It runs once
+    // off the connection threads, everyone asking meanwhile waits for the same walk
+    QFuture<qint64> walk;
+    {
+        QWriteLocker locker(&m_lock);
+        if (m_root) {
+            return m_root->totalSize;
+        }
+        if (m_savedUsage >= 0) {
+            return m_savedUsage;
+        }
+        if (!m_usageWalk.isValid()) {
+            auto promise = std::make_shared<QPromise<qint64>>();
+            m_usageWalk = promise->future();
+            promise->start();
+            QThreadPool::globalInstance()->start([promise, rootPath = m_rootPath]() {
+                promise->addResult(sumFileSizes(rootPath));
+                promise->finish();
+            });
+        }
+        walk = m_usageWalk;
+    }
+
+    qint64 used = walk.result();
+
+    QWriteLocker locker(&m_lock);
+    m_savedUsage = used;
+    return m_root ? m_root->totalSize : used;
+}
+
+qint64 MetadataIndex::reservedBytes() const
+{
+    QMutexLocker locker(&m_reservationMutex);
+    return m_reserved;
+}
+
+std::shared_ptr<MetadataIndex::Reservation> MetadataIndex::reserve(qint64 bytes, qint64 limit)
+{
+    qint64 used = usedBytes();
+
+    QMutexLocker locker(&m_reservationMutex);
+    if (used + m_reserved + bytes > limit) {
+        return nullptr;
+    }
+
+    m_reserved += bytes;
+    return std::make_shared<Reservation>(shared_from_this(), bytes);
+}
+
+void MetadataIndex::refresh(const QString &relativePath)
+{
+    QStringList parts;
+    if (!splitPath(relativePath, parts) || parts.isEmpty()) {
+        return;
+    }
+
+    {
+        QWriteLocker locker(&m_lock);
+        noteChangeLocked(relativePath);
+        if (!m_root) {
+            return;
+        }
+
+        // Folders created on the way, by an upload or mkpath, are read as a whole
+        const Node *node = m_root.get();
+        int known = 0;
+        while (known < parts.size() - 1) {
+            auto it = node->children.find(parts[known]);
+            if (it == node->children.end()) {
+                break;
+            }
+            node = it->second.get();
+            ++known;
+        }
+
+        // Nothing is kept below a file or a link that is not followed
+        if (!node->isDir || !node->scanned) {
+            return;
+        }
+        parts = parts.mid(0, known + 1);
+    }
+
+    // Disk access happens outside the lock, a large folder must not hold up listings
+    QFileInfo info(absolutePath(parts));
+    std::unique_ptr<Node> node;
+    if (info.exists() && !info.isHidden() && !UploadSessionManager::isPartFile(info.fileName())) {
+        qint64 count = 0;
+        node = info.isSymLink() ? stat(info) : scan(info, count, false);
+        if (!node) {
+            return;
+        }
+    }
+    qint64 parentModified = QFileInfo(info.absolutePath()).lastModified().toMSecsSinceEpoch();
+
+    QWriteLocker locker(&m_lock);
+    if (m_root && setLocked(parts, std::move(node))) {
+        touchLocked(parts.mid(0, parts.size() - 1), parentModified);
+    }
+}
+
+void MetadataIndex::move(const QString &fromPath, const QString &toPath)
+{
+    QStringList fromParts;
+    QStringList toParts;
+    if (!splitPath(fromPath, fromParts) || !splitPath(toPath, toParts) || fromParts.isEmpty() || toParts.isEmpty()) {
+        return;
+    }
+
+    QStringList fromParent = fromParts.mid(0, fromParts.size() - 1);
+    QStringList toParent = toParts.mid(0, toParts.size() - 1);
+    qint64 fromModified = QFileInfo(absolutePath(fromParent)).lastModified().toMSecsSinceEpoch();
+    qint64 toModified = QFileInfo(absolutePath(toParent)).lastModified().toMSecsSinceEpoch();
+
+    bool moved = false;
+    {
+        QWriteLocker locker(&m_lock);
+        noteChangeLocked(fromPath);
+        noteChangeLocked(toPath);
+        if (!m_root) {
+            return;
+        }
+
+        Node *parent = findLocked(fromParent);
+        if (parent && parent->children.count(fromParts.last())) {
+            auto it = parent->children.find(fromParts.last());
+            std::unique_ptr<Node> node = std::move(it->second);
+            parent->children.erase(it);
+            if (node->isDir) {
+                --parent->folderCount;
+            }
+            parent->version = ++m_versionCounter;
+            adjustLocked(fromParent, -node->totalSize);
+            touchLocked(fromParent, fromModified);
+            m_dirty = true;
+
+            // Moving a folder only moves its node, nothing below it is read again
+            moved = setLocked(toParts, std::move(node));
+            if (moved) {
+                touchLocked(toParent, toModified);
+            }
+        }
+    }
+
+    if (!moved) {
+        refresh(fromPath);
+        refresh(toPath);
+    }
+}
+
+void MetadataIndex::maintain()
+{
+    QMutexLocker locker(&m_stateMutex);
+    if (m_taskRunning || s_stopping) {
+        return;
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    bool reconcileDue = now - m_lastReconcile >= m_reconcileInterval;
+    bool saveDue = m_dirty && now - m_lastSave >= SAVE_INTERVAL_MS;
+    if (!reconcileDue && !saveDue) {
+        return;
+    }
+
+    m_taskRunning = true;
+    std::shared_ptr<MetadataIndex> self = shared_from_this();
+    pool()->start([self, reconcileDue]() {
+        if (!self->isReady()) {
+            self->load();
+        }
+        if (reconcileDue) {
+            self->reconcile();
+        }
+        self->save();
+
+        QMutexLocker locker(&self->m_stateMutex);
+        if (reconcileDue) {
+            self->m_lastReconcile = QDateTime::currentMSecsSinceEpoch();
+        }
+        self->m_taskRunning = false;
+    });
+}
+
+void MetadataIndex::readSavedUsage()
+{
+    // Only the header, so quota checks have a number before the tree is loaded
+    QFile file(snapshotPath());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    QByteArray rootPath;
+    qint64 usage = -1;
+    in >> magic >> version >> rootPath >> usage;
+    if (in.status() == QDataStream::Ok && magic == INDEX_MAGIC && version == INDEX_VERSION
+        && QString::fromUtf8(rootPath) == m_rootPath) {
+        m_savedUsage = usage;
+    }
+}
+
+void MetadataIndex::load()
+{
+    QFile file(snapshotPath());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    QByteArray rootPath;
+    qint64 usage = 0;
+    in >> magic >> version >> rootPath >> usage;
+    if (magic != INDEX_MAGIC || version != INDEX_VERSION || QString::fromUtf8(rootPath) != m_rootPath) {
+        return;
+    }
+
+    std::unique_ptr<Node> root = readNode(in);
+    if (!root || in.status() != QDataStream::Ok) {
+        qWarning() << "Discarding damaged metadata index" << file.fileName();
+        return;
+    }
+    SearchIndex search;
+    indexTree(search, root.get(), SearchIndex::NONE, QString());
+
+    QSet<QString> changed;
+    {
+        QWriteLocker locker(&m_lock);
+        if (m_root) {
+            return;
+        }
+        m_root = std::move(root);
+        m_search = std::move(search);
+        m_epoch = QRandomGenerator::global()->generate64();
+        changed = m_changed;
+    }
+
+    // The snapshot predates anything the server changed since it started
+    for (const QString &path : std::as_const(changed)) {
+        refresh(path);
+    }
+
+    qInfo() << "Loaded metadata index of" << m_rootPath << "in" << timer.elapsed() << "ms";
+}
+
+void MetadataIndex::reconcile()
+{
+    {
+        QWriteLocker locker(&m_lock);
+        m_reconciling = true;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    qint64 count = 0;
+    std::unique_ptr<Node> root = scan(QFileInfo(m_rootPath), count, true);
+    bool completed = root != nullptr;
+    SearchIndex search;
+    if (completed) {
+        indexTree(search, root.get(), SearchIndex::NONE, QString());
+    }
+
+    QSet<QString> changed;
+    {
+        QWriteLocker locker(&m_lock);
+        m_reconciling = false;
+        changed.swap(m_changed);
+        if (completed) {
+            m_root = std::move(root);
+            m_search = std::move(search);
+            m_epoch = QRandomGenerator::global()->generate64();
+            m_dirty = true;
+        }
+    }
+
+    // The scan may have passed a folder before the server changed it
+    for (const QString &path : std::as_const(changed)) {
+        refresh(path);
+    }
+
+    if (completed) {
+        qInfo() << "Metadata index of" << m_rootPath << "reconciled:" << count << "entries in" << timer.elapsed() << "ms";
+    }
+}
+
+void MetadataIndex::save()
+{
+    if (!m_dirty.exchange(false)) {
+        return;
+    }
+
+    bool saved = false;
+    {
+        QReadLocker locker(&m_lock);
+        if (!m_root) {
+            return;
+        }
+
+        QDir().mkpath(Config::instance().getMetadataIndexDir());
+        QSaveFile file(snapshotPath());
+        if (file.open(QIODevice::WriteOnly)) {
+            QDataStream out(&file);
+            out.setVersion(QDataStream::Qt_6_0);
+            out << INDEX_MAGIC << INDEX_VERSION << m_rootPath.toUtf8() << m_root->totalSize;
+            writeNode(out, *m_root);
+            saved = out.status() == QDataStream::Ok && file.commit();
+        }
+    }
+
+    if (!saved) {
+        qWarning() << "Failed to save metadata index of" << m_rootPath;
+        m_dirty = true;
+    }
+
+    QMutexLocker locker(&m_stateMutex);
+    m_lastSave = QDateTime::currentMSecsSinceEpoch();
+}
+
+std::unique_ptr<MetadataIndex::Node> MetadataIndex::stat(const QFileInfo &info)
+{
+    auto node = std::make_unique<Node>();
+    node->isDir = info.isDir();
+    node->size = info.size();
+    node->modified = info.lastModified().toMSecsSinceEpoch();
+    node->totalSize = node->isDir ? 0 : node->size;
+    return node;
+}
+
+std::unique_ptr<MetadataIndex::Node> MetadataIndex::scan(const QFileInfo &info, qint64 &count, bool throttled)
+{
+    std::unique_ptr<Node> node = stat(info);
+    if (!node->isDir) {
+        return node;
+    }
+
+    // Same filter as a directory listing, hidden entries and uploads in progress are left out
+    QDirIterator it(info.absoluteFilePath(), QDir::AllEntries | QDir::NoDotAndDotDot);
+    while (it.hasNext()) {
+        if (s_stopping) {
+            return nullptr;
+        }
+
+        it.next();
+        const QFileInfo child = it.fileInfo();
+        if (UploadSessionManager::isPartFile(child.fileName())) {
+            continue;
+        }
+
+        // Links to folders are listed but not followed, they could lead out of the root or back into it
+        std::unique_ptr<Node> childNode = child.isSymLink() ? stat(child) : scan(child, count, throttled);
+        if (!childNode) {
+            return nullptr;
+        }
+
+        if (++count % SCAN_PAUSE_INTERVAL == 0 && throttled) {
+            QThread::msleep(SCAN_PAUSE_MS);
+        }
+        node->totalSize += childNode->totalSize;
+        node->folderCount += childNode->isDir ? 1 : 0;
+        node->children.emplace(child.fileName(), std::move(childNode));
+    }
+
+    node->scanned = true;
+    return node;
+}
+
+qint64 MetadataIndex::sumFileSizes(const QString &path)
+{
+    qint64 size = 0;
+    QDirIterator it(path, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+
+    while (it.hasNext()) {
+        it.next();
+        size += it.fileInfo().size();
+    }
+
+    return size;
+}
+
+void MetadataIndex::writeNode(QDataStream &out, const Node &node)
+{
+    quint8 flags = (node.isDir ? FLAG_DIR : 0) | (node.scanned ? FLAG_SCANNED : 0);
+    out << flags << node.size << node.modified << quint32(node.children.size());
+    for (const auto &[name, child] : node.children) {
+        out << name.toUtf8();
+        writeNode(out, *child);
+    }
+}
+
+std::unique_ptr<MetadataIndex::Node> MetadataIndex::readNode(QDataStream &in)
+{
+    quint8 flags = 0;
+    quint32 childCount = 0;
+    auto node = std::make_unique<Node>();
+    in >> flags >> node->size >> node->modified >> childCount;
+    if (in.status() != QDataStream::Ok) {
+        return nullptr;
+    }
+
+    node->isDir = flags & FLAG_DIR;
+    node->scanned = flags & FLAG_SCANNED;
+    node->totalSize = node->isDir ? 0 : node->size;
+
+    for (quint32 i = 0; i < childCount; ++i) {
+        QByteArray name;
+        in >> name;
+        std::unique_ptr<Node> child = readNode(in);
+        if (!child) {
+            return nullptr;
+        }
+        node->totalSize += child->totalSize;
+        node->folderCount += child->isDir ? 1 : 0;
+        node->children.emplace(QString::fromUtf8(name), std::move(child));
+    }
+    return node;
+}
+
+void MetadataIndex::indexTree(SearchIndex &search, Node *node, quint32 parent, const QString &name)
+{
+    node->searchId = search.add(parent, name);
+    for (const auto &[childName, child] : node->children) {
+        indexTree(search, child.get(), node->searchId, childName);
+    }
+}
+
+void MetadataIndex::unindexTree(SearchIndex &search, const Node &node)
+{
+    search.remove(node.searchId);
+    for (const auto &[name, child] : node.children) {
+        unindexTree(search, *child);
+    }
+}
+
+MetadataIndex::Node* MetadataIndex::findLocked(const QStringList &parts) const
+{
+    Node *node = m_root.get();
+    for (const QString &part : parts) {
+        if (!node) {
+            break;
+        }
+        auto it = node->children.find(part);
+        node = it != node->children.end() ? it->second.get() : nullptr;
+    }
+    return node;
+}
+
+bool MetadataIndex::setLocked(const QStringList &parts, std::unique_ptr<Node> node)
+{
+    QStringList parentParts = parts.mid(0, parts.size() - 1);
+    Node *parent = findLocked(parentParts);
+    if (!parent || !parent->isDir || !parent->scanned) {
+        // A node detached by a move has nowhere to go, its names must not be found anymore
+        if (node) {
+            unindexTree(m_search, *node);
+        }
+        return false;
+    }
+
+    qint64 delta = node ? node->totalSize : 0;
+    auto it = parent->children.find(parts.last());
+    if (it != parent->children.end()) {
+        delta -= it->second->totalSize;
+        parent->folderCount -= it->second->isDir ? 1 : 0;
+        unindexTree(m_search, *it->second);
+        parent->children.erase(it);
+    }
+    if (node) {
+        stampLocked(node.get());
+        // A moved node keeps its names, only its own is updated
+        if (m_search.isLive(node->searchId)) {
+            m_search.move(node->searchId, parent->searchId, parts.last());
+        } else {
+            indexTree(m_search, node.get(), parent->searchId, parts.last());
+        }
+        parent->folderCount += node->isDir ? 1 : 0;
+        parent->children.emplace(parts.last(), std::move(node));
+    }
+
+    parent->version = ++m_versionCounter;
+    adjustLocked(parentParts, delta);
+    m_dirty = true;
+    return true;
+}
+
+void MetadataIndex::adjustLocked(const QStringList &parentParts, qint64 delta)
+{
+    // Every folder above a change carries the size of everything below it
+    Node *node = m_root.get();
+    node->totalSize += delta;
+    for (const QString &part : parentParts) {
+        auto it = node->children.find(part);
+        if (it == node->children.end()) {
+            return;
+        }
+        node = it->second.get();
+        node->totalSize += delta;
+    }
+}
+
+void MetadataIndex::touchLocked(const QStringList &parts, qint64 modified)
+{
+    Node *node = findLocked(parts);
+    if (!node || node->modified == modified) {
+        return;
+    }
+
+    // The date of a folder shows in the listing of the one above it
+    node->modified = modified;
+    if (!parts.isEmpty()) {
+        Node *parent = findLocked(parts.mid(0, parts.size() - 1));
+        if (parent) {
+            parent->version = ++m_versionCounter;
+        }
+    }
+}
+
+void MetadataIndex::stampLocked(Node *node)
+{
+    // A folder put in place of another, or moved there, must not take over its token
+    if (!node->isDir) {
+        return;
+    }
+    node->version = ++m_versionCounter;
+    for (const auto &[name, child] : node->children) {
+        stampLocked(child.get());
+    }
+}
+
+void MetadataIndex::noteChangeLocked(const QString &relativePath)
+{
+    if (m_reconciling) {
+        m_changed.insert(relativePath);
+    }
+}
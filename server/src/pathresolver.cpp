@@ -0,0 +1,289 @@
+#include "pathresolver.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <sys/syscall.h>
+#if __has_include(<linux/openat2.h>) && defined(SYS_openat2)
+#include <linux/openat2.h>
+#define HAVE_OPENAT2
+#endif
+#endif
+
+// Long enough to cover every check of one operation, short enough that a folder
+// swapped for a link from outside the server is not trusted for long
+static const qint64 CACHE_TTL_MS = 5000;
+static const int CACHE_SIZE = 4096;
+
+static QMutex s_registryMutex;
+static QHash<QString, std::shared_ptr<PathResolver>> s_resolvers;
+
+std::shared_ptr<PathResolver> PathResolver::forRoot(const QString &rootPath)
+{
+    QMutexLocker locker(&s_registryMutex);
+    std::shared_ptr<PathResolver> &slot = s_resolvers[rootPath];
+    if (!slot) {
+        slot = std::make_shared<PathResolver>(rootPath);
+    }
+    return slot;
+}
+
+PathResolver::PathResolver(const QString &rootPath, bool kernelResolve)
+    : m_rootPath(rootPath)
+    , m_canonicalRoot(QFileInfo(rootPath).canonicalFilePath())
+    , m_rootFd(-1)
+    , m_openat2(false)
+{
+    if (m_canonicalRoot.isEmpty()) {
+        m_canonicalRoot = QDir::cleanPath(rootPath);
+    }
+
+#ifdef HAVE_OPENAT2
+    if (kernelResolve) {
+        m_rootFd = ::open(QFile::encodeName(rootPath).constData(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        m_openat2 = m_rootFd >= 0;
+    }
+#else
+    Q_UNUSED(kernelResolve)
+#endif
+}
+
+PathResolver::~PathResolver()
+{
+#ifdef HAVE_OPENAT2
+    if (m_rootFd >= 0) {
+        ::close(m_rootFd);
+    }
+#endif
+}
+
+bool PathResolver::normalize(const QString &relativePath, QStringList &parts)
+{
+    // ".." is left for the kernel to resolve, but may never climb above the root on
+    // paper either, since QDir::mkpath and friends clean paths before using them
+    parts.clear();
+    int depth = 0;
+    const QStringList segments = relativePath.split('/', Qt::SkipEmptyParts);
+    for (const QString &segment : segments) {
+        if (segment == ".") {
+            continue;
+        }
+        depth += segment == ".." ? -1 : 1;
+        if (depth < 0) {
+            return false;
+        }
+        parts.append(segment);
+    }
+    return true;
+}
+
+bool PathResolver::isBeneath(const QString &relativePath)
+{
+    QStringList parts;
+    if (!normalize(relativePath, parts)) {
+        return false;
+    }
+    if (parts.isEmpty()) {
+        return true;
+    }
+
+    // A single syscall walks the whole path, there is nothing worth remembering
+    std::optional<bool> beneath = resolveBeneath(parts);
+    if (beneath) {
+        return *beneath;
+    }
+    return resolveFallback(parts);
+}
+
+QStringList PathResolver::collapse(const QStringList &parts)
+{
+    QStringList collapsed;
+    for (const QString &part : parts) {
+        if (part == "..") {
+            collapsed.removeLast();
+        } else {
+            collapsed.append(part);
+        }
+    }
+    return collapsed;
+}
+
+std::optional<int> PathResolver::open(const QString &relativePath, int flags, int mode)
+{
+    QStringList parts;
+    if (!normalize(relativePath, parts)) {
+        return -1;
+    }
+    return openBeneath(collapse(parts), flags, mode);
+}
+
+std::optional<int> PathResolver::openParent(const QString &relativePath, QString &name)
+{
+#ifdef HAVE_OPENAT2
+    QStringList parts;
+    if (!normalize(relativePath, parts)) {
+        return -1;
+    }
+
+    // The root itself has no folder holding it
+    parts = collapse(parts);
+    if (parts.isEmpty()) {
+        return -1;
+    }
+
+    name = parts.takeLast();
+    return openBeneath(parts, O_PATH | O_DIRECTORY, 0);
+#else
+    Q_UNUSED(relativePath)
+    Q_UNUSED(name)
+    return std::nullopt;
+#endif
+}
+
+void PathResolver::invalidate(const QString &relativePath)
+{
+    QStringList parts;
+    normalize(relativePath, parts);
+    QString key = parts.join('/');
+
+    QMutexLocker locker(&m_cacheMutex);
+    if (key.isEmpty()) {
+        m_cache.clear();
+        return;
+    }
+
+    QString prefix = key + '/';
+    for (auto it = m_cache.begin(); it != m_cache.end();) {
+        if (it.key() == key || it.key().startsWith(prefix)) {
+            it = m_cache.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::optional<bool> PathResolver::resolveBeneath(const QStringList &parts)
+{
+#ifdef HAVE_OPENAT2
+    if (m_openat2) {
+        struct open_how how;
+        std::memset(&how, 0, sizeof(how));
+        how.flags = O_PATH | O_CLOEXEC;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+        // Whatever does not exist yet is judged by the part of the path that does
+        for (qsizetype count = parts.size(); count > 0; --count) {
+            QByteArray path = QFile::encodeName(parts.mid(0, count).join('/'));
+            int fd = int(::syscall(SYS_openat2, m_rootFd, path.constData(), &how, sizeof(how)));
+            if (fd >= 0) {
+                ::close(fd);
+                return true;
+            }
+
+            if (errno == ENOENT || errno == ENOTDIR) {
+                continue;
+            }
+            if (errno == ENOSYS) {
+                // Built against newer headers than the running kernel
+                m_openat2 = false;
+            }
+            if (errno == ENOSYS || errno == EAGAIN) {
+                return std::nullopt;
+            }
+
+            // EXDEV when a link or ".." leads out of the root
+            return false;
+        }
+        return true;
+    }
+#else
+    Q_UNUSED(parts)
+#endif
+    return std::nullopt;
+}
+
+std::optional<int> PathResolver::openBeneath(const QStringList &parts, int flags, int mode)
+{
+#ifdef HAVE_OPENAT2
+    if (m_openat2) {
+        struct open_how how;
+        std::memset(&how, 0, sizeof(how));
+        how.flags = flags | O_CLOEXEC;
+        how.mode = (flags & O_CREAT) ? mode : 0;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+        QByteArray path = parts.isEmpty() ? QByteArray(".") : QFile::encodeName(parts.join('/'));
+        int fd = int(::syscall(SYS_openat2, m_rootFd, path.constData(), &how, sizeof(how)));
+        if (fd < 0 && errno == ENOSYS) {
+            m_openat2 = false;
+            return std::nullopt;
+        }
+        if (fd < 0 && errno == EAGAIN) {
+            return std::nullopt;
+        }
+        return fd;
+    }
+#else
+    Q_UNUSED(parts)
+    Q_UNUSED(flags)
+    Q_UNUSED(mode)
+#endif
+    return std::nullopt;
+}
+
+bool PathResolver::resolveFallback(const QStringList &parts)
+{
+    QStringList folderParts = parts.mid(0, parts.size() - 1);
+    QString folderKey = folderParts.join('/');
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    bool known = folderParts.isEmpty();
+    if (!known) {
+        QMutexLocker locker(&m_cacheMutex);
+        auto it = m_cache.constFind(folderKey);
+        known = it != m_cache.constEnd() && it.value() > now;
+    }
+
+    if (!known) {
+        if (!resolveCanonical(folderParts)) {
+            return false;
+        }
+
+        // Only folders that exist, a missing one was judged on paper
+        QFileInfo folder(m_rootPath + '/' + folderKey);
+        if (folder.isDir() && !folder.isSymLink()) {
+            QMutexLocker locker(&m_cacheMutex);
+            if (m_cache.size() >= CACHE_SIZE) {
+                m_cache.clear();
+            }
+            m_cache.insert(folderKey, now + CACHE_TTL_MS);
+        }
+    }
+
+    // The last component is what the caller is about to use, it is never taken from the cache
+    QFileInfo leaf(m_rootPath + '/' + parts.join('/'));
+    if (parts.last() == ".." || leaf.isSymLink()) {
+        return resolveCanonical(parts);
+    }
+    return true;
+}
+
+bool PathResolver::resolveCanonical(const QStringList &parts) const
+{
+    QString absPath = m_rootPath + '/' + parts.join('/');
+    QString canonicalPath = QFileInfo(absPath).canonicalFilePath();
+
+    QString root = m_canonicalRoot;
+    if (canonicalPath.isEmpty()) {
+        canonicalPath = QDir::cleanPath(absPath);
+        root = QDir::cleanPath(m_rootPath);
+    }
+
+    return canonicalPath == root || canonicalPath.startsWith(root + '/');
+}
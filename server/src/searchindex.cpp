@@ -0,0 +1,226 @@
+#include "searchindex.h"
+#include <QSet>
+#include <algorithm>
+
+// Postings of removed names are only dropped once they are this many, and half of all
+static const qint64 MIN_COMPACT_STALE = 4096;
+
+SearchIndex::Matcher::Matcher(const QString &pattern)
+    : m_pattern(pattern)
+    , m_wildcard(pattern.contains('*') || pattern.contains('?'))
+{
+    if (!m_wildcard) {
+        m_trigrams = trigramsOf(pattern);
+        return;
+    }
+
+    QString regexPattern = QRegularExpression::escape(pattern);
+    regexPattern.replace("\\*", ".*");
+    regexPattern.replace("\\?", ".");
+    m_regex = QRegularExpression("^" + regexPattern + "$", QRegularExpression::CaseInsensitiveOption);
+
+    // Only the literal runs between wildcards say anything about the name
+    QSet<quint64> trigrams;
+    static const QRegularExpression wildcards("[*?]");
+    const QStringList runs = pattern.split(wildcards, Qt::SkipEmptyParts);
+    for (const QString &run : runs) {
+        const QList<quint64> runTrigrams = trigramsOf(run);
+        for (quint64 trigram : runTrigrams) {
+            trigrams.insert(trigram);
+        }
+    }
+    m_trigrams = trigrams.values();
+}
+
+bool SearchIndex::Matcher::matches(const QString &name) const
+{
+    if (m_wildcard) {
+        return m_regex.match(name).hasMatch();
+    }
+    return name.contains(m_pattern, Qt::CaseInsensitive);
+}
+
+SearchIndex::SearchIndex()
+    : m_slots(1)
+    , m_postingCount(0)
+    , m_staleCount(0)
+{
+}
+
+QList<quint64> SearchIndex::trigramsOf(const QString &text)
+{
+    QString folded = text.toCaseFolded();
+
+    QList<quint64> trigrams;
+    for (qsizetype i = 0; i + 3 <= folded.size(); ++i) {
+        quint64 trigram = (quint64(folded[i].unicode()) << 32)
+                          | (quint64(folded[i + 1].unicode()) << 16)
+                          | quint64(folded[i + 2].unicode());
+        if (!trigrams.contains(trigram)) {
+            trigrams.append(trigram);
+        }
+    }
+    return trigrams;
+}
+
+quint32 SearchIndex::add(quint32 parent, const QString &name)
+{
+    // Removed slots stay empty until the next scan rebuilds the index with a new epoch,
+    // reusing them would let a cursor skip or repeat entries
+    quint32 id = quint32(m_slots.size());
+    m_slots.emplace_back();
+
+    Slot &slot = m_slots[id];
+    slot.name = name;
+    slot.parent = parent;
+    slot.live = true;
+    indexName(id, name, QString());
+    return id;
+}
+
+void SearchIndex::remove(quint32 id)
+{
+    if (!isLive(id)) {
+        return;
+    }
+
+    Slot &slot = m_slots[id];
+    m_staleCount += trigramsOf(slot.name).size();
+    slot.live = false;
+    slot.name.clear();
+
+    if (m_staleCount >= MIN_COMPACT_STALE && m_staleCount * 2 > m_postingCount) {
+        compact();
+    }
+}
+
+void SearchIndex::move(quint32 id, quint32 parent, const QString &name)
+{
+    if (!isLive(id)) {
+        return;
+    }
+
+    Slot &slot = m_slots[id];
+    slot.parent = parent;
+    if (slot.name != name) {
+        indexName(id, name, slot.name);
+        slot.name = name;
+    }
+}
+
+bool SearchIndex::isLive(quint32 id) const
+{
+    return id != NONE && id < m_slots.size() && m_slots[id].live;
+}
+
+QString SearchIndex::path(quint32 id) const
+{
+    // The root is the only slot without a parent and is not part of any path
+    QStringList parts;
+    for (quint32 current = id; isLive(current) && m_slots[current].parent != NONE; current = m_slots[current].parent) {
+        parts.prepend(m_slots[current].name);
+    }
+    return parts.join('/');
+}
+
+bool SearchIndex::isBelow(quint32 id, quint32 ancestor) const
+{
+    for (quint32 current = m_slots[id].parent; current != NONE; current = m_slots[current].parent) {
+        if (current == ancestor) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QList<quint32> SearchIndex::find(const Matcher &matcher, quint32 scope, quint32 after, int limit, bool &more) const
+{
+    QList<quint32> ids;
+    more = false;
+
+    auto visit = [&](quint32 id) {
+        const Slot &slot = m_slots[id];
+        if (!slot.live || !matcher.matches(slot.name) || (scope != NONE && !isBelow(id, scope))) {
+            return true;
+        }
+        if (ids.size() >= limit) {
+            more = true;
+            return false;
+        }
+        ids.append(id);
+        return true;
+    };
+
+    const QList<quint64> &trigrams = matcher.trigrams();
+    if (trigrams.isEmpty()) {
+        // Too short to narrow anything down, every name is looked at
+        for (quint32 id = after + 1; id < m_slots.size(); ++id) {
+            if (!visit(id)) {
+                break;
+            }
+        }
+        return ids;
+    }
+
+    const std::vector<quint32> *rarest = nullptr;
+    for (quint64 trigram : trigrams) {
+        auto it = m_postings.constFind(trigram);
+        if (it == m_postings.constEnd()) {
+            // No name has it at all
+            return ids;
+        }
+        if (!rarest || it->size() < rarest->size()) {
+            rarest = &it.value();
+        }
+    }
+
+    std::vector<quint32> candidates;
+    candidates.reserve(rarest->size());
+    for (quint32 id : *rarest) {
+        if (id > after) {
+            candidates.push_back(id);
+        }
+    }
+    // A name renamed back and forth is listed once per time it gained the trigram
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    for (quint32 id : candidates) {
+        if (!visit(id)) {
+            break;
+        }
+    }
+    return ids;
+}
+
+void SearchIndex::indexName(quint32 id, const QString &name, const QString &previous)
+{
+    const QList<quint64> trigrams = trigramsOf(name);
+    const QList<quint64> previousTrigrams = trigramsOf(previous);
+
+    // A renamed entry keeps the postings both names share, the others go stale
+    for (quint64 trigram : trigrams) {
+        if (!previousTrigrams.contains(trigram)) {
+            m_postings[trigram].push_back(id);
+            ++m_postingCount;
+        }
+    }
+    for (quint64 trigram : previousTrigrams) {
+        if (!trigrams.contains(trigram)) {
+            ++m_staleCount;
+        }
+    }
+}
+
+void SearchIndex::compact()
+{
+    m_postings.clear();
+    m_postingCount = 0;
+    m_staleCount = 0;
+
+    for (quint32 id = 1; id < m_slots.size(); ++id) {
+        if (m_slots[id].live) {
+            indexName(id, m_slots[id].name, QString());
+        }
+    }
+}
@@ -0,0 +1,166 @@
+#include "tarstreamwriter.h"
+#include "archivesink.h"
+#include <QFile>
+#include <cstring>
+
+static const qint64 BLOCK_SIZE = 512;
+static const qint64 READ_CHUNK_SIZE = 1024 * 1024;
+static const qint64 MAX_USTAR_NAME = 100;
+
+// Eleven octal digits, the most a ustar size field holds
+static const qint64 MAX_USTAR_SIZE = 077777777777LL;
+
+static void writeOctal(char *field, int width, qint64 value)
+{
+    // Zero padded and NUL terminated, the way POSIX tar writes numeric fields
+    QByteArray digits = QByteArray::number(qMax<qint64>(0, value), 8).rightJustified(width - 1, '0');
+    std::memcpy(field, digits.constData(), qMin<qint64>(digits.size(), width - 1));
+}
+
+static QByteArray paxRecord(const QByteArray &key, const QByteArray &value)
+{
+    // The length at the start counts the whole record, its own digits included
+    QByteArray payload = " " + key + "=" + value + "\n";
+    qint64 length = payload.size() + QByteArray::number(payload.size()).size();
+    if (QByteArray::number(length).size() + payload.size() != length) {
+        ++length;
+    }
+    return QByteArray::number(length) + payload;
+}
+
+TarStreamWriter::TarStreamWriter(ArchiveSink *sink)
+    : m_sink(sink)
+{
+}
+
+qint64 TarStreamWriter::padding(qint64 size)
+{
+    return (BLOCK_SIZE - size % BLOCK_SIZE) % BLOCK_SIZE;
+}
+
+qint64 TarStreamWriter::archiveSize(const QList<ZipEntry> &entries)
+{
+    // Mirrors what addEntry() and finish() write
+    qint64 size = 0;
+    for (const ZipEntry &entry : entries) {
+        qint64 paxSize = paxRecords(entry).size();
+        if (paxSize > 0) {
+            size += BLOCK_SIZE + paxSize + padding(paxSize);
+        }
+        size += BLOCK_SIZE + entry.size + padding(entry.size);
+    }
+    return size + 2 * BLOCK_SIZE;
+}
+
+QByteArray TarStreamWriter::header(const QByteArray &name, qint64 size, quint32 mode, qint64 mtime, char type)
+{
+    QByteArray block(BLOCK_SIZE, '\0');
+    char *h = block.data();
+
+    std::memcpy(h, name.constData(), qMin<qint64>(name.size(), MAX_USTAR_NAME));
+    writeOctal(h + 100, 8, mode);
+    writeOctal(h + 108, 8, 0);
+    writeOctal(h + 116, 8, 0);
+    writeOctal(h + 124, 12, size);
+    writeOctal(h + 136, 12, mtime);
+    h[156] = type;
+    std::memcpy(h + 257, "ustar", 6);
+    std::memcpy(h + 263, "00", 2);
+
+    // The checksum is computed with its own field filled with spaces
+    std::memset(h + 148, ' ', 8);
+    quint32 checksum = 0;
+    for (qint64 i = 0; i < BLOCK_SIZE; ++i) {
+        checksum += uchar(h[i]);
+    }
+    writeOctal(h + 148, 7, checksum);
+    h[155] = ' ';
+
+    return block;
+}
+
+QByteArray TarStreamWriter::paxRecords(const ZipEntry &entry)
+{
+    QByteArray records;
+
+    QByteArray name = entry.name.toUtf8();
+    if (name.size() > MAX_USTAR_NAME) {
+        records += paxRecord("path", name);
+    }
+
+    if (entry.size > MAX_USTAR_SIZE) {
+        records += paxRecord("size", QByteArray::number(entry.size));
+    }
+
+    return records;
+}
+
+bool TarStreamWriter::addEntry(const ZipEntry &entry)
+{
+    QFile file(entry.filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return fail("Failed to open " + entry.name);
+    }
+
+    qint64 mtime = entry.modified.toSecsSinceEpoch();
+
+    QByteArray pax = paxRecords(entry);
+    if (!pax.isEmpty()) {
+        QByteArray paxEntry = header("././@PaxHeader", pax.size(), 0644, mtime, 'x');
+        paxEntry += pax;
+        paxEntry += QByteArray(padding(pax.size()), '\0');
+        if (!output(paxEntry)) {
+            return false;
+        }
+    }
+
+    quint32 mode = ZipStreamWriter::unixMode(entry.permissions) & 07777;
+    qint64 headerSize = entry.size > MAX_USTAR_SIZE ? 0 : entry.size;
+    if (!output(header(entry.name.toUtf8(), headerSize, mode, mtime, '0'))) {
+        return false;
+    }
+
+    // The header already holds the listed size, a file that grew since is cut there
+    qint64 remaining = entry.size;
+    while (remaining > 0) {
+        if (m_sink->isCancelled()) {
+            return fail("Cancelled");
+        }
+
+        QByteArray chunk = file.read(qMin(remaining, READ_CHUNK_SIZE));
+        if (chunk.isEmpty()) {
+            return fail(entry.name + " changed while it was being archived");
+        }
+
+        if (m_progressCallback) {
+            m_progressCallback(chunk.size());
+        }
+
+        remaining -= chunk.size();
+        if (!output(chunk)) {
+            return false;
+        }
+    }
+
+    return output(QByteArray(padding(entry.size), '\0'));
+}
+
+bool TarStreamWriter::finish()
+{
+    // Two empty blocks mark the end of the archive
+    return output(QByteArray(2 * BLOCK_SIZE, '\0'));
+}
+
+bool TarStreamWriter::output(const QByteArray &data)
+{
+    if (!m_sink->write(data)) {
+        return fail("Cancelled");
+    }
+    return true;
+}
+
+bool TarStreamWriter::fail(const QString &error)
+{
+    m_error = error;
+    return false;
+}
@@ -0,0 +1,142 @@
+#include "uploadsessionmanager.h"
+#include "config.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDirIterator>
+#include <QThreadPool>
+#include <QUuid>
+#include <QDebug>
+
+static const QString PART_PREFIX = QStringLiteral(".odzn-");
+static const QString PART_SUFFIX = QStringLiteral(".part");
+
+UploadSessionManager::UploadSessionManager()
+    : m_gcTimer(nullptr)
+{
+}
+
+UploadSessionManager& UploadSessionManager::instance()
+{
+    static UploadSessionManager instance;
+    return instance;
+}
+
+void UploadSessionManager::startGarbageCollection()
+{
+    if (m_gcTimer) {
+        return;
+    }
+
+    m_gcTimer = new QTimer(this);
+    connect(m_gcTimer, &QTimer::timeout, this, &UploadSessionManager::collectGarbage);
+    m_gcTimer->start(10 * 60 * 1000);
+
+    // Sessions do not survive a restart, so every part file found now is left over.
+    // Walking the whole storage can take a while, keep it off the main thread
+    QString rootPath = Config::instance().storageRoot();
+    QThreadPool::globalInstance()->start([this, rootPath]() {
+        removeOrphanParts(rootPath);
+    });
+}
+
+bool UploadSessionManager::isPartFile(const QString &fileName)
+{
+    return fileName.startsWith(PART_PREFIX) && fileName.endsWith(PART_SUFFIX);
+}
+
+UploadSession UploadSessionManager::create(const QString &username, const QString &path, const QString &targetPath, qint64 size,
+                                            std::shared_ptr<MetadataIndex::Reservation> reservation)
+{
+    UploadSession session;
+    session.id = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    session.username = username;
+    session.path = path;
+    session.targetPath = targetPath;
+    // Same directory as the destination so the final rename is atomic and never crosses filesystems
+    session.partPath = QFileInfo(targetPath).dir().filePath(PART_PREFIX + session.id + PART_SUFFIX);
+    session.size = size;
+    session.lastActivity = QDateTime::currentDateTime();
+    session.attached = true;
+    session.reservation = std::move(reservation);
+
+    QMutexLocker locker(&m_mutex);
+    m_sessions.insert(session.id, session);
+    return session;
+}
+
+std::optional<UploadSession> UploadSessionManager::attach(const QString &id, const QString &username)
+{
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_sessions.find(id);
+    // Same comparison as Config::getUser, logins ignore case
+    if (it == m_sessions.end() || it->username.toLower() != username.toLower() || it->attached) {
+        return std::nullopt;
+    }
+
+    it->attached = true;
+    it->lastActivity = QDateTime::currentDateTime();
+    return *it;
+}
+
+void UploadSessionManager::detach(const QString &id)
+{
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_sessions.find(id);
+    if (it != m_sessions.end()) {
+        it->attached = false;
+        it->lastActivity = QDateTime::currentDateTime();
+    }
+}
+
+void UploadSessionManager::finish(const QString &id)
+{
+    QMutexLocker locker(&m_mutex);
+    m_sessions.remove(id);
+}
+
+void UploadSessionManager::discard(const QString &id)
+{
+    QMutexLocker locker(&m_mutex);
+
+    UploadSession session = m_sessions.take(id);
+    if (!session.partPath.isEmpty()) {
+        QFile::remove(session.partPath);
+    }
+}
+
+void UploadSessionManager::collectGarbage()
+{
+    int timeout = Config::instance().getUploadSessionTimeout();
+    QDateTime cutoff = QDateTime::currentDateTime().addSecs(-timeout);
+
+    QMutexLocker locker(&m_mutex);
+
+    for (auto it = m_sessions.begin(); it != m_sessions.end();) {
+        if (!it->attached && it->lastActivity < cutoff) {
+            qInfo() << "Discarding stale upload of" << it->path << "for" << it->username;
+            QFile::remove(it->partPath);
+            it = m_sessions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void UploadSessionManager::removeOrphanParts(const QString &rootPath)
+{
+    QDirIterator it(rootPath, QStringList() << PART_PREFIX + "*" + PART_SUFFIX,
+                    QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QString partPath = it.next();
+        QString id = it.fileName().mid(PART_PREFIX.size()).chopped(PART_SUFFIX.size());
+
+        QMutexLocker locker(&m_mutex);
+        if (!m_sessions.contains(id)) {
+            qInfo() << "Removing leftover upload" << partPath;
+            QFile::remove(partPath);
+        }
+    }
+}
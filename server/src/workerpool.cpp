@@ -0,0 +1,164 @@
+#include "workerpool.h"
+#include "clientconnection.h"
+#include "httpserver.h"
+#include "diskwriter.h"
+#include "archivejobmanager.h"
+#include "metadataindex.h"
+#include <QTcpSocket>
+#include <QCoreApplication>
+#include <QDebug>
+
+// Only checks what is due, the reconcile and save intervals are kept by each index
+static const int INDEX_MAINTAIN_INTERVAL_MS = 30 * 1000;
+
+ConnectionWorker::ConnectionWorker(HttpServer *httpServer, QObject *parent)
+    : QObject(parent)
+    , m_httpServer(httpServer)
+    , m_server(new QWebSocketServer(QStringLiteral("OdznDrive Server"),
+                                    QWebSocketServer::NonSecureMode, this))
+{
+    connect(m_server, &QWebSocketServer::newConnection, this, &ConnectionWorker::onNewConnection);
+}
+
+void ConnectionWorker::addConnection(qintptr socketDescriptor)
+{
+    // The slot released the reservation taken by WorkerPool, the connection
+    // is counted again once the websocket handshake completed
+    m_load.deref();
+
+    QTcpSocket *tcpSocket = new QTcpSocket();
+    if (!tcpSocket->setSocketDescriptor(socketDescriptor)) {
+        qWarning() << "Failed to adopt socket descriptor:" << tcpSocket->errorString();
+        delete tcpSocket;
+        return;
+    }
+
+    m_server->handleConnection(tcpSocket);
+}
+
+void ConnectionWorker::onNewConnection()
+{
+    while (m_server->hasPendingConnections()) {
+        QWebSocket *socket = m_server->nextPendingConnection();
+
+        qInfo() << "New client connected:" << socket->peerAddress().toString()
+                << "on worker" << QThread::currentThread()->objectName();
+
+        ClientConnection *client = new ClientConnection(socket, nullptr, this);
+        client->setHttpServer(m_httpServer);
+        connect(client, &ClientConnection::disconnected, this, &ConnectionWorker::onClientDisconnected);
+
+        m_clients.append(client);
+        m_load.ref();
+    }
+}
+
+void ConnectionWorker::onClientDisconnected()
+{
+    ClientConnection *client = qobject_cast<ClientConnection*>(sender());
+    if (client && m_clients.removeAll(client) > 0) {
+        qInfo() << "Client disconnected";
+        m_load.deref();
+        client->deleteLater();
+    }
+}
+
+void ConnectionWorker::closeAll()
+{
+    m_server->close();
+
+    qDeleteAll(m_clients);
+    m_clients.clear();
+    m_load.storeRelaxed(0);
+
+    // The event loop is about to stop, flush the sockets scheduled for deletion
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+}
+
+WorkerPool::WorkerPool(HttpServer *httpServer, QObject *parent)
+    : QTcpServer(parent)
+    , m_httpServer(httpServer)
+    , m_maintainTimer(new QTimer(this))
+{
+    connect(m_maintainTimer, &QTimer::timeout, this, []() {
+        MetadataIndex::maintainAll();
+    });
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::start(int threadCount)
+{
+    if (!m_workers.isEmpty()) {
+        return;
+    }
+
+    for (int i = 0; i < threadCount; ++i) {
+        QThread *thread = new QThread(this);
+        thread->setObjectName(QString("worker-%1").arg(i));
+
+        ConnectionWorker *worker = new ConnectionWorker(m_httpServer);
+        worker->moveToThread(thread);
+        thread->start();
+
+        m_threads.append(thread);
+        m_workers.append(worker);
+    }
+
+    m_maintainTimer->start(INDEX_MAINTAIN_INTERVAL_MS);
+
+    qInfo() << "Started" << threadCount << "connection worker thread(s)";
+}
+
+void WorkerPool::stop()
+{
+    close();
+    m_maintainTimer->stop();
+
+    for (int i = 0; i < m_workers.size(); ++i) {
+        QMetaObject::invokeMethod(m_workers[i], &ConnectionWorker::closeAll, Qt::BlockingQueuedConnection);
+        m_threads[i]->quit();
+        m_threads[i]->wait();
+        delete m_workers[i];
+    }
+
+    m_workers.clear();
+    qDeleteAll(m_threads);
+    m_threads.clear();
+
+    ArchiveJobManager::instance().shutdown();
+    DiskWriter::shutdown();
+    MetadataIndex::saveAll();
+}
+
+void WorkerPool::incomingConnection(qintptr socketDescriptor)
+{
+    ConnectionWorker *worker = leastLoadedWorker();
+    if (!worker) {
+        QTcpSocket socket;
+        socket.setSocketDescriptor(socketDescriptor);
+        socket.abort();
+        return;
+    }
+
+    // Count the socket right away so a burst of connections is spread out
+    // before the worker had a chance to process them
+    worker->reserve();
+    QMetaObject::invokeMethod(worker, [worker, socketDescriptor]() {
+        worker->addConnection(socketDescriptor);
+    }, Qt::QueuedConnection);
+}
+
+ConnectionWorker* WorkerPool::leastLoadedWorker() const
+{
+    ConnectionWorker *best = nullptr;
+    for (ConnectionWorker *worker : m_workers) {
+        if (!best || worker->load() < best->load()) {
+            best = worker;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,696 @@
+#include "zipstreamwriter.h"
+#include "archivesink.h"
+#include "uploadsessionmanager.h"
+#include "config.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QPromise>
+#include <QThreadPool>
+#include <QtEndian>
+#include <cmath>
+#include <memory>
+#include <zlib.h>
+
+static const quint32 LOCAL_HEADER_SIGNATURE = 0x04034b50;
+static const quint32 DATA_DESCRIPTOR_SIGNATURE = 0x08074b50;
+static const quint32 CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+static const quint32 ZIP64_END_SIGNATURE = 0x06064b50;
+static const quint32 ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+static const quint32 END_SIGNATURE = 0x06054b50;
+
+static const int LOCAL_HEADER_SIZE = 30;
+static const int CENTRAL_HEADER_SIZE = 46;
+static const int ZIP64_END_SIZE = 56;
+static const int ZIP64_LOCATOR_SIZE = 20;
+static const int END_SIZE = 22;
+static const int ZIP64_LOCAL_EXTRA_SIZE = 20;
+
+// Data descriptor (bit 3) and UTF-8 names (bit 11)
+static const quint16 ENTRY_FLAGS = 0x0808;
+static const quint16 METHOD_STORE = 0;
+static const quint16 METHOD_DEFLATE = 8;
+static const quint16 VERSION_DEFAULT = 20;
+static const quint16 VERSION_ZIP64 = 45;
+// Made by unix, so readers apply the permissions in the external attributes
+static const quint16 VERSION_MADE_BY = (3 << 8) | VERSION_ZIP64;
+
+static const qint64 MAX_32 = 0xFFFFFFFF;
+static const qint64 MAX_16 = 0xFFFF;
+static const qint64 READ_CHUNK_SIZE = 1024 * 1024;
+static const qint64 BLOCK_SIZE = 1024 * 1024;
+static const qint64 DICTIONARY_SIZE = 32 * 1024;
+static const qint64 PROBE_SIZE = 64 * 1024;
+
+// Random data sits at 8 bits per byte, text and most binaries well below 7
+static const double COMPRESSED_ENTROPY = 7.5;
+
+static const QStringList COMPRESSED_EXTENSIONS = {
+    "jpg", "jpeg", "png", "gif", "webp", "heic", "heif", "avif", "jxl",
+    "mp4", "m4v", "mkv", "webm", "mov", "avi", "wmv",
+    "mp3", "m4a", "aac", "ogg", "opus", "flac", "wma",
+    "zip", "7z", "rar", "gz", "tgz", "bz2", "xz", "zst", "lz4", "cab",
+    "jar", "apk", "docx", "xlsx", "pptx", "odt", "ods", "odp", "epub"
+};
+
+static void append16(QByteArray &out, quint16 value)
+{
+    char buffer[2];
+    qToLittleEndian(value, buffer);
+    out.append(buffer, 2);
+}
+
+static void append32(QByteArray &out, quint32 value)
+{
+    char buffer[4];
+    qToLittleEndian(value, buffer);
+    out.append(buffer, 4);
+}
+
+static void append64(QByteArray &out, quint64 value)
+{
+    char buffer[8];
+    qToLittleEndian(value, buffer);
+    out.append(buffer, 8);
+}
+
+static void toDosDateTime(const QDateTime &dateTime, quint16 &dosTime, quint16 &dosDate)
+{
+    QDateTime local = dateTime.toLocalTime();
+    if (!local.isValid() || local.date().year() < 1980) {
+        dosTime = 0;
+        dosDate = (1 << 5) | 1;
+        return;
+    }
+
+    QDate date = local.date();
+    QTime time = local.time();
+    dosTime = quint16((time.hour() << 11) | (time.minute() << 5) | (time.second() / 2));
+    dosDate = quint16(((date.year() - 1980) << 9) | (date.month() << 5) | date.day());
+}
+
+quint32 ZipStreamWriter::unixMode(QFile::Permissions permissions)
+{
+    quint32 mode = 0100000;
+    if (permissions & QFile::ReadOwner) mode |= 0400;
+    if (permissions & QFile::WriteOwner) mode |= 0200;
+    if (permissions & QFile::ExeOwner) mode |= 0100;
+    if (permissions & QFile::ReadGroup) mode |= 0040;
+    if (permissions & QFile::WriteGroup) mode |= 0020;
+    if (permissions & QFile::ExeGroup) mode |= 0010;
+    if (permissions & QFile::ReadOther) mode |= 0004;
+    if (permissions & QFile::WriteOther) mode |= 0002;
+    if (permissions & QFile::ExeOther) mode |= 0001;
+    return mode;
+}
+
+ZipStreamWriter::ZipStreamWriter(ArchiveSink *sink, int compressionLevel)
+    : m_sink(sink)
+    , m_compressionLevel(qBound(0, compressionLevel, 9))
+    , m_offset(0)
+    , m_blocksInFlight(0)
+    , m_maxBlocksInFlight(compressionPool()->maxThreadCount() * 2)
+{
+}
+
+ZipStreamWriter::~ZipStreamWriter()
+{
+    // Blocks of an aborted archive that did not start yet are skipped by the pool
+    for (PendingOutput &pending : m_pending) {
+        if (pending.kind == PendingOutput::Block) {
+            pending.block.cancel();
+        }
+    }
+}
+
+QThreadPool* ZipStreamWriter::compressionPool()
+{
+    // Shared by every archive, sized to the cores rather than to the number of downloads
+    static QThreadPool *pool = []() {
+        QThreadPool *pool = new QThreadPool();
+        pool->setMaxThreadCount(Config::instance().getCompressionThreadCount());
+        return pool;
+    }();
+    return pool;
+}
+
+void ZipStreamWriter::collectEntries(const QString &absPath, const QString &baseDir, QList<ZipEntry> &entries)
+{
+    QFileInfo info(absPath);
+
+    if (info.isFile()) {
+        QString name = absPath.mid(baseDir.length());
+        if (name.startsWith('/') || name.startsWith('\\')) {
+            name = name.mid(1);
+        }
+
+        ZipEntry entry;
+        entry.filePath = absPath;
+        entry.name = name;
+        entry.size = info.size();
+        entry.modified = info.lastModified();
+        entry.permissions = info.permissions();
+        entries.append(entry);
+        return;
+    }
+
+    QDir dir(absPath);
+    const QFileInfoList children = dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot);
+    for (const QFileInfo &child : children) {
+        if (UploadSessionManager::isPartFile(child.fileName())) {
+            continue;
+        }
+        collectEntries(child.absoluteFilePath(), baseDir, entries);
+    }
+}
+
+bool ZipStreamWriter::needsZip64(qint64 size, int compressionLevel)
+{
+    if (compressionLevel == 0) {
+        return size >= MAX_32;
+    }
+
+    // Whether the deflated size fits is only known afterwards, go by deflate's worst case
+    qint64 bound = size + (size >> 12) + (size >> 14) + (size >> 25) + 13;
+    return bound >= MAX_32;
+}
+
+int ZipStreamWriter::centralExtraSize(bool zip64, qint64 offset)
+{
+    int fields = (zip64 ? 2 : 0) + (offset >= MAX_32 ? 1 : 0);
+    return fields > 0 ? 4 + fields * 8 : 0;
+}
+
+bool ZipStreamWriter::needsZip64End(qint64 entryCount, qint64 centralSize, qint64 centralOffset)
+{
+    return entryCount >= MAX_16 || centralSize >= MAX_32 || centralOffset >= MAX_32;
+}
+
+qint64 ZipStreamWriter::storedArchiveSize(const QList<ZipEntry> &entries)
+{
+    // Mirrors the layout addEntry() and finish() produce at level 0
+    qint64 offset = 0;
+    qint64 centralSize = 0;
+
+    for (const ZipEntry &entry : entries) {
+        qint64 nameSize = entry.name.toUtf8().size();
+        bool zip64 = needsZip64(entry.size, 0);
+
+        centralSize += CENTRAL_HEADER_SIZE + nameSize + centralExtraSize(zip64, offset);
+        offset += LOCAL_HEADER_SIZE + nameSize + (zip64 ? ZIP64_LOCAL_EXTRA_SIZE : 0);
+        offset += entry.size;
+        offset += zip64 ? 24 : 16;
+    }
+
+    qint64 size = offset + centralSize + END_SIZE;
+    if (needsZip64End(entries.size(), centralSize, offset)) {
+        size += ZIP64_END_SIZE + ZIP64_LOCATOR_SIZE;
+    }
+    return size;
+}
+
+bool ZipStreamWriter::looksCompressed(const QString &name, const QByteArray &head)
+{
+    if (COMPRESSED_EXTENSIONS.contains(QFileInfo(name).suffix().toLower())) {
+        return true;
+    }
+
+    // Too little data to tell, and deflating it costs next to nothing
+    qint64 length = qMin<qint64>(head.size(), PROBE_SIZE);
+    if (length < 4096) {
+        return false;
+    }
+
+    qint64 counts[256] = {};
+    const uchar *data = reinterpret_cast<const uchar*>(head.constData());
+    for (qint64 i = 0; i < length; ++i) {
+        ++counts[data[i]];
+    }
+
+    double entropy = 0;
+    for (qint64 count : counts) {
+        if (count > 0) {
+            double p = double(count) / length;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy >= COMPRESSED_ENTROPY;
+}
+
+bool ZipStreamWriter::addEntry(const ZipEntry &entry)
+{
+    QFile file(entry.filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return fail("Failed to open " + entry.name);
+    }
+
+    CentralRecord record;
+    record.name = entry.name.toUtf8();
+    record.method = m_compressionLevel == 0 ? METHOD_STORE : METHOD_DEFLATE;
+    record.externalAttributes = unixMode(entry.permissions) << 16;
+    record.zip64 = needsZip64(entry.size, m_compressionLevel);
+    toDosDateTime(entry.modified, record.dosTime, record.dosDate);
+
+    if (record.method == METHOD_STORE) {
+        m_records.append(record);
+        CentralRecord &stored = m_records.last();
+        return writeHeader(stored) && writeStored(file, entry, stored) && writeDescriptor(stored);
+    }
+
+    // Unchanged files that were deflated before are copied as they are
+    DeflateBlobCache &blobCache = DeflateBlobCache::instance();
+    bool cacheable = blobCache.isEnabled() && entry.size >= DeflateBlobCache::MIN_ENTRY_SIZE;
+    if (cacheable) {
+        std::optional<DeflateBlobCache::Blob> blob = blobCache.lookup(entry, m_compressionLevel);
+        QFile blobFile(blob ? blob->filePath : QString());
+        if (blob && blobFile.open(QIODevice::ReadOnly) && blobFile.seek(DeflateBlobCache::HEADER_SIZE)) {
+            record.crc = blob->crc;
+            record.size = blob->size;
+            m_records.append(record);
+
+            ++m_stats.reusedEntries;
+            m_stats.reusedBytes += blob->size;
+            if (m_progressCallback) {
+                m_progressCallback(blob->size);
+            }
+            return queueCached(blobFile, m_records.size() - 1);
+        }
+    }
+
+    // The first block decides the method and is then queued like the others
+    QByteArray first = file.read(qMin(entry.size, BLOCK_SIZE));
+    if (looksCompressed(entry.name, first)) {
+        record.method = METHOD_STORE;
+        ++m_stats.storedEntries;
+        m_stats.storedBytes += entry.size;
+    }
+
+    m_records.append(record);
+    if (cacheable && record.method == METHOD_DEFLATE) {
+        m_blobWriters.insert(m_records.size() - 1, blobCache.create(entry, m_compressionLevel));
+    }
+    return queueBlocks(file, entry, m_records.size() - 1, first);
+}
+
+bool ZipStreamWriter::writeHeader(CentralRecord &record)
+{
+    record.offset = m_offset;
+
+    // CRC and sizes follow the data in the descriptor
+    QByteArray header;
+    append32(header, LOCAL_HEADER_SIGNATURE);
+    append16(header, record.zip64 ? VERSION_ZIP64 : VERSION_DEFAULT);
+    append16(header, ENTRY_FLAGS);
+    append16(header, record.method);
+    append16(header, record.dosTime);
+    append16(header, record.dosDate);
+    append32(header, 0);
+    append32(header, record.zip64 ? MAX_32 : 0);
+    append32(header, record.zip64 ? MAX_32 : 0);
+    append16(header, record.name.size());
+    append16(header, record.zip64 ? ZIP64_LOCAL_EXTRA_SIZE : 0);
+    header.append(record.name);
+    if (record.zip64) {
+        append16(header, 0x0001);
+        append16(header, 16);
+        append64(header, 0);
+        append64(header, 0);
+    }
+
+    return output(header);
+}
+
+bool ZipStreamWriter::writeDescriptor(const CentralRecord &record)
+{
+    QByteArray descriptor;
+    append32(descriptor, DATA_DESCRIPTOR_SIGNATURE);
+    append32(descriptor, record.crc);
+    if (record.zip64) {
+        append64(descriptor, record.compressedSize);
+        append64(descriptor, record.size);
+    } else {
+        append32(descriptor, record.compressedSize);
+        append32(descriptor, record.size);
+    }
+
+    return output(descriptor);
+}
+
+bool ZipStreamWriter::writeStored(QFile &file, const ZipEntry &entry, CentralRecord &record)
+{
+    // The announced archive size counts on every entry being exactly as large as listed
+    uLong crc = crc32(0, nullptr, 0);
+    qint64 remaining = entry.size;
+
+    while (remaining > 0) {
+        if (m_sink->isCancelled()) {
+            return fail("Cancelled");
+        }
+
+        QByteArray chunk = file.read(qMin(remaining, READ_CHUNK_SIZE));
+        if (chunk.isEmpty()) {
+            return fail(entry.name + " changed while it was being archived");
+        }
+
+        if (m_progressCallback) {
+            m_progressCallback(chunk.size());
+        }
+
+        crc = crc32(crc, reinterpret_cast<const Bytef*>(chunk.constData()), chunk.size());
+        remaining -= chunk.size();
+
+        if (!output(chunk)) {
+            return false;
+        }
+    }
+
+    record.crc = crc;
+    record.size = entry.size;
+    record.compressedSize = entry.size;
+    return true;
+}
+
+bool ZipStreamWriter::queueBlocks(QFile &file, const ZipEntry &entry, int recordIndex, QByteArray input)
+{
+    PendingOutput header;
+    header.kind = PendingOutput::Header;
+    header.record = recordIndex;
+    m_pending.enqueue(header);
+
+    // Sizes were decided from the listing, so a file that grew since is cut at its listed size.
+    // Reading stays on this thread, only the compression is spread over the pool.
+    // Stored entries go through the pool too, which keeps them in order and computes their CRC
+    int level = m_records[recordIndex].method == METHOD_STORE ? 0 : m_compressionLevel;
+    qint64 remaining = entry.size;
+    QByteArray dictionary;
+    bool last = false;
+
+    while (!last) {
+        if (m_sink->isCancelled()) {
+            return fail("Cancelled");
+        }
+
+        if (input.isNull()) {
+            input = file.read(qMin(remaining, BLOCK_SIZE));
+        }
+        remaining -= input.size();
+        last = remaining <= 0 || input.isEmpty();
+
+        if (m_progressCallback) {
+            m_progressCallback(input.size());
+        }
+
+        auto promise = std::make_shared<QPromise<CompressedBlock>>();
+        PendingOutput block;
+        block.kind = PendingOutput::Block;
+        block.record = recordIndex;
+        block.block = promise->future();
+        m_pending.enqueue(block);
+        ++m_blocksInFlight;
+
+        promise->start();
+        compressionPool()->start([promise, input, dictionary, last, level]() {
+            if (!promise->isCanceled()) {
+                promise->addResult(compressBlock(input, dictionary, last, level));
+            }
+            promise->finish();
+        });
+
+        if (level > 0) {
+            dictionary = input.right(DICTIONARY_SIZE);
+        }
+        input = QByteArray();
+
+        if (!flushPending(m_maxBlocksInFlight)) {
+            return false;
+        }
+    }
+
+    PendingOutput descriptor;
+    descriptor.kind = PendingOutput::Descriptor;
+    descriptor.record = recordIndex;
+    m_pending.enqueue(descriptor);
+    return true;
+}
+
+bool ZipStreamWriter::queueCached(QFile &blob, int recordIndex)
+{
+    PendingOutput header;
+    header.kind = PendingOutput::Header;
+    header.record = recordIndex;
+    m_pending.enqueue(header);
+
+    // CRC and size came with the blob, only the compressed size is counted on output
+    while (!blob.atEnd()) {
+        if (m_sink->isCancelled()) {
+            return fail("Cancelled");
+        }
+
+        QByteArray data = blob.read(BLOCK_SIZE);
+        if (data.isEmpty()) {
+            return fail("Failed to read cached data for " + QString::fromUtf8(m_records[recordIndex].name));
+        }
+
+        PendingOutput raw;
+        raw.kind = PendingOutput::Raw;
+        raw.record = recordIndex;
+        raw.raw = data;
+        m_pending.enqueue(raw);
+        ++m_blocksInFlight;
+
+        if (!flushPending(m_maxBlocksInFlight)) {
+            return false;
+        }
+    }
+
+    PendingOutput descriptor;
+    descriptor.kind = PendingOutput::Descriptor;
+    descriptor.record = recordIndex;
+    m_pending.enqueue(descriptor);
+    return true;
+}
+
+ZipStreamWriter::CompressedBlock ZipStreamWriter::compressBlock(const QByteArray &input, const QByteArray &dictionary, bool last, int level)
+{
+    CompressedBlock block;
+    block.size = input.size();
+    block.crc = crc32(0, reinterpret_cast<const Bytef*>(input.constData()), input.size());
+
+    if (level == 0) {
+        block.data = input;
+        return block;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    z_stream stream = {};
+    if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        block.ok = false;
+        return block;
+    }
+    if (!dictionary.isEmpty()
+        && deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary.constData()), dictionary.size()) != Z_OK) {
+        deflateEnd(&stream);
+        block.ok = false;
+        return block;
+    }
+
+    // A sync flush ends the block on a byte boundary without marking it final,
+    // so the blocks of a file can simply be concatenated
+    block.data.resize(deflateBound(&stream, input.size()) + 16);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.constData()));
+    stream.avail_in = input.size();
+
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    qint64 produced = 0;
+    do {
+        if (produced == block.data.size()) {
+            block.data.resize(block.data.size() * 2);
+        }
+        stream.next_out = reinterpret_cast<Bytef*>(block.data.data() + produced);
+        stream.avail_out = block.data.size() - produced;
+        if (deflate(&stream, flush) == Z_STREAM_ERROR) {
+            block.ok = false;
+            break;
+        }
+        produced = block.data.size() - stream.avail_out;
+    } while (stream.avail_out == 0);
+
+    deflateEnd(&stream);
+    block.data.resize(produced);
+    block.nsecs = timer.nsecsElapsed();
+    return block;
+}
+
+bool ZipStreamWriter::flushPending(int maxBlocksInFlight)
+{
+    while (!m_pending.isEmpty()) {
+        // A finished block goes out at once, only one still compressing may be waited for
+        PendingOutput &next = m_pending.head();
+        if (next.kind == PendingOutput::Block && m_blocksInFlight <= maxBlocksInFlight && !next.block.isFinished()) {
+            return true;
+        }
+
+        PendingOutput pending = m_pending.dequeue();
+        CentralRecord &record = m_records[pending.record];
+
+        if (pending.kind == PendingOutput::Header) {
+            if (!writeHeader(record)) {
+                return false;
+            }
+        } else if (pending.kind == PendingOutput::Descriptor) {
+            auto blobWriter = m_blobWriters.find(pending.record);
+            if (blobWriter != m_blobWriters.end()) {
+                (*blobWriter)->commit(record.crc, record.size);
+                m_blobWriters.erase(blobWriter);
+            }
+
+            if (!writeDescriptor(record)) {
+                return false;
+            }
+        } else if (pending.kind == PendingOutput::Raw) {
+            --m_blocksInFlight;
+            record.compressedSize += pending.raw.size();
+
+            if (!output(pending.raw)) {
+                return false;
+            }
+        } else {
+            CompressedBlock block = pending.block.result();
+            --m_blocksInFlight;
+            if (!block.ok) {
+                return fail("Failed to compress " + QString::fromUtf8(record.name));
+            }
+
+            record.crc = crc32_combine(record.crc, block.crc, block.size);
+            record.size += block.size;
+            record.compressedSize += block.data.size();
+
+            if (record.method == METHOD_DEFLATE) {
+                m_stats.deflatedInput += block.size;
+                m_stats.deflatedOutput += block.data.size();
+                m_stats.deflateNsecs += block.nsecs;
+            }
+
+            auto blobWriter = m_blobWriters.find(pending.record);
+            if (blobWriter != m_blobWriters.end()) {
+                (*blobWriter)->append(block.data);
+            }
+
+            if (!output(block.data)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool ZipStreamWriter::finish()
+{
+    if (!flushPending(0)) {
+        return false;
+    }
+
+    qint64 centralOffset = m_offset;
+
+    QByteArray central;
+    for (const CentralRecord &record : std::as_const(m_records)) {
+        bool offset64 = record.offset >= MAX_32;
+        int extraSize = centralExtraSize(record.zip64, record.offset);
+
+        append32(central, CENTRAL_HEADER_SIGNATURE);
+        append16(central, VERSION_MADE_BY);
+        append16(central, record.zip64 || offset64 ? VERSION_ZIP64 : VERSION_DEFAULT);
+        append16(central, ENTRY_FLAGS);
+        append16(central, record.method);
+        append16(central, record.dosTime);
+        append16(central, record.dosDate);
+        append32(central, record.crc);
+        append32(central, record.zip64 ? MAX_32 : record.compressedSize);
+        append32(central, record.zip64 ? MAX_32 : record.size);
+        append16(central, record.name.size());
+        append16(central, extraSize);
+        append16(central, 0);
+        append16(central, 0);
+        append16(central, 0);
+        append32(central, record.externalAttributes);
+        append32(central, offset64 ? MAX_32 : record.offset);
+        central.append(record.name);
+
+        if (extraSize > 0) {
+            append16(central, 0x0001);
+            append16(central, extraSize - 4);
+            if (record.zip64) {
+                append64(central, record.size);
+                append64(central, record.compressedSize);
+            }
+            if (offset64) {
+                append64(central, record.offset);
+            }
+        }
+
+        if (central.size() >= READ_CHUNK_SIZE) {
+            if (!output(central)) {
+                return false;
+            }
+            central.clear();
+        }
+    }
+
+    if (!output(central)) {
+        return false;
+    }
+
+    qint64 centralSize = m_offset - centralOffset;
+    qint64 entryCount = m_records.size();
+    bool zip64End = needsZip64End(entryCount, centralSize, centralOffset);
+
+    QByteArray end;
+    if (zip64End) {
+        qint64 zip64EndOffset = m_offset;
+
+        append32(end, ZIP64_END_SIGNATURE);
+        append64(end, ZIP64_END_SIZE - 12);
+        append16(end, VERSION_MADE_BY);
+        append16(end, VERSION_ZIP64);
+        append32(end, 0);
+        append32(end, 0);
+        append64(end, entryCount);
+        append64(end, entryCount);
+        append64(end, centralSize);
+        append64(end, centralOffset);
+
+        append32(end, ZIP64_LOCATOR_SIGNATURE);
+        append32(end, 0);
+        append64(end, zip64EndOffset);
+        append32(end, 1);
+    }
+
+    append32(end, END_SIGNATURE);
+    append16(end, 0);
+    append16(end, 0);
+    append16(end, zip64End ? MAX_16 : entryCount);
+    append16(end, zip64End ? MAX_16 : entryCount);
+    append32(end, zip64End ? MAX_32 : centralSize);
+    append32(end, zip64End ? MAX_32 : centralOffset);
+    append16(end, 0);
+
+    return output(end);
+}
+
+bool ZipStreamWriter::output(const QByteArray &data)
+{
+    if (!m_sink->write(data)) {
+        return fail("Cancelled");
+    }
+    m_offset += data.size();
+    return true;
+}
+
+bool ZipStreamWriter::fail(const QString &error)
+{
+    m_error = error;
+    return false;
+}
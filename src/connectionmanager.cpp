@@ -4,6 +4,8 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QCborValue>
+#include <QCborMap>
 #include <QFile>
 #include <QFileInfo>
 #include <QUrl>
@@ -20,13 +22,15 @@ ConnectionManager::ConnectionManager(QObject *parent)
     , m_connected(false)
     , m_authenticating(false)
     , m_authenticated(false)
+    , m_cborEncoding(false)
     , m_downloadFile(nullptr)
     , m_downloadExpectedSize(0)
     , m_downloadReceivedSize(0)
+    , m_downloadRanged(false)
     , m_isZipping(false)
-    , m_uploadFile(nullptr)
-    , m_uploadTotalSize(0)
-    , m_uploadSentSize(0)
+    , m_lastUploadStream(0)
+    , m_uploadWindow(DEFAULT_UPLOAD_WINDOW)
+    , m_uploadUnacked(0)
     , m_serverName("Unknown Server")
     , m_imageProvider(nullptr)
     , m_connectionTimer(new QTimer(this))
@@ -35,6 +39,14 @@ ConnectionManager::ConnectionManager(QObject *parent)
     , m_totalTransferSize(0)
     , m_totalBytesTransferred(0)
     , m_currentSpeed(0)
+    , m_nextRequestId(0)
+    , m_listRequestId(0)
+    , m_listPending(false)
+    , m_searchRequestId(0)
+    , m_searchReceived(0)
+    , m_downloadRequestId(0)
+    , m_nextStreamId(0)
+    , m_downloadStreamId(0)
 {
     connect(m_socket, &QWebSocket::connected, this, &ConnectionManager::onConnected);
     connect(m_socket, &QWebSocket::disconnected, this, &ConnectionManager::onDisconnected);
@@ -57,7 +69,7 @@ ConnectionManager::ConnectionManager(QObject *parent)
 
 ConnectionManager::~ConnectionManager()
 {
-    cleanupCurrentUpload();
+    closeAllUploads();
     cleanupCurrentDownload();
 
     if (m_socket) {
@@ -98,6 +110,7 @@ void ConnectionManager::connectToServer(const QString &url, const QString &usern
     setAuthenticating(true);
     setAuthenticated(false);
 
+    QString previousUsername = m_username;
     m_username = username;
     m_password = password;
     setStatusMessage("Connecting...");
@@ -130,12 +143,22 @@ void ConnectionManager::connectToServer(const QString &url, const QString &usern
         }
     }
 
+    // Interrupted uploads can only be resumed on the server and account that started them
+    if (wsUrl.toString() != m_serverUrl || username != previousUsername) {
+        clearUploadQueue();
+        discardPartialDownload();
+    }
+    m_serverUrl = wsUrl.toString();
+
     m_connectionTimer->start();
     m_socket->open(wsUrl);
 }
 
 void ConnectionManager::disconnect()
 {
+    clearUploadQueue();
+    cleanupCurrentDownload();
+    discardPartialDownload();
     m_socket->close();
 }
 
@@ -149,7 +172,24 @@ void ConnectionManager::listDirectory(const QString &path, bool foldersFirst)
     QJsonObject params;
     params["path"] = path;
     params["foldersFirst"] = foldersFirst;
-    sendCommand(Protocol::Commands::LIST_DIRECTORY, params);
+    // Large folders arrive in batches, the first one can be shown while the rest follows
+    params["stream"] = true;
+    params["limit"] = LIST_BATCH_SIZE;
+
+    // Whatever was held back concerns the folder being left
+    releaseHeldChanges();
+    m_listPending = true;
+
+    // Only a listing received in full can stand in for a new one
+    m_listPath = path.split('/', Qt::SkipEmptyParts).join('/');
+    m_listKey = (foldersFirst ? "1:" : "0:") + path;
+    auto cached = m_listingCache.constFind(m_listKey);
+    if (cached != m_listingCache.constEnd() && cached->complete) {
+        params["version"] = cached->version;
+    }
+
+    m_searchRequestId = 0;
+    m_listRequestId = sendCommand(Protocol::Commands::LIST_DIRECTORY, params);
 }
 
 void ConnectionManager::createDirectory(const QString &path)
@@ -210,7 +250,7 @@ void ConnectionManager::uploadFile(const QString &localPath, const QString &remo
     m_uploadQueue.enqueue(item);
     emit uploadQueueSizeChanged();
 
-    if (queueWasEmpty && !m_uploadFile && m_uploadLocalPath.isEmpty()) {
+    if (queueWasEmpty && m_activeUploads.isEmpty()) {
         // Defer the start to the next event loop iteration to allow
         // uploadFiles() to finish setting up the total size.
         QTimer::singleShot(0, this, &ConnectionManager::startNextUpload);
@@ -238,7 +278,7 @@ void ConnectionManager::uploadFiles(const QStringList &localPaths, const QString
         uploadFile(localPath, remotePath);
     }
 
-    if (m_uploadQueue.size() == localPaths.size() && !m_uploadFile) {
+    if (m_uploadQueue.size() == localPaths.size() && m_activeUploads.isEmpty()) {
         startEtaTracking(TransferType::Upload, newBatchSize);
     } else if (m_currentTransferType == TransferType::Upload) {
         m_totalTransferSize += newBatchSize;
@@ -252,14 +292,48 @@ void ConnectionManager::downloadFile(const QString &remotePath, const QString &l
         return;
     }
 
+    // Continue from the part file of an earlier attempt at the same download
+    QJsonObject range;
+    if (m_partialDownload.remotePath == remotePath && m_partialDownload.localPath == localPath) {
+        QFileInfo partInfo(localPath + ".part");
+        if (partInfo.exists()) {
+            range["offset"] = partInfo.size();
+            range["modified"] = m_partialDownload.modified;
+        }
+    } else {
+        discardPartialDownload();
+    }
+
+    requestDownload(remotePath, localPath, range);
+}
+
+void ConnectionManager::downloadFileRange(const QString &remotePath, const QString &localPath, qint64 offset, qint64 length)
+{
+    if (!m_authenticated) {
+        emit errorOccurred("Not authenticated");
+        return;
+    }
+
+    QJsonObject range;
+    range["offset"] = offset;
+    range["length"] = length;
+    requestDownload(remotePath, localPath, range);
+    m_downloadRanged = true;
+}
+
+void ConnectionManager::requestDownload(const QString &remotePath, const QString &localPath, const QJsonObject &range)
+{
+    cancelDownloadStream();
     cleanupCurrentDownload();
 
+    m_downloadStreamId = ++m_nextStreamId;
     m_downloadRemotePath = remotePath;
     m_downloadLocalPath = localPath;
 
-    QJsonObject params;
+    QJsonObject params = range;
     params["path"] = remotePath;
-    sendCommand(Protocol::Commands::DOWNLOAD_FILE, params);
+    params[Protocol::Fields::STREAM_ID] = qint64(m_downloadStreamId);
+    m_downloadRequestId = sendCommand(Protocol::Commands::DOWNLOAD_FILE, params);
 }
 
 void ConnectionManager::downloadDirectory(const QString &remotePath, const QString &localPath)
@@ -269,14 +343,17 @@ void ConnectionManager::downloadDirectory(const QString &remotePath, const QStri
         return;
     }
 
+    cancelDownloadStream();
     cleanupCurrentDownload();
 
+    m_downloadStreamId = ++m_nextStreamId;
     m_downloadRemotePath = remotePath;
     m_downloadLocalPath = localPath;
 
     QJsonObject params;
     params["path"] = remotePath;
-    sendCommand(Protocol::Commands::DOWNLOAD_DIRECTORY, params);
+    params[Protocol::Fields::STREAM_ID] = qint64(m_downloadStreamId);
+    m_downloadRequestId = sendCommand(Protocol::Commands::DOWNLOAD_DIRECTORY, params);
 }
 
 void ConnectionManager::getStorageInfo()
@@ -318,16 +395,54 @@ void ConnectionManager::requestThumbnail(const QString &path)
     sendCommand(Protocol::Commands::GET_THUMBNAIL, params);
 }
 
+void ConnectionManager::requestThumbnails(const QVariantList &files)
+{
+    if (!m_imageProvider) {
+        return;
+    }
+
+    for (const QVariant &fileVar : files) {
+        QVariantMap fileMap = fileVar.toMap();
+        if (!fileMap["isDir"].toBool()) {
+            QString fileName = fileMap["name"].toString().toLower();
+            if (fileName.endsWith(".jpg") || fileName.endsWith(".jpeg") ||
+                fileName.endsWith(".png") || fileName.endsWith(".gif") ||
+                fileName.endsWith(".bmp") || fileName.endsWith(".webp")) {
+
+                QString filePath = fileMap["path"].toString();
+
+                if (m_imageProvider->hasImage(filePath)) {
+                    emit thumbnailReady(filePath);
+                } else {
+                    requestThumbnail(filePath);
+                }
+            }
+        }
+    }
+}
+
+void ConnectionManager::touchListing(const QString &key)
+{
+    m_listingOrder.removeAll(key);
+    m_listingOrder.append(key);
+
+    while (m_listingOrder.size() > LISTING_CACHE_SIZE) {
+        m_listingCache.remove(m_listingOrder.takeFirst());
+    }
+}
+
 void ConnectionManager::onConnected()
 {
     m_connectionTimer->stop();
     setConnected(true);
     setStatusMessage("Connected");
+    m_pacer = TransferPacer();
 
     QJsonObject params;
     params["username"] = m_username;
     params["password"] = m_password;
     params["version"] = APP_VERSION_STRING;
+    params[Protocol::Fields::ENCODING] = Protocol::Encodings::CBOR;
     sendCommand(Protocol::Commands::AUTHENTICATE, params);
 }
 
@@ -338,17 +453,22 @@ void ConnectionManager::onDisconnected()
     setAuthenticating(false);
     setAuthenticated(false);
     setStatusMessage("Disconnected");
+    m_cborEncoding = false;
 
-    cleanupCurrentUpload();
+    requeueActiveUploads();
     cleanupCurrentDownload();
-    m_uploadQueue.clear();
-    emit uploadQueueSizeChanged();
 
     resetEtaTracking();
 
     if (m_imageProvider) {
         m_imageProvider->clear();
     }
+
+    // The next server or user may not see the same files
+    m_listingCache.clear();
+    m_listingOrder.clear();
+    m_listPending = false;
+    m_heldChanges.clear();
 }
 
 void ConnectionManager::onTextMessageReceived(const QString &message)
@@ -361,15 +481,33 @@ void ConnectionManager::onTextMessageReceived(const QString &message)
 
 void ConnectionManager::onBinaryMessageReceived(const QByteArray &message)
 {
-    if (!m_downloadFile || m_downloadLocalPath.isEmpty()) {
+    if (message.isEmpty()) {
+        return;
+    }
+
+    if (message.at(0) == Protocol::Frames::CONTROL && m_cborEncoding) {
+        QCborValue response = QCborValue::fromCbor(message.constData() + 1, message.size() - 1);
+        if (response.isMap()) {
+            handleResponse(response.toMap().toJsonObject());
+        }
+    } else if (message.at(0) == Protocol::Frames::DATA && message.size() >= Protocol::Frames::DATA_HEADER_SIZE) {
+        quint32 streamId = Protocol::Frames::readStreamId(message.constData());
+        handleDownloadData(streamId, QByteArrayView(message).sliced(Protocol::Frames::DATA_HEADER_SIZE));
+    }
+}
+
+void ConnectionManager::handleDownloadData(quint32 streamId, QByteArrayView data)
+{
+    // Chunks of a download that was cancelled or replaced may still be arriving
+    if (streamId != m_downloadStreamId || !m_downloadFile || m_downloadLocalPath.isEmpty()) {
         return;
     }
 
-    m_downloadBuffer.append(message);
-    m_downloadReceivedSize += message.size();
+    m_downloadBuffer.append(data);
+    m_downloadReceivedSize += data.size();
 
     if (m_currentTransferType == TransferType::Download) {
-        m_totalBytesTransferred += message.size();
+        m_totalBytesTransferred += data.size();
     }
 
     if (m_downloadExpectedSize > 0) {
@@ -377,24 +515,9 @@ void ConnectionManager::onBinaryMessageReceived(const QByteArray &message)
         emit downloadProgress(progress);
     }
 
-    if (m_downloadReceivedSize >= m_downloadExpectedSize) {
-        if (!m_downloadFile->write(m_downloadBuffer)) {
-            emit errorOccurred("Failed to write to file");
-        }
-        m_downloadFile->flush();
-        m_downloadFile->close();
-        delete m_downloadFile;
-        m_downloadFile = nullptr;
-
-        emit downloadComplete(m_downloadLocalPath);
-
-        m_downloadRemotePath.clear();
-        m_downloadLocalPath.clear();
-        m_downloadBuffer.clear();
-        m_downloadExpectedSize = 0;
-        m_downloadReceivedSize = 0;
-        setCurrentDownloadFileName("");
-        setIsZipping(false);
+    // Archives compressed on the fly have no size up front (-1), they end with download_complete
+    if (m_downloadExpectedSize >= 0 && m_downloadReceivedSize >= m_downloadExpectedSize) {
+        finishCurrentDownload();
     } else {
         if (m_downloadBuffer.size() >= CHUNK_SIZE) {
             if (!m_downloadFile->write(m_downloadBuffer)) {
@@ -434,6 +557,8 @@ void ConnectionManager::onConnectionTimeout()
 
 void ConnectionManager::onBytesWritten(qint64 bytes)
 {
+    m_pacer.onBytesWritten(bytes, m_socket->bytesToWrite());
+
     if (m_currentTransferType == TransferType::Upload) {
         m_totalBytesTransferred += bytes;
 
@@ -448,67 +573,98 @@ void ConnectionManager::onBytesWritten(qint64 bytes)
         }
     }
 
-    if (m_uploadFile && m_uploadFile->isOpen()) {
-        if (m_socket->bytesToWrite() < CHUNK_SIZE * 2) {
-            sendNextChunk();
-        }
+    if (!m_activeUploads.isEmpty()) {
+        pumpUploads();
     }
 }
 
-void ConnectionManager::sendNextChunk()
+void ConnectionManager::pumpUploads()
 {
-    if (!m_uploadFile || !m_uploadFile->isOpen()) {
-        return;
-    }
+    // Ready uploads take turns, one chunk each, while the socket has room and the
+    // server has acknowledged enough of what was sent to have room on its side
+    bool sent = true;
+    while (sent && m_pacer.canSend(m_socket->bytesToWrite()) && m_uploadUnacked < m_uploadWindow) {
+        sent = false;
+
+        auto it = m_activeUploads.upperBound(m_lastUploadStream);
+        for (int i = 0; i < m_activeUploads.size(); ++i, ++it) {
+            if (it == m_activeUploads.end()) {
+                it = m_activeUploads.begin();
+            }
 
-    if (m_uploadSentSize >= m_uploadTotalSize) {
-        m_uploadFile->close();
-        delete m_uploadFile;
-        m_uploadFile = nullptr;
-        return;
-    }
+            ActiveUpload &upload = it.value();
+            if (!upload.file || upload.sentSize >= upload.totalSize) {
+                continue;
+            }
 
-    if (m_socket->bytesToWrite() >= CHUNK_SIZE * 2) {
-        return;
-    }
+            quint32 streamId = it.key();
+            m_lastUploadStream = streamId;
 
-    QByteArray chunk = m_uploadFile->read(CHUNK_SIZE);
-    if (chunk.isEmpty()) {
-        emit errorOccurred("Failed to read file chunk");
-        cleanupCurrentUpload();
-        startNextUpload();
-        return;
-    }
+            qint64 length = qMin(qMin(m_pacer.chunkSize(), upload.totalSize - upload.sentSize), m_uploadWindow - m_uploadUnacked);
+            QByteArray frame(Protocol::Frames::DATA_HEADER_SIZE + length, Qt::Uninitialized);
+            Protocol::Frames::writeDataHeader(frame.data(), streamId);
+
+            qint64 read = upload.file->read(frame.data() + Protocol::Frames::DATA_HEADER_SIZE, length);
+            if (read <= 0) {
+                emit errorOccurred("Failed to read file chunk");
+
+                QJsonObject params;
+                params[Protocol::Fields::STREAM_ID] = qint64(streamId);
+                sendCommand(Protocol::Commands::CANCEL_UPLOAD, params);
+
+                closeUpload(streamId);
+                startNextUpload();
+                return;
+            }
+
+            frame.resize(Protocol::Frames::DATA_HEADER_SIZE + read);
+            upload.sentSize += read;
+            m_uploadUnacked += read;
+
+            if (upload.sentSize >= upload.totalSize) {
+                // Everything is queued on the socket, the stream stays until upload_complete
+                upload.file->close();
+                delete upload.file;
+                upload.file = nullptr;
+            }
 
-    m_socket->sendBinaryMessage(chunk);
-    m_uploadSentSize += chunk.size();
+            m_socket->sendBinaryMessage(frame);
+            sent = true;
+            break;
+        }
+    }
 }
 
-void ConnectionManager::sendCommand(const QString &type, const QJsonObject &params)
+int ConnectionManager::sendCommand(const QString &type, const QJsonObject &params)
 {
+    int requestId = ++m_nextRequestId;
+
     QJsonObject command;
     command["type"] = type;
     command["params"] = params;
+    command[Protocol::Fields::REQUEST_ID] = requestId;
+
+    if (m_cborEncoding) {
+        QByteArray frame(1, Protocol::Frames::CONTROL);
+        frame.append(QCborValue::fromJsonValue(command).toCbor());
+        m_socket->sendBinaryMessage(frame);
+        return requestId;
+    }
 
     QJsonDocument doc(command);
     m_socket->sendTextMessage(QString::fromUtf8(doc.toJson(QJsonDocument::Compact)));
+    return requestId;
 }
 
 void ConnectionManager::cancelUpload()
 {
-    if (m_uploadLocalPath.isEmpty()) {
+    if (m_activeUploads.isEmpty()) {
         return;
     }
 
-    cleanupCurrentUpload();
-
-    QJsonObject params;
-    params["path"] = m_uploadRemotePath;
-    sendCommand(Protocol::Commands::CANCEL_UPLOAD, params);
-    m_uploadLocalPath.clear();
-    m_uploadRemotePath.clear();
-    m_uploadTotalSize = 0;
-    m_uploadSentSize = 0;
+    // Cancels the files currently in flight, without a stream id the server drops all of them
+    closeAllUploads();
+    sendCommand(Protocol::Commands::CANCEL_UPLOAD, QJsonObject());
     setCurrentUploadFileName("");
 
     if (m_uploadQueue.isEmpty()) {
@@ -524,89 +680,184 @@ void ConnectionManager::cancelAllUploads()
     resetEtaTracking();
     m_uploadQueue.clear();
     emit uploadQueueSizeChanged();
-    cleanupCurrentUpload();
-    m_uploadLocalPath.clear();
-    m_uploadRemotePath.clear();
-    m_uploadTotalSize = 0;
-    m_uploadSentSize = 0;
+
+    if (!m_activeUploads.isEmpty()) {
+        closeAllUploads();
+        sendCommand(Protocol::Commands::CANCEL_UPLOAD, QJsonObject());
+    }
+
     setCurrentUploadFileName("");
     setStatusMessage("All uploads cancelled");
 }
 
 void ConnectionManager::cancelDownload()
 {
-    if (!m_downloadRemotePath.isEmpty()) {
-        QJsonObject params;
-        sendCommand(Protocol::Commands::CANCEL_DOWNLOAD, params);
-    }
-
+    cancelDownloadStream();
     cleanupCurrentDownload();
+    discardPartialDownload();
     setStatusMessage("Download cancelled");
     setIsZipping(false);
     emit errorOccurred("Download cancelled by user");
     resetEtaTracking();
 }
 
+void ConnectionManager::cancelDownloadStream()
+{
+    if (m_downloadStreamId == 0) {
+        return;
+    }
+
+    QJsonObject params;
+    params[Protocol::Fields::STREAM_ID] = qint64(m_downloadStreamId);
+    sendCommand(Protocol::Commands::CANCEL_DOWNLOAD, params);
+    m_downloadStreamId = 0;
+}
+
 void ConnectionManager::startNextUpload()
 {
-    if (m_uploadQueue.isEmpty()) {
+    // Several files are in flight at once so small files do not wait on each other's round trips
+    while (m_activeUploads.size() < MAX_PARALLEL_UPLOADS && !m_uploadQueue.isEmpty()) {
+        UploadQueueItem item = m_uploadQueue.dequeue();
+        emit uploadQueueSizeChanged();
+
+        QFile file(item.localPath);
+        if (!file.open(QIODevice::ReadOnly)) {
+            emit errorOccurred("Cannot open file: " + item.localPath);
+            continue;
+        }
+
+        ActiveUpload upload;
+        upload.localPath = item.localPath;
+        upload.remotePath = item.remotePath;
+        upload.totalSize = file.size();
+        upload.uploadId = item.uploadId;
+
+        file.close();
+
+        QFileInfo fileInfo(item.localPath);
+        setCurrentUploadFileName(fileInfo.fileName());
+
+        quint32 streamId = ++m_nextStreamId;
+
+        QJsonObject params;
+        params[Protocol::Fields::STREAM_ID] = qint64(streamId);
+        if (upload.uploadId.isEmpty()) {
+            params["path"] = item.remotePath;
+            params["size"] = upload.totalSize;
+            upload.requestId = sendCommand(Protocol::Commands::UPLOAD_FILE, params);
+        } else {
+            params[Protocol::Fields::UPLOAD_ID] = upload.uploadId;
+            upload.requestId = sendCommand(Protocol::Commands::RESUME_UPLOAD, params);
+        }
+
+        m_activeUploads.insert(streamId, upload);
+    }
+
+    if (m_activeUploads.isEmpty()) {
         setCurrentUploadFileName("");
         resetEtaTracking();
-        return;
     }
+}
 
-    UploadQueueItem item = m_uploadQueue.dequeue();
-    emit uploadQueueSizeChanged();
-
-    QFile file(item.localPath);
-    if (!file.open(QIODevice::ReadOnly)) {
-        emit errorOccurred("Cannot open file: " + item.localPath);
-        startNextUpload();
-        return;
+void ConnectionManager::closeUpload(quint32 streamId)
+{
+    ActiveUpload upload = m_activeUploads.take(streamId);
+    m_uploadUnacked -= upload.sentSize - upload.ackedSize;
+    if (upload.file) {
+        upload.file->close();
+        delete upload.file;
     }
+}
 
-    m_uploadLocalPath = item.localPath;
-    m_uploadRemotePath = item.remotePath;
-    m_uploadTotalSize = file.size();
-    m_uploadSentSize = 0;
+void ConnectionManager::closeAllUploads()
+{
+    const QList<quint32> streams = m_activeUploads.keys();
+    for (quint32 streamId : streams) {
+        closeUpload(streamId);
+    }
+}
 
-    file.close();
+void ConnectionManager::requeueActiveUploads()
+{
+    // Put interrupted files back in front, in their original order, so they resume on reconnect
+    const QList<ActiveUpload> uploads = m_activeUploads.values();
+    for (auto it = uploads.crbegin(); it != uploads.crend(); ++it) {
+        UploadQueueItem item;
+        item.localPath = it->localPath;
+        item.remotePath = it->remotePath;
+        item.uploadId = it->uploadId;
+        m_uploadQueue.prepend(item);
+    }
 
-    QFileInfo fileInfo(item.localPath);
-    setCurrentUploadFileName(fileInfo.fileName());
+    closeAllUploads();
+    emit uploadQueueSizeChanged();
+}
 
-    QJsonObject params;
-    params["path"] = item.remotePath;
-    params["size"] = m_uploadTotalSize;
-    sendCommand(Protocol::Commands::UPLOAD_FILE, params);
+void ConnectionManager::clearUploadQueue()
+{
+    closeAllUploads();
+    m_uploadQueue.clear();
+    emit uploadQueueSizeChanged();
 }
 
-void ConnectionManager::cleanupCurrentUpload()
+void ConnectionManager::finishCurrentDownload()
 {
-    if (m_uploadFile) {
-        m_uploadFile->close();
-        delete m_uploadFile;
-        m_uploadFile = nullptr;
+    QString partPath = m_downloadLocalPath + ".part";
+
+    if (!m_downloadFile->write(m_downloadBuffer)) {
+        emit errorOccurred("Failed to write to file");
+    }
+    m_downloadBuffer.clear();
+    m_downloadFile->close();
+    delete m_downloadFile;
+    m_downloadFile = nullptr;
+
+    // The destination is only replaced once the whole file arrived
+    QFile::remove(m_downloadLocalPath);
+    if (QFile::rename(partPath, m_downloadLocalPath)) {
+        emit downloadComplete(m_downloadLocalPath);
+    } else {
+        emit errorOccurred("Failed to save " + m_downloadLocalPath);
     }
+
+    m_partialDownload = PartialDownload();
+    cleanupCurrentDownload();
+    resetEtaTracking();
 }
 
 void ConnectionManager::cleanupCurrentDownload()
 {
     if (m_downloadFile) {
+        // Whatever was received stays in the part file for a later resume
+        m_downloadFile->write(m_downloadBuffer);
         m_downloadFile->close();
         delete m_downloadFile;
         m_downloadFile = nullptr;
+
+        if (m_partialDownload.localPath != m_downloadLocalPath) {
+            QFile::remove(m_downloadLocalPath + ".part");
+        }
     }
 
     m_downloadBuffer.clear();
     m_downloadExpectedSize = 0;
     m_downloadReceivedSize = 0;
+    m_downloadRanged = false;
     m_downloadRemotePath.clear();
     m_downloadLocalPath.clear();
+    m_downloadStreamId = 0;
     setCurrentDownloadFileName("");
     setIsZipping(false);
 }
 
+void ConnectionManager::discardPartialDownload()
+{
+    if (!m_partialDownload.localPath.isEmpty()) {
+        QFile::remove(m_partialDownload.localPath + ".part");
+    }
+    m_partialDownload = PartialDownload();
+}
+
 void ConnectionManager::setCurrentUploadFileName(const QString &fileName)
 {
     if (m_currentUploadFileName != fileName) {
@@ -658,6 +909,9 @@ void ConnectionManager::handleResponse(const QJsonObject &response)
     QString type = response["type"].toString();
     QJsonObject data = response["data"].toObject();
 
+    // Replies may arrive out of order, 0 means the server did not tag the reply
+    int requestId = response[Protocol::Fields::REQUEST_ID].toInt();
+
     if (type == Protocol::Responses::ERROR) {
         QString error = data["error"].toString();
         setStatusMessage("Error: " + error);
@@ -667,20 +921,50 @@ void ConnectionManager::handleResponse(const QJsonObject &response)
             m_socket->close();
         }
 
-        cleanupCurrentUpload();
-        m_uploadLocalPath.clear();
-        m_uploadRemotePath.clear();
-        m_uploadTotalSize = 0;
-        m_uploadSentSize = 0;
+        // Only abort the transfer the error belongs to
+        bool uploadFailed = false;
+        const QList<quint32> uploads = m_activeUploads.keys();
+        for (quint32 streamId : uploads) {
+            const ActiveUpload &upload = m_activeUploads[streamId];
+            if (requestId == 0 || upload.requestId == requestId) {
+                if (requestId != 0 && !upload.uploadId.isEmpty() && !upload.file) {
+                    // The server no longer has the session, send the whole file again
+                    UploadQueueItem item;
+                    item.localPath = upload.localPath;
+                    item.remotePath = upload.remotePath;
+                    m_uploadQueue.prepend(item);
+                    emit uploadQueueSizeChanged();
+                }
+                closeUpload(streamId);
+                uploadFailed = true;
+            }
+        }
 
-        cleanupCurrentDownload();
+        if (uploadFailed || requestId == 0) {
+            startNextUpload();
+        }
 
-        startNextUpload();
+        if (requestId == 0 || requestId == m_downloadRequestId) {
+            cleanupCurrentDownload();
+            discardPartialDownload();
+            m_downloadRequestId = 0;
+        }
+
+        // No listing is coming to hold the changes for
+        if (requestId == 0 || requestId == m_listRequestId) {
+            releaseHeldChanges();
+        }
         return;
     }
 
     if (type == Protocol::Responses::PING) {
         sendCommand(Protocol::Commands::PONG, QJsonObject());
+
+        // The server measures the round trip, we only have the receiving end of it
+        qint64 rtt = data["rtt"].toInteger();
+        if (rtt > 0) {
+            m_pacer.onRttSample(rtt);
+        }
     }
 
     if (type == Protocol::Responses::AUTHENTICATE) {
@@ -689,36 +973,82 @@ void ConnectionManager::handleResponse(const QJsonObject &response)
             setAuthenticating(false);
             setStatusMessage("Authenticated");
             setIsAdmin(data["isAdmin"].toBool());
+            // Servers that do not know about CBOR leave the field out and keep talking JSON
+            m_cborEncoding = data[Protocol::Fields::ENCODING].toString() == Protocol::Encodings::CBOR;
+
+            if (!m_uploadQueue.isEmpty()) {
+                qint64 remainingSize = 0;
+                for (const UploadQueueItem &item : std::as_const(m_uploadQueue)) {
+                    remainingSize += QFileInfo(item.localPath).size();
+                }
+                startEtaTracking(TransferType::Upload, remainingSize);
+                startNextUpload();
+            }
+
+            if (!m_partialDownload.remotePath.isEmpty()) {
+                downloadFile(m_partialDownload.remotePath, m_partialDownload.localPath);
+            }
         } else {
             m_socket->close();
         }
     } else if (type == Protocol::Responses::LIST_DIRECTORY) {
+        if (requestId != 0 && requestId != m_listRequestId) {
+            // A newer listing was requested since, this one is stale
+            return;
+        }
+
         QString path = data["path"].toString();
         QJsonArray filesArray = data["files"].toArray();
         QVariantList files = filesArray.toVariantList();
 
-        emit directoryListed(path, files);
+        QString version = data["version"].toString();
+        bool first = data["offset"].toInteger() == 0;
 
-        if (m_imageProvider) {
-            for (const QVariant &fileVar : std::as_const(files)) {
-                QVariantMap fileMap = fileVar.toMap();
-                if (!fileMap["isDir"].toBool()) {
-                    QString fileName = fileMap["name"].toString().toLower();
-                    if (fileName.endsWith(".jpg") || fileName.endsWith(".jpeg") ||
-                        fileName.endsWith(".png") || fileName.endsWith(".gif") ||
-                        fileName.endsWith(".bmp") || fileName.endsWith(".webp")) {
-
-                        QString filePath = fileMap["path"].toString();
-
-                        if (m_imageProvider->hasImage(filePath)) {
-                            emit thumbnailReady(filePath);
-                        } else {
-                            requestThumbnail(filePath);
-                        }
-                    }
-                }
+        if (first) {
+            emit directoryListed(path, files);
+        } else {
+            emit directoryBatchListed(path, files);
+        }
+
+        // Servers without an index for the folder send no version, nothing to compare against later
+        if (version.isEmpty()) {
+            m_listingCache.remove(m_listKey);
+            m_listingOrder.removeAll(m_listKey);
+        } else if (first) {
+            CachedListing listing;
+            listing.version = version;
+            listing.files = files;
+            listing.complete = data["nextCursor"].toString().isEmpty();
+            m_listingCache.insert(m_listKey, listing);
+            touchListing(m_listKey);
+        } else {
+            auto cached = m_listingCache.find(m_listKey);
+            if (cached != m_listingCache.end() && cached->version == version) {
+                cached->files.append(files);
+                cached->complete = data["nextCursor"].toString().isEmpty();
             }
         }
+
+        requestThumbnails(files);
+
+        if (data["nextCursor"].toString().isEmpty()) {
+            releaseHeldChanges();
+        }
+    } else if (type == Protocol::Responses::NOT_MODIFIED) {
+        if (requestId != m_listRequestId) {
+            return;
+        }
+
+        auto cached = m_listingCache.constFind(m_listKey);
+        if (cached == m_listingCache.constEnd()) {
+            return;
+        }
+
+        QVariantList files = cached->files;
+        touchListing(m_listKey);
+        emit directoryListed(data["path"].toString(), files);
+        requestThumbnails(files);
+        releaseHeldChanges();
     } else if (type == Protocol::Responses::THUMBNAIL_DATA) {
         if (m_imageProvider) {
             QString path = data["path"].toString();
@@ -742,8 +1072,25 @@ void ConnectionManager::handleResponse(const QJsonObject &response)
     } else if (type == Protocol::Responses::MOVE_ITEM) {
         emit itemMoved(data["from"].toString(), data["to"].toString());
     } else if (type == Protocol::Responses::UPLOAD_READY) {
-        m_uploadFile = new QFile(m_uploadLocalPath);
-        if (m_uploadFile->open(QIODevice::ReadOnly)) {
+        quint32 streamId = data[Protocol::Fields::STREAM_ID].toInteger();
+        auto it = m_activeUploads.find(streamId);
+        if (it == m_activeUploads.end()) {
+            // Cancelled while the server was getting ready
+            return;
+        }
+
+        ActiveUpload &upload = it.value();
+        upload.uploadId = data[Protocol::Fields::UPLOAD_ID].toString();
+        upload.file = new QFile(upload.localPath);
+        if (upload.file->open(QIODevice::ReadOnly)) {
+            // A resumed upload continues where the server's part file ends
+            qint64 offset = data["offset"].toInteger();
+            if (offset > 0 && upload.file->seek(offset)) {
+                upload.sentSize = offset;
+                upload.ackedSize = offset;
+            }
+            m_uploadWindow = data["window"].toInteger(DEFAULT_UPLOAD_WINDOW);
+
             // Only start ETA tracking for the first file
             // Subsequent files will continue using the existing tracking
             if (m_currentTransferType == TransferType::None) {
@@ -753,29 +1100,23 @@ void ConnectionManager::handleResponse(const QJsonObject &response)
             }
 
             // Don't emit 0% progress here, let onBytesWritten handle it
-            for (int i = 0; i < 3 && m_uploadSentSize < m_uploadTotalSize; ++i) {
-                sendNextChunk();
-            }
+            pumpUploads();
         } else {
-            emit errorOccurred("Failed to open file: " + m_uploadLocalPath);
-            delete m_uploadFile;
-            m_uploadFile = nullptr;
+            emit errorOccurred("Failed to open file: " + upload.localPath);
+
+            QJsonObject params;
+            params[Protocol::Fields::STREAM_ID] = qint64(streamId);
+            sendCommand(Protocol::Commands::CANCEL_UPLOAD, params);
+
+            closeUpload(streamId);
             startNextUpload();
         }
     } else if (type == Protocol::Responses::UPLOAD_COMPLETE) {
         // Individual file completed
         QString completedPath = data["path"].toString();
+        closeUpload(data[Protocol::Fields::STREAM_ID].toInteger());
 
-        m_uploadLocalPath.clear();
-        m_uploadRemotePath.clear();
-        m_uploadTotalSize = 0;
-        m_uploadSentSize = 0;
-        if (m_uploadFile) {
-            delete m_uploadFile;
-            m_uploadFile = nullptr;
-        }
-
-        if (m_uploadQueue.isEmpty()) {
+        if (m_uploadQueue.isEmpty() && m_activeUploads.isEmpty()) {
             // All uploads done - emit 100% and signal completion
             emit uploadProgress(100);
             setCurrentUploadFileName("");
@@ -787,34 +1128,93 @@ void ConnectionManager::handleResponse(const QJsonObject &response)
             // More files to upload - continue without emitting uploadComplete
             startNextUpload();
         }
+    } else if (type == Protocol::Responses::UPLOAD_ACK) {
+        auto it = m_activeUploads.find(data[Protocol::Fields::STREAM_ID].toInteger());
+        if (it == m_activeUploads.end()) {
+            return;
+        }
+
+        qint64 ackedSize = data["size"].toInteger();
+        m_uploadUnacked -= ackedSize - it->ackedSize;
+        it->ackedSize = ackedSize;
+        pumpUploads();
     } else if (type == Protocol::Responses::UPLOAD_CANCELLED) {
         setStatusMessage("Upload cancelled");
     } else if (type == Protocol::Responses::DOWNLOAD_ZIPPING) {
+        if (data[Protocol::Fields::STREAM_ID].toInteger() != m_downloadStreamId) {
+            return;
+        }
+
+        // Compressed archives are sent while they are built without a size, the
+        // progress of the compression stands in for the download progress
+        if (m_downloadFile) {
+            qint64 totalBytes = data["totalBytes"].toInteger();
+            if (m_downloadExpectedSize < 0 && totalBytes > 0) {
+                emit downloadProgress(data["bytesDone"].toInteger() * 100 / totalBytes);
+            }
+            return;
+        }
+
         QString name = data["name"].toString();
         setCurrentDownloadFileName(name);
         setIsZipping(true);
         emit downloadZipping(name);
     } else if (type == Protocol::Responses::DOWNLOAD_START) {
+        if (data[Protocol::Fields::STREAM_ID].toInteger() != m_downloadStreamId) {
+            return;
+        }
+
         QString fileName = data["name"].toString();
-        m_downloadExpectedSize = data["size"].toVariant().toLongLong();
-        m_downloadReceivedSize = 0;
+        qint64 size = data["size"].toVariant().toLongLong();
+        qint64 offset = data["offset"].toInteger();
         m_downloadBuffer.clear();
         setCurrentDownloadFileName(fileName);
         setIsZipping(false);
-        m_downloadFile = new QFile(m_downloadLocalPath);
-        if (!m_downloadFile->open(QIODevice::WriteOnly)) {
+
+        // Data goes to a .part file next to the destination. The server restarts
+        // from 0 when the file changed, otherwise it continues where the part file ends
+        QString partPath = m_downloadLocalPath + ".part";
+        bool resuming = !m_downloadRanged && offset > 0;
+        if (resuming && QFileInfo(partPath).size() != offset) {
+            // The part file changed under us, start over rather than writing at the wrong place
+            QString remotePath = m_downloadRemotePath;
+            QString localPath = m_downloadLocalPath;
+            cancelDownloadStream();
+            cleanupCurrentDownload();
+            discardPartialDownload();
+            downloadFile(remotePath, localPath);
+            return;
+        }
+        m_downloadExpectedSize = resuming ? offset + size : size;
+        m_downloadReceivedSize = resuming ? offset : 0;
+
+        m_downloadFile = new QFile(partPath);
+        if (!m_downloadFile->open(resuming ? QIODevice::WriteOnly | QIODevice::Append : QIODevice::WriteOnly)) {
             emit errorOccurred("Failed to create download file");
             delete m_downloadFile;
             m_downloadFile = nullptr;
             cleanupCurrentDownload();
             return;
         }
-        startEtaTracking(TransferType::Download, m_downloadExpectedSize);
+
+        // Directories and archives are generated on the fly and cannot be resumed
+        if (!m_downloadRanged && data.contains("modified")) {
+            m_partialDownload.remotePath = m_downloadRemotePath;
+            m_partialDownload.localPath = m_downloadLocalPath;
+            m_partialDownload.modified = data["modified"].toInteger();
+        }
+
+        startEtaTracking(TransferType::Download, size);
         emit downloadProgress(0);
     } else if (type == Protocol::Responses::DOWNLOAD_COMPLETE) {
-        emit downloadComplete(m_downloadLocalPath);
-        cleanupCurrentDownload();
-        resetEtaTracking();
+        // Usually the download already finished with its last chunk, only empty files end here
+        if (data[Protocol::Fields::STREAM_ID].toInteger() != m_downloadStreamId) {
+            return;
+        }
+
+        if (m_downloadFile) {
+            finishCurrentDownload();
+        }
     } else if (type == Protocol::Responses::DOWNLOAD_CANCELLED) {
         setStatusMessage("Download cancelled");
     } else if (type == Protocol::Responses::STORAGE_INFO) {
@@ -846,6 +1246,46 @@ void ConnectionManager::handleResponse(const QJsonObject &response)
     } else if (type == Protocol::Responses::FOLDER_TREE) {
         QJsonObject tree = data["tree"].toObject();
         emit folderTreeReceived(tree.toVariantMap());
+    } else if (type == Protocol::Responses::CHILDREN) {
+        emit childrenReceived(data.toVariantMap());
+    } else if (type == Protocol::Responses::SEARCH_RESULTS) {
+        if (requestId != m_searchRequestId) {
+            return;
+        }
+
+        QVariantList files = data["files"].toArray().toVariantList();
+        bool first = m_searchReceived == 0;
+        m_searchReceived += files.size();
+        emit searchResultsReceived(files, first);
+        requestThumbnails(files);
+
+        // Later pages follow on their own, up to a bound a very common name would exceed
+        QString nextCursor = data["nextCursor"].toString();
+        if (!nextCursor.isEmpty() && m_searchReceived < MAX_SEARCH_RESULTS) {
+            QJsonObject params;
+            params["query"] = data["query"].toString();
+            params["path"] = data["path"].toString();
+            params["cursor"] = nextCursor;
+            params["limit"] = SEARCH_PAGE_SIZE;
+            m_searchRequestId = sendCommand(Protocol::Commands::SEARCH, params);
+        }
+    } else if (type == Protocol::Responses::CHANGE) {
+        QVariantMap change = data.toVariantMap();
+
+        // The listing still arriving may have been taken before the change and would
+        // undo it. Anything after a held change waits too, so the order is kept
+        QString from = change["path"].toString().section('/', 0, -2, QString::SectionSkipEmpty);
+        QString to = change["toPath"].toString().section('/', 0, -2, QString::SectionSkipEmpty);
+        if (m_listPending && (!m_heldChanges.isEmpty() || from == m_listPath || to == m_listPath)) {
+            m_heldChanges.append(change);
+            return;
+        }
+
+        emitChange(change);
+    } else if (type == Protocol::Responses::TRANSFER_STATS) {
+        QVariantMap stats = data.toVariantMap();
+        stats["client"] = m_pacer.stats().toVariantMap();
+        emit transferStatsReceived(stats);
     } else if (type == Protocol::Responses::MOVE_MULTIPLE) {
         QJsonArray movedArray = data["movedItems"].toArray();
         QStringList movedItems;
@@ -858,6 +1298,28 @@ void ConnectionManager::handleResponse(const QJsonObject &response)
     }
 }
 
+void ConnectionManager::emitChange(const QVariantMap &change)
+{
+    emit changeReceived(change);
+
+    QVariantMap item = change["item"].toMap();
+    QString folder = item["path"].toString().section('/', 0, -2, QString::SectionSkipEmpty);
+    if (!item.isEmpty() && folder == m_listPath) {
+        requestThumbnails(QVariantList{ item });
+    }
+}
+
+void ConnectionManager::releaseHeldChanges()
+{
+    m_listPending = false;
+
+    QList<QVariantMap> changes;
+    changes.swap(m_heldChanges);
+    for (const QVariantMap &change : std::as_const(changes)) {
+        emitChange(change);
+    }
+}
+
 void ConnectionManager::setConnected(bool connected)
 {
     if (m_connected != connected) {
@@ -899,6 +1361,16 @@ void ConnectionManager::getServerInfo()
     sendCommand(Protocol::Commands::GET_SERVER_INFO, QJsonObject());
 }
 
+void ConnectionManager::getTransferStats()
+{
+    if (!m_authenticated) {
+        emit errorOccurred("Not authenticated");
+        return;
+    }
+
+    sendCommand(Protocol::Commands::GET_TRANSFER_STATS, QJsonObject());
+}
+
 void ConnectionManager::setServerName(const QString &name)
 {
     if (m_serverName != name) {
@@ -927,8 +1399,10 @@ void ConnectionManager::downloadMultiple(const QStringList &remotePaths, const Q
         return;
     }
 
+    cancelDownloadStream();
     cleanupCurrentDownload();
 
+    m_downloadStreamId = ++m_nextStreamId;
     m_downloadLocalPath = localPath;
     m_downloadRemotePath = zipName + ".zip";
 
@@ -941,7 +1415,8 @@ void ConnectionManager::downloadMultiple(const QStringList &remotePaths, const Q
     }
     params["paths"] = pathsArray;
     params["zipName"] = zipName;
-    sendCommand(Protocol::Commands::DOWNLOAD_MULTIPLE, params);
+    params[Protocol::Fields::STREAM_ID] = qint64(m_downloadStreamId);
+    m_downloadRequestId = sendCommand(Protocol::Commands::DOWNLOAD_MULTIPLE, params);
 }
 
 void ConnectionManager::renameItem(const QString &path, const QString &newName)
@@ -1057,6 +1532,11 @@ void ConnectionManager::updateEta()
     m_etaLastBytesTransferred = m_totalBytesTransferred;
     setSpeed(formatSpeed(medianSpeed));
 
+    if (m_totalTransferSize < 0) {
+        setEta("");
+        return;
+    }
+
     if (medianSpeed > 0) {
         qint64 remainingBytes = m_totalTransferSize - m_totalBytesTransferred;
         if (remainingBytes > 0) {
@@ -1181,6 +1661,48 @@ void ConnectionManager::getFolderTree(const QString &path, int maxDepth)
     sendCommand(Protocol::Commands::GET_FOLDER_TREE, params);
 }
 
+void ConnectionManager::getChildren(const QString &path)
+{
+    // Asked for by the folder tree on its own, not worth an error after a disconnect
+    if (!m_authenticated) {
+        return;
+    }
+
+    QJsonObject params;
+    params["path"] = path;
+    sendCommand(Protocol::Commands::GET_CHILDREN, params);
+}
+
+void ConnectionManager::releaseChildren(const QString &path)
+{
+    if (!m_authenticated) {
+        return;
+    }
+
+    QJsonObject params;
+    params["path"] = path;
+    sendCommand(Protocol::Commands::RELEASE_CHILDREN, params);
+}
+
+void ConnectionManager::search(const QString &query, const QString &path)
+{
+    if (!m_authenticated) {
+        emit errorOccurred("Not authenticated");
+        return;
+    }
+
+    QJsonObject params;
+    params["query"] = query;
+    params["path"] = path;
+    params["limit"] = SEARCH_PAGE_SIZE;
+
+    // Results take the place of the listing, one still arriving is dropped
+    m_listRequestId = -1;
+    releaseHeldChanges();
+    m_searchReceived = 0;
+    m_searchRequestId = sendCommand(Protocol::Commands::SEARCH, params);
+}
+
 void ConnectionManager::moveMultiple(const QStringList &fromPaths, const QString &toPath)
 {
     if (!m_authenticated) {
@@ -1249,7 +1771,7 @@ void ConnectionManager::uploadFolder(const QString &localFolderPath, const QStri
 
     emit uploadQueueSizeChanged();
 
-    if (!m_uploadFile && m_uploadLocalPath.isEmpty()) {
+    if (m_activeUploads.isEmpty()) {
         startEtaTracking(TransferType::Upload, totalSize);
         QTimer::singleShot(0, this, &ConnectionManager::startNextUpload);
     } else if (m_currentTransferType == TransferType::Upload) {
@@ -1320,7 +1842,7 @@ void ConnectionManager::uploadMixed(const QStringList &localPaths, const QString
 
     emit uploadQueueSizeChanged();
 
-    if (!m_uploadFile && m_uploadLocalPath.isEmpty()) {
+    if (m_activeUploads.isEmpty()) {
         startEtaTracking(TransferType::Upload, totalSize);
         QTimer::singleShot(0, this, &ConnectionManager::startNextUpload);
     } else if (m_currentTransferType == TransferType::Upload) {
@@ -5,7 +5,10 @@ FileModel* FileModel::s_instance = nullptr;
 
 FileModel::FileModel(QObject *parent)
     : QAbstractListModel(parent)
+    , m_showingResults(false)
 {
+    // Same order as listings sorted by name on the server
+    m_collator.setCaseSensitivity(Qt::CaseInsensitive);
 }
 
 FileModel* FileModel::create(QQmlEngine *qmlEngine, QJSEngine *jsEngine)
@@ -88,25 +91,13 @@ void FileModel::loadDirectory(const QString &path, const QVariantList &files)
     beginResetModel();
 
     m_files.clear();
+    m_paths.clear();
     m_currentPath = path;
+    m_showingResults = false;
 
     for (const QVariant &value : files) {
-        QVariantMap obj = value.toMap();
-
-        FileItem item;
-        item.name = obj["name"].toString();
-        item.path = obj["path"].toString();
-        item.isDir = obj["isDir"].toBool();
-        item.size = obj["size"].toLongLong();
-        item.modified = obj["modified"].toString();
-
-        if (!item.isDir && isImageFile(item.name)) {
-            item.previewPath = "";
-        } else {
-            item.previewPath = "";
-        }
-
-        m_files.append(item);
+        m_files.append(toFileItem(value));
+        m_paths.insert(m_files.last().path);
     }
 
     endResetModel();
@@ -115,6 +106,152 @@ void FileModel::loadDirectory(const QString &path, const QVariantList &files)
     emit countChanged();
 }
 
+void FileModel::appendFiles(const QString &path, const QVariantList &files)
+{
+    // A batch of a listing that was replaced by another folder in the meantime
+    if (path != m_currentPath) {
+        return;
+    }
+
+    QList<FileItem> items;
+    for (const QVariant &value : files) {
+        FileItem item = toFileItem(value);
+        if (!m_paths.contains(item.path)) {
+            m_paths.insert(item.path);
+            items.append(item);
+        }
+    }
+
+    if (items.isEmpty()) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), m_files.count(), m_files.count() + items.count() - 1);
+    m_files.append(items);
+    endInsertRows();
+
+    emit countChanged();
+}
+
+void FileModel::showSearchResults(const QVariantList &files, bool first)
+{
+    if (!first) {
+        appendFiles(m_currentPath, files);
+        return;
+    }
+
+    loadDirectory(m_currentPath, files);
+    m_showingResults = true;
+}
+
+void FileModel::applyChange(const QVariantMap &change, bool foldersFirst)
+{
+    if (m_showingResults) {
+        return;
+    }
+
+    QString kind = change["kind"].toString();
+    QString path = change["path"].toString();
+    QString toPath = change["toPath"].toString();
+
+    if (kind == "deleted" || kind == "moved" || kind == "renamed") {
+        removeFile(path);
+    }
+
+    if (kind == "deleted") {
+        return;
+    }
+
+    QString target = toPath.isEmpty() ? path : toPath;
+    QString folder = target.section('/', 0, -2, QString::SectionSkipEmpty);
+    if (folder != m_currentPath.split('/', Qt::SkipEmptyParts).join('/')) {
+        return;
+    }
+
+    upsertFile(toFileItem(change["item"]), foldersFirst);
+}
+
+int FileModel::findRow(const QString &path) const
+{
+    if (!m_paths.contains(path)) {
+        return -1;
+    }
+
+    for (int i = 0; i < m_files.count(); ++i) {
+        if (m_files[i].path == path) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void FileModel::removeFile(const QString &path)
+{
+    int row = findRow(path);
+    if (row < 0) {
+        return;
+    }
+
+    beginRemoveRows(QModelIndex(), row, row);
+    m_files.removeAt(row);
+    m_paths.remove(path);
+    endRemoveRows();
+
+    emit countChanged();
+}
+
+void FileModel::upsertFile(const FileItem &item, bool foldersFirst)
+{
+    int existing = findRow(item.path);
+    if (existing >= 0) {
+        // Same name, so the entry keeps its place
+        m_files[existing].size = item.size;
+        m_files[existing].modified = item.modified;
+        QModelIndex idx = index(existing, 0);
+        emit dataChanged(idx, idx, {SizeRole, ModifiedRole});
+        return;
+    }
+
+    int row = 0;
+    while (row < m_files.count()) {
+        const FileItem &other = m_files[row];
+        bool before = foldersFirst && item.isDir != other.isDir
+                          ? item.isDir
+                          : m_collator.compare(item.name, other.name) < 0;
+        if (before) {
+            break;
+        }
+        ++row;
+    }
+
+    beginInsertRows(QModelIndex(), row, row);
+    m_files.insert(row, item);
+    m_paths.insert(item.path);
+    endInsertRows();
+
+    emit countChanged();
+}
+
+FileItem FileModel::toFileItem(const QVariant &value) const
+{
+    QVariantMap obj = value.toMap();
+
+    FileItem item;
+    item.name = obj["name"].toString();
+    item.path = obj["path"].toString();
+    item.isDir = obj["isDir"].toBool();
+    item.size = obj["size"].toLongLong();
+    item.modified = obj["modified"].toString();
+
+    if (!item.isDir && isImageFile(item.name)) {
+        item.previewPath = "";
+    } else {
+        item.previewPath = "";
+    }
+
+    return item;
+}
+
 void FileModel::refreshThumbnail(const QString &path)
 {
     for (int i = 0; i < m_files.count(); ++i) {
@@ -131,7 +268,9 @@ void FileModel::clear()
 {
     beginResetModel();
     m_files.clear();
+    m_paths.clear();
     m_currentPath.clear();
+    m_showingResults = false;
     endResetModel();
 
     emit currentPathChanged();
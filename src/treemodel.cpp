@@ -108,6 +108,7 @@ void TreeModel::loadTree(const QVariantMap &treeData)
     m_rootNode->name = treeData["name"].toString();
     m_rootNode->path = treeData["path"].toString();
     m_rootNode->hasChildren = treeData["hasChildren"].toBool();
+    m_rootNode->childrenLoaded = treeData.contains("children");
 
     QVariantList childrenList = treeData["children"].toList();
 
@@ -125,6 +126,7 @@ void TreeModel::buildTree(TreeNode *parent, const QVariantMap &data)
     node->name = data["name"].toString();
     node->path = data["path"].toString();
     node->hasChildren = data["hasChildren"].toBool();
+    node->childrenLoaded = data.contains("children");
     node->parent = parent;
 
     parent->children.append(node);
@@ -148,40 +150,290 @@ void TreeModel::toggleExpanded(const QString &path)
     }
 
     node->isExpanded = !node->isExpanded;
+    QModelIndex nodeModelIndex = index(nodeIndex, 0);
 
     if (node->isExpanded) {
-        if (!node->children.isEmpty()) {
-            int insertCount = countVisibleDescendants(node);
+        // Rows are added once the children arrive
+        if (canFetchMore(nodeModelIndex)) {
+            fetchMore(nodeModelIndex);
+        } else {
+            insertVisibleDescendants(node);
+        }
+    } else {
+        removeVisibleDescendants(node);
+
+        // Not kept up to date while hidden, the root always stays loaded
+        if (node != m_rootNode) {
+            qDeleteAll(node->children);
+            node->children.clear();
+            node->childrenLoaded = !node->hasChildren;
+            node->fetching = false;
+            emit childrenReleased(node->path);
+        }
+    }
+
+    emit dataChanged(nodeModelIndex, nodeModelIndex, {IsExpandedRole});
+}
 
-            if (insertCount > 0) {
-                beginInsertRows(QModelIndex(), nodeIndex + 1, nodeIndex + insertCount);
+bool TreeModel::canFetchMore(const QModelIndex &parent) const
+{
+    TreeNode *node = nodeFromIndex(parent);
+    return node && node->hasChildren && !node->childrenLoaded && !node->fetching;
+}
 
-                QList<TreeNode*> childNodes;
-                collectVisibleNodes(node, childNodes);
+void TreeModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent)) {
+        return;
+    }
 
-                for (int i = 0; i < childNodes.count(); ++i) {
-                    m_visibleNodes.insert(nodeIndex + 1 + i, childNodes[i]);
-                }
+    TreeNode *node = nodeFromIndex(parent);
+    node->fetching = true;
+    emit childrenRequested(node->path);
+}
 
-                endInsertRows();
-            }
+void TreeModel::loadChildren(const QVariantMap &data)
+{
+    QString path = data["path"].toString();
+
+    if (!m_rootNode) {
+        if (!path.isEmpty()) {
+            return;
+        }
+
+        beginResetModel();
+        m_rootNode = new TreeNode();
+        m_rootNode->path = path;
+        m_visibleNodes.append(m_rootNode);
+        endResetModel();
+    }
+
+    TreeNode *node = findNode(m_rootNode, path);
+    if (!node) {
+        // Removed by an earlier reply of the same refresh
+        return;
+    }
+
+    // Collapsed before the reply came, its children were released already
+    if (node != m_rootNode && !node->isExpanded) {
+        node->fetching = false;
+        return;
+    }
+
+    if (node == m_rootNode) {
+        node->name = data["name"].toString();
+    }
+
+    bool shown = node->isExpanded && m_visibleNodes.contains(node);
+    if (shown) {
+        removeVisibleDescendants(node);
+    }
+
+    // Folders still there keep their nodes, and whatever is expanded below them
+    QHash<QString, TreeNode*> previous;
+    for (TreeNode *child : std::as_const(node->children)) {
+        previous.insert(child->path, child);
+    }
+
+    QList<TreeNode*> children;
+    const QVariantList childrenList = data["children"].toList();
+    for (const QVariant &childData : childrenList) {
+        QVariantMap childMap = childData.toMap();
+        QString childPath = childMap["path"].toString();
+
+        TreeNode *child = previous.take(childPath);
+        if (!child) {
+            child = new TreeNode();
+            child->path = childPath;
+            child->parent = node;
         }
-    } else {
-        int removeCount = countVisibleDescendants(node);
 
-        if (removeCount > 0) {
-            beginRemoveRows(QModelIndex(), nodeIndex + 1, nodeIndex + removeCount);
+        child->name = childMap["name"].toString();
+        child->hasChildren = childMap["hasChildren"].toBool();
 
-            for (int i = 0; i < removeCount; ++i) {
-                m_visibleNodes.removeAt(nodeIndex + 1);
+        // Collapsed folders are asked for again when opened rather than kept stale
+        if (!child->hasChildren || !child->isExpanded) {
+            qDeleteAll(child->children);
+            child->children.clear();
+            child->childrenLoaded = !child->hasChildren;
+            child->isExpanded = false;
+        }
+
+        children.append(child);
+    }
+    qDeleteAll(previous);
+
+    node->children = children;
+    node->childrenLoaded = true;
+    node->fetching = false;
+    node->hasChildren = !children.isEmpty();
+
+    if (shown) {
+        insertVisibleDescendants(node);
+    }
+
+    int row = m_visibleNodes.indexOf(node);
+    if (row >= 0) {
+        QModelIndex nodeModelIndex = index(row, 0);
+        emit dataChanged(nodeModelIndex, nodeModelIndex, {NameRole, HasChildrenRole});
+    }
+}
+
+void TreeModel::applyChange(const QVariantMap &change)
+{
+    QString kind = change["kind"].toString();
+
+    if (kind == "deleted" || kind == "moved" || kind == "renamed") {
+        removeNode(change["path"].toString());
+    }
+
+    QVariantMap item = change["item"].toMap();
+    if (kind != "deleted" && item["isDir"].toBool()) {
+        addNode(item);
+    }
+}
+
+void TreeModel::addNode(const QVariantMap &item)
+{
+    QString path = item["path"].toString();
+    TreeNode *parent = findNode(m_rootNode, path.section('/', 0, -2, QString::SectionSkipEmpty));
+    if (!parent) {
+        return;
+    }
+
+    // Not loaded yet, the folder only needs to show it can be opened
+    if (!parent->childrenLoaded) {
+        if (!parent->hasChildren) {
+            parent->hasChildren = true;
+            notifyNodeChanged(parent);
+        }
+        return;
+    }
+
+    for (TreeNode *child : std::as_const(parent->children)) {
+        if (child->path == path) {
+            if (!child->childrenLoaded && child->hasChildren != item["hasChildren"].toBool()) {
+                child->hasChildren = item["hasChildren"].toBool();
+                notifyNodeChanged(child);
             }
+            return;
+        }
+    }
+
+    TreeNode *node = new TreeNode();
+    node->name = item["name"].toString();
+    node->path = path;
+    node->hasChildren = item["hasChildren"].toBool();
+    node->childrenLoaded = !node->hasChildren;
+    node->parent = parent;
 
-            endRemoveRows();
+    bool shown = parent->isExpanded && m_visibleNodes.contains(parent);
+    if (shown) {
+        removeVisibleDescendants(parent);
+    }
+
+    int row = 0;
+    while (row < parent->children.count()
+           && parent->children[row]->name.compare(node->name, Qt::CaseInsensitive) < 0) {
+        ++row;
+    }
+    parent->children.insert(row, node);
+    parent->hasChildren = true;
+
+    if (shown) {
+        insertVisibleDescendants(parent);
+    }
+    notifyNodeChanged(parent);
+}
+
+void TreeModel::removeNode(const QString &path)
+{
+    TreeNode *node = findNode(m_rootNode, path);
+    if (!node || node == m_rootNode) {
+        return;
+    }
+
+    TreeNode *parent = node->parent;
+    bool shown = parent->isExpanded && m_visibleNodes.contains(parent);
+    if (shown) {
+        removeVisibleDescendants(parent);
+    }
+
+    parent->children.removeOne(node);
+    delete node;
+    parent->hasChildren = !parent->children.isEmpty();
+
+    if (shown) {
+        insertVisibleDescendants(parent);
+    }
+    notifyNodeChanged(parent);
+}
+
+void TreeModel::notifyNodeChanged(TreeNode *node)
+{
+    int row = m_visibleNodes.indexOf(node);
+    if (row >= 0) {
+        QModelIndex nodeModelIndex = index(row, 0);
+        emit dataChanged(nodeModelIndex, nodeModelIndex, {HasChildrenRole});
+    }
+}
+
+void TreeModel::refresh()
+{
+    // Only the root and what is expanded are asked for, the sidebar costs what it shows
+    if (!m_rootNode) {
+        emit childrenRequested(QString());
+        return;
+    }
+
+    emit childrenRequested(m_rootNode->path);
+
+    QStringList paths;
+    collectExpandedPaths(m_rootNode, paths);
+    for (const QString &path : std::as_const(paths)) {
+        if (path != m_rootNode->path) {
+            emit childrenRequested(path);
         }
     }
+}
 
-    QModelIndex nodeModelIndex = index(nodeIndex, 0);
-    emit dataChanged(nodeModelIndex, nodeModelIndex, {IsExpandedRole});
+void TreeModel::insertVisibleDescendants(TreeNode *node)
+{
+    int nodeIndex = m_visibleNodes.indexOf(node);
+    int insertCount = countVisibleDescendants(node);
+
+    if (nodeIndex < 0 || insertCount == 0) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), nodeIndex + 1, nodeIndex + insertCount);
+
+    QList<TreeNode*> childNodes;
+    collectVisibleNodes(node, childNodes);
+
+    for (int i = 0; i < childNodes.count(); ++i) {
+        m_visibleNodes.insert(nodeIndex + 1 + i, childNodes[i]);
+    }
+
+    endInsertRows();
+}
+
+void TreeModel::removeVisibleDescendants(TreeNode *node)
+{
+    int nodeIndex = m_visibleNodes.indexOf(node);
+    int removeCount = countVisibleDescendants(node);
+
+    if (nodeIndex < 0 || removeCount == 0) {
+        return;
+    }
+
+    beginRemoveRows(QModelIndex(), nodeIndex + 1, nodeIndex + removeCount);
+
+    for (int i = 0; i < removeCount; ++i) {
+        m_visibleNodes.removeAt(nodeIndex + 1);
+    }
+
+    endRemoveRows();
 }
 
 void TreeModel::clear()